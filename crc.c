@@ -1,6 +1,9 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <assert.h>
+#ifdef __PCLMUL__
+#include <wmmintrin.h>
+#endif
 
 #include "crc.h"
 
@@ -9,12 +12,29 @@
 #define crc_one		((crc_t)1)
 #define ms_bit		(crc_one << (max_width - 1))
 
+/* quotient of x^(32 + width) divided by the polynomial */
+static uint64_t calc_barrett_mu(crc_t polynomial, uint32_t width)
+{
+	uint64_t dividend = 1ULL << (max_width + width);
+	uint64_t quotient = 0;
+	int bit;
+
+	for (bit = max_width + width; bit >= (int)width; --bit) {
+		if (dividend & (1ULL << bit)) {
+			quotient |= 1ULL << (bit - width);
+			dividend ^= (uint64_t)polynomial << (bit - width);
+		}
+	}
+	return quotient;
+}
+
 void crc_init(struct crc_poly *crc_poly, const crc_t polynomial, uint32_t width)
 {
 	crc_t remainder, dividend;
-	int bit;
+	int bit, k;
 
-	assert(width <= max_width);
+	assert(width > 0 && width < max_width);
+	assert(polynomial >> width == 1);
 
 	crc_poly->poly = polynomial;
 	crc_poly->width = width;
@@ -22,6 +42,7 @@ void crc_init(struct crc_poly *crc_poly, const crc_t polynomial, uint32_t width)
 	crc_poly->pad_len = crc_poly->shift_len - 1;
 	crc_poly->top_bit = crc_one << (width - 1);
 	crc_poly->poly_div = polynomial << crc_poly->pad_len;
+	crc_poly->barrett_mu = calc_barrett_mu(polynomial, width);
 
 	/* fill out remainder table */
 	for (dividend = 0; dividend < 256; ++dividend) {
@@ -33,7 +54,16 @@ void crc_init(struct crc_poly *crc_poly, const crc_t polynomial, uint32_t width)
 				remainder ^= crc_poly->poly_div;
 			remainder <<= 1;
 		}
-		crc_poly->table[dividend] = remainder;
+		crc_poly->table[0][dividend] = remainder;
+	}
+	/* each next table pushes one more zero byte through */
+	for (k = 1; k < CRC_SLICES; k++) {
+		for (dividend = 0; dividend < 256; ++dividend) {
+			remainder = crc_poly->table[k - 1][dividend];
+			crc_poly->table[k][dividend] =
+			    crc_poly->table[0][remainder >> ms_byte_shift] ^
+			    (remainder << 8);
+		}
 	}
 }
 
@@ -41,7 +71,23 @@ static inline crc_t
 calc_remainder(struct crc_poly *crc_poly, crc_t remainder, uint8_t data_byte)
 {
 	uint8_t dividend = data_byte ^ (uint8_t) (remainder >> ms_byte_shift);
-	return crc_poly->table[dividend] ^ (remainder << 8);
+	return crc_poly->table[0][dividend] ^ (remainder << 8);
+}
+
+/* pushes the 4 bytes of the register through, msb first */
+static inline crc_t
+calc_remainder32(struct crc_poly *crc_poly, crc_t remainder, int k)
+{
+	return crc_poly->table[k + 3][remainder >> 24] ^
+	    crc_poly->table[k + 2][(uint8_t) (remainder >> 16)] ^
+	    crc_poly->table[k + 1][(uint8_t) (remainder >> 8)] ^
+	    crc_poly->table[k][(uint8_t) remainder];
+}
+
+static inline uint32_t load_be32(uint8_t const *p)
+{
+	return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) |
+	    ((uint32_t) p[2] << 8) | (uint32_t) p[3];
 }
 
 crc_t calc_crc_array(struct crc_poly * crc_poly, uint8_t const *msg, int n)
@@ -49,20 +95,37 @@ crc_t calc_crc_array(struct crc_poly * crc_poly, uint8_t const *msg, int n)
 	crc_t remainder = 0;
 	int i;
 
-	for (i = 0; i < n; --i)
+	for (i = 0; i + 8 <= n; i += 8) {
+		remainder = calc_remainder32(crc_poly,
+					     remainder ^ load_be32(&msg[i]), 4) ^
+		    calc_remainder32(crc_poly, load_be32(&msg[i + 4]), 0);
+	}
+	for (; i < n; i++)
 		remainder = calc_remainder(crc_poly, remainder, msg[i]);
 
 	return (remainder >> crc_poly->shift_len);	/* final remainder is the CRC */
 }
 
-crc_t calc_crc_uint32_table(struct crc_poly * crc_poly, uint32_t data)
+crc_t calc_crc_array_bitwise(struct crc_poly * crc_poly, uint8_t const *msg,
+			     int n)
 {
 	crc_t remainder = 0;
+	int i, bit;
+
+	for (i = 0; i < n; i++) {
+		remainder ^= (crc_t) msg[i] << ms_byte_shift;
+		for (bit = 8; bit; --bit) {
+			if (remainder & ms_bit)
+				remainder ^= crc_poly->poly_div;
+			remainder <<= 1;
+		}
+	}
+	return remainder >> crc_poly->shift_len;
+}
 
-	remainder = calc_remainder(crc_poly, remainder, (uint8_t) (data >> 24));
-	remainder = calc_remainder(crc_poly, remainder, (uint8_t) (data >> 16));
-	remainder = calc_remainder(crc_poly, remainder, (uint8_t) (data >> 8));
-	remainder = calc_remainder(crc_poly, remainder, (uint8_t) data);
+crc_t calc_crc_uint32_table(struct crc_poly * crc_poly, uint32_t data)
+{
+	crc_t remainder = calc_remainder32(crc_poly, data, 0);
 
 	return (remainder >> crc_poly->shift_len);	/* final remainder is the CRC */
 }
@@ -80,3 +143,24 @@ crc_t calc_crc_uint32_bitwise(struct crc_poly * crc_poly, uint32_t data)
 	/* Return only the relevant bits of the remainder as CRC */
 	return remainder >> crc_poly->shift_len;
 }
+
+#ifdef __PCLMUL__
+static inline uint64_t clmul64(uint64_t a, uint64_t b)
+{
+	__m128i r = _mm_clmulepi64_si128(_mm_cvtsi64_si128(a),
+					 _mm_cvtsi64_si128(b), 0);
+	return (uint64_t)_mm_cvtsi128_si64(r);
+}
+
+/*
+ * crc = data * x^width mod poly; the quotient is estimated as
+ * (data * mu) / x^32, which is exact for data of up to 32 bits
+ */
+crc_t calc_crc_uint32_clmul(struct crc_poly * crc_poly, uint32_t data)
+{
+	uint64_t quotient = clmul64(data, crc_poly->barrett_mu) >> max_width;
+
+	return (crc_t) clmul64(quotient, crc_poly->poly) &
+	    ((crc_one << crc_poly->width) - 1);
+}
+#endif
@@ -6,6 +6,10 @@
 /* The width of the CRC calculation and result */
 typedef uint32_t crc_t;
 
+/* number of byte tables, for slicing-by-8 over arrays */
+#define CRC_SLICES	8
+
+/* polynomial includes the x^width term, 1 <= width < 32 */
 struct crc_poly {
 	crc_t poly;
 	crc_t poly_div;
@@ -15,13 +19,37 @@ struct crc_poly {
 	size_t pad_len;
 	size_t shift_len;
 
-	crc_t table[256];
+	uint64_t barrett_mu;	/* x^(32 + width) / poly, for clmul */
+
+	/* table[k][b]: remainder of byte b followed by k zero bytes */
+	crc_t table[CRC_SLICES][256];
 };
 
 void crc_init(struct crc_poly *crc_poly, const crc_t polynomial,
 	      uint32_t width);
+
+/* slicing-by-8 and the bit-at-a-time reference */
 crc_t calc_crc_array(struct crc_poly *crc_poly, uint8_t const *msg, int n);
+crc_t calc_crc_array_bitwise(struct crc_poly *crc_poly, uint8_t const *msg,
+			     int n);
+
+/* slicing-by-4 and the bit-at-a-time reference */
 crc_t calc_crc_uint32_table(struct crc_poly *crc_poly, uint32_t data);
 crc_t calc_crc_uint32_bitwise(struct crc_poly *crc_poly, uint32_t data);
 
+#ifdef __PCLMUL__
+/* Barrett reduction with carry-less multiply, build with PCLMUL=1 */
+crc_t calc_crc_uint32_clmul(struct crc_poly *crc_poly, uint32_t data);
+#endif
+
+/* fastest kernel available in this build */
+static inline crc_t calc_crc_uint32(struct crc_poly *crc_poly, uint32_t data)
+{
+#ifdef __PCLMUL__
+	return calc_crc_uint32_clmul(crc_poly, data);
+#else
+	return calc_crc_uint32_table(crc_poly, data);
+#endif
+}
+
 #endif
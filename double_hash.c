@@ -19,18 +19,68 @@ dhash_bucket_val_find(struct dhash_bucket *bucket, uint32_t val)
 	return -1;
 }
 
-int dhash_add(struct dhash_table *dhash, uint32_t val)
+static inline uint8_t *
+dhash_val_ptr(struct dhash_table *dhash, struct dhash_bucket *bucket, int i)
+{
+	size_t slot = (bucket - dhash->bucket) * NUM_BUCKET_VALS + i;
+
+	return dhash->val_tbl + slot * dhash->val_size;
+}
+
+static inline void
+dhash_calc_crc(struct dhash_table *dhash, uint32_t val, crc_t *crc_val)
+{
+	int p;
+
+	for (p = 0; p < dhash->num_poly; p++)
+		crc_val[p] = calc_crc_uint32(&dhash->crc_poly[p], val);
+}
+
+/* returns the bucket holding val and its index there, NULL if not found */
+static inline struct dhash_bucket *
+dhash_lookup_crc(struct dhash_table *dhash, uint32_t val,
+		 const crc_t *crc_val, int *index)
+{
+	struct dhash_bucket *bucket;
+	int p, i;
+
+	dhash->lookups++;
+	for (p = 0; p < dhash->num_poly; p++) {
+		bucket = &dhash->bucket[crc_val[p]];
+		i = dhash_bucket_val_find(bucket, val);
+		if (i >= 0) {
+			dhash->probes += p + 1;
+			*index = i;
+			return bucket;
+		}
+	}
+	dhash->probes += dhash->num_poly;
+	return NULL;
+}
+
+static inline struct dhash_bucket *
+dhash_lookup(struct dhash_table *dhash, uint32_t val, int *index)
+{
+	crc_t crc_val[MAX_POLY];
+
+	dhash_calc_crc(dhash, val, crc_val);
+	return dhash_lookup_crc(dhash, val, crc_val, index);
+}
+
+static int
+dhash_insert_crc(struct dhash_table *dhash, uint32_t val,
+		 const crc_t *crc_val, const void *map_val)
 {
 	struct dhash_bucket *bucket, *min_bucket = NULL;
-	crc_t crc_val;
 	int p;
 
 	if (!dhash->num_free)
 		return ENOSPC;
 
+	dhash->lookups++;
+	dhash->probes += dhash->num_poly;
 	for (p = 0; p < dhash->num_poly; p++) {
-		crc_val = calc_crc_uint32_table(&dhash->crc_poly[p], val);
-		bucket = &dhash->bucket[crc_val];
+		bucket = &dhash->bucket[crc_val[p]];
 		if (dhash_bucket_val_find(bucket, val) < 0) { /* not found */
 			if (!min_bucket || bucket->num < min_bucket->num)
 				min_bucket = bucket;
@@ -39,9 +89,16 @@ int dhash_add(struct dhash_table *dhash, uint32_t val)
 	}
 
 	if (min_bucket->num < NUM_BUCKET_VALS) {
+		if (map_val)
+			memcpy(dhash_val_ptr(dhash, min_bucket, min_bucket->num),
+			       map_val, dhash->val_size);
+		dhash->bucket_num[min_bucket->num]--;
 		min_bucket->val[min_bucket->num++] = val;
+		dhash->bucket_num[min_bucket->num]++;
 		if (min_bucket->num > dhash->bucket_abs_max)
 			dhash->bucket_abs_max = min_bucket->num;
+		if (min_bucket != &dhash->bucket[crc_val[0]])
+			dhash->displaced++;
 		dhash->num_free--;
 		return 0;
 	} else {
@@ -51,41 +108,192 @@ int dhash_add(struct dhash_table *dhash, uint32_t val)
 	}
 }
 
+static inline int
+dhash_insert(struct dhash_table *dhash, uint32_t val, const void *map_val)
+{
+	crc_t crc_val[MAX_POLY];
+
+	dhash_calc_crc(dhash, val, crc_val);
+	return dhash_insert_crc(dhash, val, crc_val, map_val);
+}
+
+static void
+dhash_remove(struct dhash_table *dhash, struct dhash_bucket *bucket, int i)
+{
+	int j;
+
+	for (j = i + 1; j < bucket->num; j++)
+		bucket->val[j - 1] = bucket->val[j];
+	if (dhash->val_tbl && i + 1 < bucket->num)
+		memmove(dhash_val_ptr(dhash, bucket, i),
+			dhash_val_ptr(dhash, bucket, i + 1),
+			(bucket->num - i - 1) * dhash->val_size);
+	dhash->bucket_num[bucket->num]--;
+	bucket->num--;
+	dhash->bucket_num[bucket->num]++;
+	dhash->num_free++;
+}
+
+int dhash_add(struct dhash_table *dhash, uint32_t val)
+{
+	return dhash_insert(dhash, val, NULL);
+}
+
 int dhash_find(struct dhash_table *dhash, uint32_t val)
+{
+	int i;
+
+	return dhash_lookup(dhash, val, &i) ? 0 : ENOENT;
+}
+
+int dhash_del(struct dhash_table *dhash, uint32_t val)
 {
 	struct dhash_bucket *bucket;
-	crc_t crc_val;
-	int p, i;
+	int i;
 
-	for (p = 0; p < dhash->num_poly; p++) {
-		crc_val = calc_crc_uint32_table(&dhash->crc_poly[p], val);
-		bucket = &dhash->bucket[crc_val];
-		i = dhash_bucket_val_find(bucket, val);
-		if (i >= 0)
-			return 0;
+	bucket = dhash_lookup(dhash, val, &i);
+	if (!bucket)
+		return ENOENT;
+	dhash_remove(dhash, bucket, i);
+	return 0;
+}
+
+int dhash_map_add(struct dhash_table *dhash, uint32_t key, const void *val)
+{
+	assert(dhash->val_tbl && val);
+	return dhash_insert(dhash, key, val);
+}
+
+void *dhash_map_find(struct dhash_table *dhash, uint32_t key)
+{
+	struct dhash_bucket *bucket;
+	int i;
+
+	bucket = dhash_lookup(dhash, key, &i);
+	return bucket ? dhash_val_ptr(dhash, bucket, i) : NULL;
+}
+
+int dhash_map_del(struct dhash_table *dhash, uint32_t key, void *val)
+{
+	struct dhash_bucket *bucket;
+	int i;
+
+	bucket = dhash_lookup(dhash, key, &i);
+	if (!bucket)
+		return ENOENT;
+	if (val)
+		memcpy(val, dhash_val_ptr(dhash, bucket, i), dhash->val_size);
+	dhash_remove(dhash, bucket, i);
+	return 0;
+}
+
+void dhash_map_walk(struct dhash_table *dhash,
+		    void (*fn)(uint32_t key, void *val, void *arg), void *arg)
+{
+	struct dhash_bucket *bucket;
+	size_t b;
+	int i;
+
+	for (b = 0; b < dhash->num_crc_vals; b++) {
+		bucket = &dhash->bucket[b];
+		for (i = 0; i < bucket->num; i++)
+			fn(bucket->val[i], dhash_val_ptr(dhash, bucket, i), arg);
 	}
-	return ENOENT;
 }
 
-int dhash_del(struct dhash_table *dhash, uint32_t val)
+/*
+ * Batched calls: hash a group of values and prefetch all their candidate
+ * buckets first, so the cache misses overlap, then resolve the values in
+ * their original order (results are the same as of the sequential calls).
+ */
+
+struct dhash_batch {
+	size_t n;
+	crc_t crc_val[DHASH_BATCH_MAX][MAX_POLY];
+};
+
+static inline void
+dhash_batch_prepare(struct dhash_table *dhash, struct dhash_batch *b,
+		    const uint32_t *val, size_t n, int rw)
+{
+	size_t i;
+	int p;
+
+	b->n = (n < DHASH_BATCH_MAX) ? n : DHASH_BATCH_MAX;
+	for (i = 0; i < b->n; i++) {
+		dhash_calc_crc(dhash, val[i], b->crc_val[i]);
+		for (p = 0; p < dhash->num_poly; p++) {
+			const void *addr = &dhash->bucket[b->crc_val[i][p]];
+
+			/* rw must be a compile time constant, also at -O0 */
+			if (rw)
+				__builtin_prefetch(addr, 1, 1);
+			else
+				__builtin_prefetch(addr, 0, 1);
+		}
+	}
+}
+
+void dhash_prefetch_batch(struct dhash_table *dhash, const uint32_t *val,
+			  size_t n)
+{
+	struct dhash_batch b;
+	size_t done;
+
+	for (done = 0; done < n; done += b.n)
+		dhash_batch_prepare(dhash, &b, val + done, n - done, 0);
+}
+
+void dhash_find_batch(struct dhash_table *dhash, const uint32_t *val,
+		      int *err, size_t n)
+{
+	struct dhash_batch b;
+	size_t i, done;
+	int index;
+
+	for (done = 0; done < n; done += b.n) {
+		dhash_batch_prepare(dhash, &b, val + done, n - done, 0);
+		for (i = 0; i < b.n; i++)
+			err[done + i] = dhash_lookup_crc(dhash, val[done + i],
+						b.crc_val[i], &index) ?
+						0 : ENOENT;
+	}
+}
+
+void dhash_add_batch(struct dhash_table *dhash, const uint32_t *val,
+		     int *err, size_t n)
+{
+	struct dhash_batch b;
+	size_t i, done;
+
+	for (done = 0; done < n; done += b.n) {
+		dhash_batch_prepare(dhash, &b, val + done, n - done, 1);
+		for (i = 0; i < b.n; i++)
+			err[done + i] = dhash_insert_crc(dhash, val[done + i],
+							 b.crc_val[i], NULL);
+	}
+}
+
+void dhash_del_batch(struct dhash_table *dhash, const uint32_t *val,
+		     int *err, size_t n)
 {
 	struct dhash_bucket *bucket;
-	crc_t crc_val;
-	int p, i, j;
+	struct dhash_batch b;
+	size_t i, done;
+	int index;
 
-	for (p = 0; p < dhash->num_poly; p++) {
-		crc_val = calc_crc_uint32_table(&dhash->crc_poly[p], val);
-		bucket = &dhash->bucket[crc_val];
-		i = dhash_bucket_val_find(bucket, val);
-		if (i >= 0) {
-			for (j = i + 1; j < bucket->num; j++)
-				bucket->val[j - 1] = bucket->val[j];
-			bucket->num--;
-			dhash->num_free++;
-			return 0;
+	for (done = 0; done < n; done += b.n) {
+		dhash_batch_prepare(dhash, &b, val + done, n - done, 1);
+		for (i = 0; i < b.n; i++) {
+			bucket = dhash_lookup_crc(dhash, val[done + i],
+						  b.crc_val[i], &index);
+			if (bucket) {
+				dhash_remove(dhash, bucket, index);
+				err[done + i] = 0;
+			} else
+				err[done + i] = ENOENT;
 		}
 	}
-	return ENOENT;
 }
 
 static inline size_t dhash_sz(struct dhash_table *dhash)
@@ -107,7 +315,8 @@ dhash_init(struct dhash_table *dhash, size_t crc_width,
 
 	dhash->crc_width = crc_width;
 	dhash->num_crc_vals = 1 << crc_width;
-	dhash->num_free = dhash->num_crc_vals * NUM_BUCKET_VALS;
+	dhash->val_size = 0;
+	dhash->val_tbl = NULL;
 
 	dhash->bucket = malloc(dhash_sz(dhash));
 	if (!dhash->bucket) {
@@ -118,15 +327,47 @@ dhash_init(struct dhash_table *dhash, size_t crc_width,
 	return 0;
 }
 
+int
+dhash_map_init(struct dhash_table *dhash, size_t crc_width,
+	       const uint32_t * poly, int npoly, size_t val_size)
+{
+	int err;
+
+	assert(val_size > 0);
+
+	err = dhash_init(dhash, crc_width, poly, npoly);
+	if (err)
+		return err;
+
+	dhash->val_size = val_size;
+	dhash->val_tbl = calloc(dhash->num_crc_vals * NUM_BUCKET_VALS,
+				val_size);
+	if (!dhash->val_tbl) {
+		printf("failed to alloc map values table\n");
+		dhash_cleanup(dhash);
+		return ENOMEM;
+	}
+	return 0;
+}
+
 void dhash_reset(struct dhash_table *dhash)
 {
 	if (dhash->bucket)
 		memset(dhash->bucket, 0, dhash_sz(dhash));
+
+	dhash->num_free = dhash->num_crc_vals * NUM_BUCKET_VALS;
+	dhash->bucket_abs_max = 0;
+	memset(dhash->bucket_num, 0, sizeof(dhash->bucket_num));
+	dhash->bucket_num[0] = dhash->num_crc_vals;
+	dhash->lookups = 0;
+	dhash->probes = 0;
+	dhash->displaced = 0;
 }
 
 void dhash_cleanup(struct dhash_table *dhash)
 {
 	free(dhash->bucket);
+	free(dhash->val_tbl);
 	memset(dhash, 0, sizeof(*dhash));
 }
 
@@ -138,10 +379,9 @@ void dhash_stat(struct dhash_table *dhash, struct dhash_stat *s)
 	    dhash->num_free;
 	s->bucket_abs_max = dhash->bucket_abs_max;
 
-	for (i = 0; i <= NUM_BUCKET_VALS; i++)	/* initial reset */
-		s->bucket_num[i] = 0;
-	for (i = 0; i < dhash->num_crc_vals; i++) {	/* count values */
-		assert(dhash->bucket[i].num <= NUM_BUCKET_VALS);
-		s->bucket_num[dhash->bucket[i].num]++;
-	}
+	for (i = 0; i <= NUM_BUCKET_VALS; i++)
+		s->bucket_num[i] = dhash->bucket_num[i];
+	s->lookups = dhash->lookups;
+	s->probes = dhash->probes;
+	s->displaced = dhash->displaced;
 }
@@ -16,6 +16,7 @@ extern "C" {
 
 #define NUM_BUCKET_VALS	6
 #define MAX_POLY	3
+#define DHASH_BATCH_MAX	32
 
 	struct dhash_bucket {
 		uint32_t num;
@@ -37,7 +38,14 @@ extern "C" {
 		size_t bucket_min;
 		size_t bucket_max;
 		size_t bucket_abs_max;
+		/* maintained by add/del, buckets per fill level */
+		size_t bucket_num[NUM_BUCKET_VALS + 1];
+		unsigned long long lookups;	/* find, del and add calls */
+		unsigned long long probes;	/* buckets scanned by lookups */
+		unsigned long long displaced;	/* not added to 1st bucket */
 		struct dhash_bucket *bucket;
+		size_t val_size;	/* map mode only, 0 for a plain set */
+		uint8_t *val_tbl;	/* map mode values, parallel to buckets */
 	};
 
 	int dhash_init(struct dhash_table *dhash, size_t crc_width,
@@ -62,11 +70,57 @@ extern "C" {
 /* clear all hash entries */
 	void dhash_reset(struct dhash_table *dhash);
 
-/* get statistics */
+/*
+ * Batched calls: the candidate buckets of all the values are prefetched
+ * before any of them is resolved; values are processed in array order,
+ * per-value results are the same as of dhash_find/add/del()
+ */
+	void dhash_find_batch(struct dhash_table *dhash, const uint32_t *val,
+			      int *err, size_t n);
+	void dhash_add_batch(struct dhash_table *dhash, const uint32_t *val,
+			     int *err, size_t n);
+	void dhash_del_batch(struct dhash_table *dhash, const uint32_t *val,
+			     int *err, size_t n);
+
+/* only prefetch, for callers mixing different calls on the values */
+	void dhash_prefetch_batch(struct dhash_table *dhash,
+				  const uint32_t *val, size_t n);
+
+/*
+ * Map mode: every key carries a fixed-size value (order state, or a slot
+ * index into a caller's slab). Keys stay packed in the buckets, values live
+ * in a separate table, so the probes touch only the key cache lines.
+ */
+	int dhash_map_init(struct dhash_table *dhash, size_t crc_width,
+			   const uint32_t * poly, int npoly, size_t val_size);
+
+/* same return values as dhash_add(), val is copied into the table */
+	int dhash_map_add(struct dhash_table *dhash, uint32_t key,
+			  const void *val);
+
+/* returns pointer to the value stored with the key,
+ * NULL when not in hash; valid until the next add/del */
+	void *dhash_map_find(struct dhash_table *dhash, uint32_t key);
+
+/* returns 0 on success, copies the value out if val is not NULL,
+ * ENOENT when not in hash */
+	int dhash_map_del(struct dhash_table *dhash, uint32_t key, void *val);
+
+/* calls fn for every key with its value, in table order;
+ * fn may change the value but not add or delete keys */
+	void dhash_map_walk(struct dhash_table *dhash,
+			    void (*fn)(uint32_t key, void *val, void *arg),
+			    void *arg);
+
+/* get statistics: a snapshot of the counters kept up to date
+ * by add/del, O(1) - cheap enough for periodic reporting */
 	struct dhash_stat {
 		uint32_t num_entries;	/* current */
 		uint32_t bucket_abs_max;	/* max since reset */
 		uint32_t bucket_num[NUM_BUCKET_VALS + 1];
+		unsigned long long lookups;	/* since reset */
+		unsigned long long probes;
+		unsigned long long displaced;
 	};
 
 	void dhash_stat(struct dhash_table *dhash, struct dhash_stat *s);
@@ -0,0 +1,306 @@
+/*
+ * File:   double_hash_mt.c
+ * Summary: multi-threaded variant of the double hash table
+ *
+ * Lookups take no locks: a bucket is read between two samples of its
+ * stripe's sequence counter and re-read if a delete has been moving values
+ * in the meantime. Adds append a value and publish it with a release store
+ * of the bucket counter, so they never disturb concurrent readers.
+ * Updates lock the stripes of all the candidate buckets of the value (in
+ * ascending order), which also keeps two threads from adding the same
+ * value into different buckets.
+ *
+ * Author: Alexander Nezhinsky (nezhinsky@gmail.com)
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+
+#include "crc.h"
+#include "double_hash_mt.h"
+
+#define DHASH_MT_SPINS	64
+
+/* spin a little, then give the cpu away: a preempted lock holder
+ * should not make the waiters burn their entire time slice */
+static inline void cpu_relax(unsigned int *spins)
+{
+	if (++(*spins) < DHASH_MT_SPINS) {
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#endif
+	} else {
+		*spins = 0;
+		sched_yield();
+	}
+}
+
+static inline void stripe_lock(struct dhash_mt_stripe *stripe)
+{
+	unsigned int spins = 0;
+
+	while (__atomic_exchange_n(&stripe->lock, 1, __ATOMIC_ACQUIRE)) {
+		while (__atomic_load_n(&stripe->lock, __ATOMIC_RELAXED))
+			cpu_relax(&spins);
+	}
+}
+
+static inline void stripe_unlock(struct dhash_mt_stripe *stripe)
+{
+	__atomic_store_n(&stripe->lock, 0, __ATOMIC_RELEASE);
+}
+
+static inline struct dhash_mt_stripe *
+dhash_mt_stripe(struct dhash_mt_table *mt, crc_t crc_val)
+{
+	return &mt->stripe[crc_val & mt->stripe_mask];
+}
+
+static inline int
+dhash_mt_bucket_find(struct dhash_bucket *bucket, uint32_t val)
+{
+	uint32_t i, num = __atomic_load_n(&bucket->num, __ATOMIC_ACQUIRE);
+
+	for (i = 0; i < num && i < NUM_BUCKET_VALS; i++) {
+		if (__atomic_load_n(&bucket->val[i], __ATOMIC_RELAXED) == val)
+			return i;
+	}
+	return -1;
+}
+
+/* lock the distinct stripes in ascending order, returns their number */
+static int
+dhash_mt_lock(struct dhash_mt_table *mt, const crc_t *crc_val, int n,
+	      struct dhash_mt_stripe **locked)
+{
+	struct dhash_mt_stripe *s;
+	int i, j, num = 0;
+
+	for (i = 0; i < n; i++) {
+		s = dhash_mt_stripe(mt, crc_val[i]);
+		for (j = 0; j < num && locked[j] < s; j++)
+			;
+		if (j < num && locked[j] == s)
+			continue;	/* already there */
+		memmove(&locked[j + 1], &locked[j],
+			(num - j) * sizeof(locked[0]));
+		locked[j] = s;
+		num++;
+	}
+	for (i = 0; i < num; i++)
+		stripe_lock(locked[i]);
+	return num;
+}
+
+static void
+dhash_mt_unlock(struct dhash_mt_stripe **locked, int num)
+{
+	while (num--)
+		stripe_unlock(locked[num]);
+}
+
+/* take one free slot, keeps num_free from ever wrapping */
+static int dhash_mt_reserve(struct dhash_mt_table *mt)
+{
+	size_t nfree = __atomic_load_n(&mt->dhash.num_free, __ATOMIC_RELAXED);
+
+	do {
+		if (!nfree)
+			return ENOSPC;
+	} while (!__atomic_compare_exchange_n(&mt->dhash.num_free, &nfree,
+					      nfree - 1, 1, __ATOMIC_RELAXED,
+					      __ATOMIC_RELAXED));
+	return 0;
+}
+
+static void dhash_mt_update_max(struct dhash_mt_table *mt, size_t num)
+{
+	size_t cur_max = __atomic_load_n(&mt->dhash.bucket_abs_max,
+					 __ATOMIC_RELAXED);
+
+	while (num > cur_max &&
+	       !__atomic_compare_exchange_n(&mt->dhash.bucket_abs_max,
+					    &cur_max, num, 1, __ATOMIC_RELAXED,
+					    __ATOMIC_RELAXED))
+		;
+}
+
+int dhash_mt_add(struct dhash_mt_table *mt, uint32_t val)
+{
+	struct dhash_table *dhash = &mt->dhash;
+	struct dhash_mt_stripe *locked[MAX_POLY], *stripe;
+	struct dhash_bucket *bucket, *min_bucket = NULL;
+	crc_t crc_val[MAX_POLY];
+	int p, num_locked, err = 0;
+
+	err = dhash_mt_reserve(mt);
+	if (err)
+		return err;
+
+	for (p = 0; p < dhash->num_poly; p++)
+		crc_val[p] = calc_crc_uint32(&dhash->crc_poly[p], val);
+
+	num_locked = dhash_mt_lock(mt, crc_val, dhash->num_poly, locked);
+
+	for (p = 0; p < dhash->num_poly; p++) {
+		bucket = &dhash->bucket[crc_val[p]];
+		if (dhash_mt_bucket_find(bucket, val) >= 0) {
+			err = EEXIST;
+			goto out;
+		}
+		if (!min_bucket || bucket->num < min_bucket->num)
+			min_bucket = bucket;
+	}
+
+	if (min_bucket->num < NUM_BUCKET_VALS) {
+		stripe = dhash_mt_stripe(mt, min_bucket - dhash->bucket);
+		stripe->bucket_num[min_bucket->num]--;
+		stripe->bucket_num[min_bucket->num + 1]++;
+		if (min_bucket != &dhash->bucket[crc_val[0]])
+			stripe->displaced++;
+		__atomic_store_n(&min_bucket->val[min_bucket->num], val,
+				 __ATOMIC_RELAXED);
+		__atomic_store_n(&min_bucket->num, min_bucket->num + 1,
+				 __ATOMIC_RELEASE);
+		dhash_mt_update_max(mt, min_bucket->num);
+	} else {
+		printf("bucket:0x%zx val:0x%x overflow, cur:%d vals\n",
+		       min_bucket - dhash->bucket, val, min_bucket->num);
+		err = ENOMEM;
+	}
+out:
+	dhash_mt_unlock(locked, num_locked);
+	if (err)	/* return the reserved slot */
+		__atomic_fetch_add(&dhash->num_free, 1, __ATOMIC_RELAXED);
+	return err;
+}
+
+int dhash_mt_find(struct dhash_mt_table *mt, uint32_t val)
+{
+	struct dhash_table *dhash = &mt->dhash;
+	struct dhash_mt_stripe *stripe;
+	struct dhash_bucket *bucket;
+	crc_t crc_val;
+	unsigned int spins = 0;
+	uint32_t seq;
+	int p, i;
+
+	for (p = 0; p < dhash->num_poly; p++) {
+		crc_val = calc_crc_uint32(&dhash->crc_poly[p], val);
+		bucket = &dhash->bucket[crc_val];
+		stripe = dhash_mt_stripe(mt, crc_val);
+		for (;;) {
+			seq = __atomic_load_n(&stripe->seq, __ATOMIC_ACQUIRE);
+			if (seq & 1) {	/* delete in progress */
+				cpu_relax(&spins);
+				continue;
+			}
+			i = dhash_mt_bucket_find(bucket, val);
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (seq == __atomic_load_n(&stripe->seq,
+						   __ATOMIC_RELAXED))
+				break;
+		}
+		if (i >= 0)
+			return 0;
+	}
+	return ENOENT;
+}
+
+int dhash_mt_del(struct dhash_mt_table *mt, uint32_t val)
+{
+	struct dhash_table *dhash = &mt->dhash;
+	struct dhash_mt_stripe *stripe;
+	struct dhash_bucket *bucket;
+	crc_t crc_val;
+	int p, i, j;
+
+	for (p = 0; p < dhash->num_poly; p++) {
+		crc_val = calc_crc_uint32(&dhash->crc_poly[p], val);
+		bucket = &dhash->bucket[crc_val];
+		stripe = dhash_mt_stripe(mt, crc_val);
+
+		stripe_lock(stripe);
+		i = dhash_mt_bucket_find(bucket, val);
+		if (i < 0) {
+			stripe_unlock(stripe);
+			continue;
+		}
+		__atomic_store_n(&stripe->seq, stripe->seq + 1,
+				 __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		for (j = i + 1; j < bucket->num; j++)
+			__atomic_store_n(&bucket->val[j - 1], bucket->val[j],
+					 __ATOMIC_RELAXED);
+		__atomic_store_n(&bucket->num, bucket->num - 1,
+				 __ATOMIC_RELAXED);
+		stripe->bucket_num[bucket->num + 1]--;
+		stripe->bucket_num[bucket->num]++;
+		__atomic_store_n(&stripe->seq, stripe->seq + 1,
+				 __ATOMIC_RELEASE);
+		stripe_unlock(stripe);
+
+		__atomic_fetch_add(&dhash->num_free, 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+	return ENOENT;
+}
+
+int dhash_mt_init(struct dhash_mt_table *mt, size_t crc_width,
+		  const uint32_t * poly, int npoly)
+{
+	size_t i, num_stripes;
+	int err;
+
+	err = dhash_init(&mt->dhash, crc_width, poly, npoly);
+	if (err)
+		return err;
+
+	num_stripes = 1 << DHASH_MT_STRIPE_SHIFT;
+	if (num_stripes > mt->dhash.num_crc_vals)
+		num_stripes = mt->dhash.num_crc_vals;
+	mt->stripe_mask = num_stripes - 1;
+
+	err = posix_memalign((void **)&mt->stripe, sizeof(*mt->stripe),
+			     num_stripes * sizeof(*mt->stripe));
+	if (err) {
+		printf("failed to alloc hash lock stripes\n");
+		dhash_cleanup(&mt->dhash);
+		return ENOMEM;
+	}
+	memset(mt->stripe, 0, num_stripes * sizeof(*mt->stripe));
+	for (i = 0; i < num_stripes; i++)
+		mt->stripe[i].bucket_num[0] = mt->dhash.num_crc_vals /
+		    num_stripes;
+	return 0;
+}
+
+void dhash_mt_cleanup(struct dhash_mt_table *mt)
+{
+	free(mt->stripe);
+	dhash_cleanup(&mt->dhash);
+	memset(mt, 0, sizeof(*mt));
+}
+
+void dhash_mt_stat(struct dhash_mt_table *mt, struct dhash_stat *s)
+{
+	struct dhash_mt_stripe *stripe;
+	size_t i;
+	int j;
+
+	dhash_stat(&mt->dhash, s);
+	memset(s->bucket_num, 0, sizeof(s->bucket_num));
+	s->displaced = 0;
+	for (i = 0; i <= mt->stripe_mask; i++) {
+		stripe = &mt->stripe[i];
+		for (j = 0; j <= NUM_BUCKET_VALS; j++)
+			s->bucket_num[j] += __atomic_load_n(&stripe->bucket_num[j],
+							    __ATOMIC_RELAXED);
+		s->displaced += __atomic_load_n(&stripe->displaced,
+						__ATOMIC_RELAXED);
+	}
+}
@@ -0,0 +1,56 @@
+/*
+ * File:   double_hash_mt.h
+ * Summary: multi-threaded variant of the double hash table,
+ *          lock-free lookups and striped locks for updates
+ * Author: Alexander Nezhinsky (nezhinsky@gmail.com)
+ */
+
+#ifndef DOUBLE_HASH_MT_H
+#define	DOUBLE_HASH_MT_H
+
+#include "double_hash.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define DHASH_MT_STRIPE_SHIFT	10
+
+/* a stripe covers every bucket with the same low index bits;
+ * seq is odd while a writer moves values inside one of its buckets,
+ * bucket_num[] is the fill histogram of its buckets, under lock */
+	struct dhash_mt_stripe {
+		uint32_t lock;
+		uint32_t seq;
+		uint32_t bucket_num[NUM_BUCKET_VALS + 1];
+		uint32_t displaced;
+	} __attribute__ ((aligned(64)));
+
+	struct dhash_mt_table {
+		struct dhash_table dhash;	/* num_free updated atomically */
+		size_t stripe_mask;
+		struct dhash_mt_stripe *stripe;
+	};
+
+	int dhash_mt_init(struct dhash_mt_table *mt, size_t crc_width,
+			  const uint32_t * poly, int npoly);
+	void dhash_mt_cleanup(struct dhash_mt_table *mt);
+
+/* same return values as dhash_add(), safe against concurrent add/del */
+	int dhash_mt_add(struct dhash_mt_table *mt, uint32_t val);
+
+/* returns 0 on success, ENOENT when not in hash;
+ * takes no locks, retries when a delete reshuffles the bucket */
+	int dhash_mt_find(struct dhash_mt_table *mt, uint32_t val);
+
+/* returns 0 on success, ENOENT when not in hash */
+	int dhash_mt_del(struct dhash_mt_table *mt, uint32_t val);
+
+/* sums the per-stripe counters, not synchronized with the writers;
+ * lookups and probes are not counted by the mt variant */
+	void dhash_mt_stat(struct dhash_mt_table *mt, struct dhash_stat *s);
+
+#ifdef	__cplusplus
+}
+#endif
+#endif				/* DOUBLE_HASH_MT_H */
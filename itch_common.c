@@ -40,6 +40,9 @@
 #include <endian.h>
 #include <getopt.h>
 #include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "itch_proto.h"
 #include "itchygen.h"
@@ -90,73 +93,76 @@ const char *trade_outcome_str(enum order_event_type type)
 	}
 }
 
-void print_order_add(struct order_event *order)
+void print_order_add(struct symbol_table *tbl, struct order_rec *order,
+		struct order_event *event)
 {
 	printf
-	    ("time: %u.%09u %s ADD order ref: %lld shares: %d price: %d, req: %s\n",
-	     order->t_sec, order->t_nsec,
-	     order->symbol->name, order->ref_num,
-	     order->add.shares, order->add.price,
-	     order->add.buy ? "BUY" : "SELL");
+	    ("time: %u.%09u %s ADD order ref: %u shares: %u price: %u, req: %s\n",
+	     order_event_sec(event), order_event_nsec(event),
+	     tbl->name[order->locate], order->ref_num,
+	     event->shares, event->price,
+	     event->add.buy ? "BUY" : "SELL");
 }
 
-void print_order_exec(struct order_event *event)
+void print_order_exec(struct symbol_table *tbl, struct order_rec *order,
+		struct order_event *event)
 {
-	struct order_event *order = event->exec.order;
-	printf("time: %u.%09u %s %s order ref: %lld shares: %d price: %d "
-	       "match: %lld, remains: %d\n",
-	       event->t_sec, event->t_nsec, order->symbol->name,
-	       trade_outcome_str(event->type),
-	       order->ref_num, event->exec.shares, event->exec.price,
-	       event->exec.match_num, event->remain_shares);
+	printf("time: %u.%09u %s %s order ref: %u shares: %u price: %u "
+	       "match: %" PRIu64 ", remains: %u\n",
+	       order_event_sec(event), order_event_nsec(event),
+	       tbl->name[order->locate], trade_outcome_str(event->type),
+	       order->ref_num, event->shares, event->price,
+	       event->exec.match_num, order->remain_shares);
 }
 
-void print_order_cancel(struct order_event *event)
+void print_order_cancel(struct symbol_table *tbl, struct order_rec *order,
+		struct order_event *event)
 {
-	struct order_event *order = event->cancel.order;
-	printf("time: %u.%09u %s %s order ref: %lld shares: %d, remains: %d\n",
-	       event->t_sec, event->t_nsec, order->symbol->name,
-	       trade_outcome_str(event->type),
-	       order->ref_num, event->cancel.shares, event->remain_shares);
+	printf("time: %u.%09u %s %s order ref: %u shares: %u, remains: %u\n",
+	       order_event_sec(event), order_event_nsec(event),
+	       tbl->name[order->locate], trade_outcome_str(event->type),
+	       order->ref_num, event->shares, order->remain_shares);
 }
 
-void print_order_replace(struct order_event *event)
+void print_order_replace(struct symbol_table *tbl, struct order_rec *order,
+		struct order_event *event)
 {
-	struct order_event *order = event->replace.order;
 	printf
-	    ("time: %u.%09u %s %s order ref: %lld -> %lld shares: %d price: %d\n",
-	     event->t_sec, event->t_nsec,
-	     order->symbol->name, trade_outcome_str(event->type),
-	     event->replace.orig_ref_num, event->ref_num, event->replace.shares,
-	     event->replace.price);
+	    ("time: %u.%09u %s %s order ref: %u -> %u shares: %u price: %u\n",
+	     order_event_sec(event), order_event_nsec(event),
+	     tbl->name[order->locate], trade_outcome_str(event->type),
+	     order->ref_num, event->replace.new_ref_num, event->shares,
+	     event->price);
 }
 
 void print_order_timestamp(struct order_event *event)
 {
-	printf("time: %u.%09u timestamp: %d sec\n",
-	       event->t_sec, event->t_nsec, event->timestamp.seconds);
+	printf("time: %u.%09u timestamp: %u sec\n",
+	       order_event_sec(event), order_event_nsec(event),
+	       event->timestamp.seconds);
 }
 
-void order_event_print(struct order_event *event,
-		char *prefix, int print_seq_num)
+void order_event_print(struct symbol_table *tbl, struct order_rec *order,
+		struct order_event *event, char *prefix,
+		const unsigned long long *seq_num)
 {
-	if (!print_seq_num)
+	if (!seq_num)
 		printf("%s ", prefix);
 	else
-		printf("%s %lld ", prefix, event->seq_num);
+		printf("%s %lld ", prefix, *seq_num);
 
 	switch (event->type) {
 	case ORDER_ADD:
-		print_order_add(event);
+		print_order_add(tbl, order, event);
 		break;
 	case ORDER_EXEC:
-		print_order_exec(event);
+		print_order_exec(tbl, order, event);
 		break;
 	case ORDER_CANCEL:
-		print_order_cancel(event);
+		print_order_cancel(tbl, order, event);
 		break;
 	case ORDER_REPLACE:
-		print_order_replace(event);
+		print_order_replace(tbl, order, event);
 		break;
 	case ORDER_TIMESTAMP:
 		print_order_timestamp(event);
@@ -206,7 +212,10 @@ void print_stats(struct itchygen_stat *s, struct dhash_table *dhash)
 	printf("\tbucket ");
 	for (i = 0; i <= NUM_BUCKET_VALS; i++)
 		printf("num[%d]:%d ", i, ds.bucket_num[i]);
-	printf("\n\n");
+	printf("\n");
+	printf("\tlookups: %llu, avg. probes: %.3f, displaced adds: %llu\n\n",
+	       ds.lookups, ds.lookups ? (double)ds.probes / ds.lookups : 0.0,
+	       ds.displaced);
 }
 
 static struct rand_interval symbol_len_rand_int[2];	/* len: 3, 4 */
@@ -241,115 +250,354 @@ void symbol_name_generator_init(void)
 	rand_interval_init(symbol_len_rand_int, 2);
 }
 
-static void load_symbol_file(struct symbols_file * sym, int print_warn)
+static void symbol_file_grow(struct symbols_file * sym, unsigned int *max)
 {
-	int i = 0, ln = 0;
-	char *lf, *comma;
-	char line[4096];
+	struct trade_symbol *symbol;
 
-	while (fgets(line, sizeof(line), sym->fh)) {
-		sym->num_lines++;
-	}
-	fseek(sym->fh, 0, SEEK_SET);
-
-	sym->symbol = calloc(sym->num_lines, sizeof(*sym->symbol));
-	if (!sym->symbol) {
-		printf("failed to alloc %d symbol names\n", sym->num_lines);
+	*max = *max ? 2 * *max : 1024;
+	symbol = realloc(sym->symbol, *max * sizeof(*sym->symbol));
+	if (!symbol) {
+		printf("failed to alloc %d symbol names\n", *max);
 		exit(ENOMEM);
 	}
+	sym->symbol = symbol;
+}
+
+/* one pass over the mapped csv, the symbol is the first field */
+static void load_symbol_file(struct symbols_file * sym, const char *buf,
+			     size_t len, int print_warn)
+{
+	const char *line = buf, *end = buf + len, *lf, *cr, *comma;
+	char name[ITCH_SYMBOL_LEN + 1];
+	unsigned int max_symbols = 0;
+	size_t line_len;
 
-	while (fgets(line, sizeof(line), sym->fh)) {
-		ln++;
+	while (line < end) {
+		sym->num_lines++;
 
-		lf = strchr(line, '\n');
-		if (lf)
-			*lf = '\0';
-		lf = strchr(line, '\r');
-		if (lf)
-			*lf = '\0';
+		lf = memchr(line, '\n', end - line);
+		line_len = (lf ? lf : end) - line;
+		cr = memchr(line, '\r', line_len);
+		if (cr)
+			line_len = cr - line;
 
-		comma = strchr(line, ',');
+		comma = memchr(line, ',', line_len);
 		if (likely(comma != NULL)) {
-			*comma = '\0';
-			if (strlen(line) < 5)
-				symbol_name_init(&sym->symbol[i++], line);
-			else if (print_warn)
+			if (comma - line <= ITCH_SYMBOL_LEN) {
+				if (sym->num_symbols == max_symbols)
+					symbol_file_grow(sym, &max_symbols);
+				memcpy(name, line, comma - line);
+				name[comma - line] = '\0';
+				symbol_name_init(&sym->symbol[sym->num_symbols++],
+						 name);
+			} else if (print_warn)
 				printf("%s +%d symbol longer than "
-					"4 chars: [%s]\n",
-					sym->fname, ln, line);
+					"%d chars: [%.*s]\n",
+					sym->fname, sym->num_lines,
+					ITCH_SYMBOL_LEN, (int)(comma - line),
+					line);
 		} else if (print_warn)
-			printf("%s +%d unexpected format: [%s]\n",
-				sym->fname, ln, line);
+			printf("%s +%d unexpected format: [%.*s]\n",
+				sym->fname, sym->num_lines, (int)line_len,
+				line);
+
+		line = lf ? lf + 1 : end;
 	}
-	sym->num_symbols = i;
-	assert(sym->num_lines == ln);
 }
 
-int read_symbol_file(struct symbols_file * sym, int print_warn)
+/*
+ * Parsed symbol names are cached in <cache dir>/<csv file name>.cache, if
+ * a cache dir is given, valid as long as the csv size and mtime match. Only the names are kept: price bands
+ * are drawn again, so the seeded random sequence stays the same.
+ */
+
+#define SYMBOL_CACHE_MAGIC	0x454843414d5953ULL	/* "SYMACHE" */
+#define SYMBOL_CACHE_VERSION	1
+
+struct symbol_cache_hdr {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t name_len;
+	uint64_t csv_size;
+	int64_t csv_mtime_sec;
+	int64_t csv_mtime_nsec;
+	uint32_t num_lines;
+	uint32_t num_symbols;
+};	/* followed by num_symbols names of name_len bytes each */
+
+/* the base name keeps it readable, the hash (FNV-1a) of the full path
+ * tells apart same-named csv files from different directories */
+static char *symbol_cache_fname(struct symbols_file * sym)
 {
-	assert(sym->fname);
-	sym->fh = fopen(sym->fname, "r");
-	if (!sym->fh) {
-		perror(sym->fname);
+	char *path, *fname;
+	const char *p;
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	int ret;
+
+	path = realpath(sym->fname, NULL);
+	for (p = path ? path : sym->fname; *p; p++)
+		hash = (hash ^ (uint8_t)*p) * 0x100000001b3ULL;
+	free(path);
+
+	ret = asprintf(&fname, "%s/%s.%016" PRIx64 ".cache", sym->cache_dir,
+		       basename(sym->fname), hash);
+	if (ret < 0)
+		return NULL;
+	return fname;
+}
+
+static int load_symbol_cache(struct symbols_file * sym, struct stat *csv_st)
+{
+	const struct symbol_cache_hdr *hdr;
+	const char *names;
+	char name[ITCH_SYMBOL_LEN + 1];
+	struct stat st;
+	char *fname;
+	void *map;
+	unsigned int i;
+	int fd, err = ENOENT;
+
+	fname = symbol_cache_fname(sym);
+	if (!fname)
+		return ENOMEM;
+	fd = open(fname, O_RDONLY);
+	free(fname);
+	if (fd < 0)
 		return errno;
+	if (fstat(fd, &st) || st.st_size < sizeof(*hdr)) {
+		close(fd);
+		return ENOENT;
 	}
-	load_symbol_file(sym, 1);
-	fclose(sym->fh);
-	return 0;
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return errno;
+
+	hdr = map;
+	if (hdr->magic != SYMBOL_CACHE_MAGIC ||
+	    hdr->version != SYMBOL_CACHE_VERSION ||
+	    hdr->name_len != ITCH_SYMBOL_LEN ||
+	    hdr->csv_size != csv_st->st_size ||
+	    hdr->csv_mtime_sec != csv_st->st_mtim.tv_sec ||
+	    hdr->csv_mtime_nsec != csv_st->st_mtim.tv_nsec ||
+	    st.st_size != sizeof(*hdr) +
+	    (size_t)hdr->num_symbols * ITCH_SYMBOL_LEN)
+		goto out;	/* stale, rebuild it */
+
+	sym->symbol = calloc(hdr->num_symbols ? : 1, sizeof(*sym->symbol));
+	if (!sym->symbol) {
+		printf("failed to alloc %d symbol names\n", hdr->num_symbols);
+		exit(ENOMEM);
+	}
+	names = (const char *)(hdr + 1);
+	name[ITCH_SYMBOL_LEN] = '\0';
+	for (i = 0; i < hdr->num_symbols; i++) {
+		memcpy(name, &names[i * ITCH_SYMBOL_LEN], ITCH_SYMBOL_LEN);
+		symbol_name_init(&sym->symbol[i], name);
+	}
+	sym->num_lines = hdr->num_lines;
+	sym->num_symbols = hdr->num_symbols;
+	sym->cached = 1;
+	err = 0;
+out:
+	munmap(map, st.st_size);
+	return err;
 }
 
-uint32_t name4_to_u32(char *name)
+/* best effort and quiet, written aside and renamed so readers never see
+ * a part */
+static void save_symbol_cache(struct symbols_file * sym, struct stat *csv_st)
 {
-	uint32_t int_val;
+	struct symbol_cache_hdr hdr;
+	char *fname, *tmp_fname;
+	unsigned int i;
+	FILE *fh;
+	int err = 0;
+
+	fname = symbol_cache_fname(sym);
+	if (!fname)
+		return;
+	if (asprintf(&tmp_fname, "%s.%d", fname, (int)getpid()) < 0) {
+		free(fname);
+		return;
+	}
+	fh = fopen(tmp_fname, "w");
+	if (!fh)
+		goto out;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = SYMBOL_CACHE_MAGIC;
+	hdr.version = SYMBOL_CACHE_VERSION;
+	hdr.name_len = ITCH_SYMBOL_LEN;
+	hdr.csv_size = csv_st->st_size;
+	hdr.csv_mtime_sec = csv_st->st_mtim.tv_sec;
+	hdr.csv_mtime_nsec = csv_st->st_mtim.tv_nsec;
+	hdr.num_lines = sym->num_lines;
+	hdr.num_symbols = sym->num_symbols;
+
+	if (fwrite(&hdr, sizeof(hdr), 1, fh) != 1)
+		err = EIO;
+	for (i = 0; !err && i < sym->num_symbols; i++) {
+		if (fwrite(sym->symbol[i].name, ITCH_SYMBOL_LEN, 1, fh) != 1)
+			err = EIO;
+	}
+	if (fclose(fh) || err || rename(tmp_fname, fname))
+		unlink(tmp_fname);
+out:
+	free(tmp_fname);
+	free(fname);
+}
 
-	int_val = (uint32_t)name[0];
-	int_val |= ((uint32_t)name[1]) << 8;
-	int_val |= ((uint32_t)name[2]) << 16;
-	int_val |= ((uint32_t)name[3]) << 24;
+int read_symbol_file(struct symbols_file * sym, int print_warn)
+{
+	struct stat st;
+	void *map;
+	int fd, err;
 
-	return int_val;
+	assert(sym->fname);
+	fd = open(sym->fname, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st)) {
+		err = errno;
+		perror(sym->fname);
+		if (fd >= 0)
+			close(fd);
+		return err;
+	}
+	if (sym->cache_dir && !load_symbol_cache(sym, &st)) {
+		close(fd);
+		return 0;
+	}
+
+	if (st.st_size) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) {
+			err = errno;
+			perror(sym->fname);
+			close(fd);
+			return err;
+		}
+		madvise(map, st.st_size, MADV_SEQUENTIAL);
+		load_symbol_file(sym, map, st.st_size, print_warn);
+		munmap(map, st.st_size);
+	}
+	close(fd);
+
+	if (sym->cache_dir)
+		save_symbol_cache(sym, &st);
+	return 0;
 }
 
-uint32_t symbol_name_to_u32(struct trade_symbol *symbol)
+uint64_t symbol_name_to_u64(struct trade_symbol *symbol)
 {
-	return name4_to_u32(symbol->name);
+	return name8_to_u64(symbol->name);
 }
 
+/* the symbol set is static, compile it into a perfect hash */
 void init_symbol_file_hash(struct symbols_file * sym)
 {
-	uint32_t poly[2];
-	uint32_t name32, i;
+	uint64_t *names;
+	uint32_t i;
 	int err;
 
-	i = get_default_poly(poly, 2);
-	assert(i == 2);
-
-	err = dhash_init(&sym->dhash, CRC_WIDTH, poly, 2);
-	assert(!err);
-
-	for (i = 0; i < sym->num_symbols; i++) {
-		name32 = name4_to_u32(sym->symbol[i].name);
-		dhash_add(&sym->dhash, name32);
+	names = malloc((sym->num_symbols + 1) * sizeof(*names));
+	if (!names) {
+		printf("failed to alloc %d symbol names\n", sym->num_symbols);
+		exit(ENOMEM);
+	}
+	for (i = 0; i < sym->num_symbols; i++)
+		names[i] = symbol_name_to_u64(&sym->symbol[i]);
+
+	err = phash_build(&sym->phash, names, sym->num_symbols);
+	free(names);
+	if (err) {
+		printf("failed to hash symbols of %s\n", sym->fname);
+		exit(err);
 	}
 }
 
 int is_in_symbol_file(struct symbols_file * sym, char *name)
 {
-	uint32_t name32 = name4_to_u32(name);
-	int err;
+	return phash_find(&sym->phash, name8_to_u64(name)) >= 0;
+}
 
-	err = dhash_find(&sym->dhash, name32);
-	if (!err) /* found in hash */
-		return 1;
-	else {
-		assert(err == ENOENT);
-		return 0;
+void cleanup_symbol_file_hash(struct symbols_file * sym)
+{
+	phash_cleanup(&sym->phash);
+}
+
+int symbol_table_init(struct symbol_table *tbl,
+		      struct symbols_file **sym, int num_files)
+{
+	uint64_t *names;
+	unsigned int i, n, total = 0;
+	int f, err, loc;
+
+	memset(tbl, 0, sizeof(*tbl));
+	for (f = 0; f < num_files; f++)
+		total += sym[f]->num_symbols;
+
+	names = malloc((total + 1) * sizeof(*names));
+	if (!names) {
+		printf("failed to alloc %d symbol names\n", total);
+		return ENOMEM;
+	}
+	for (f = 0, n = 0; f < num_files; f++) {
+		for (i = 0; i < sym[f]->num_symbols; i++)
+			names[n++] = symbol_name_to_u64(&sym[f]->symbol[i]);
+	}
+	/* perfect hash slots are dense, they serve as the locates */
+	err = phash_build(&tbl->phash, names, total);
+	free(names);
+	if (err)
+		return err;
+	tbl->num_symbols = tbl->phash.num_keys;
+	if (tbl->num_symbols >= SYMBOL_LOCATE_NONE) {
+		printf("too many distinct symbols: %u, max: %u\n",
+		       tbl->num_symbols, SYMBOL_LOCATE_NONE - 1);
+		symbol_table_cleanup(tbl);
+		return ERANGE;
 	}
+
+	tbl->name = calloc(tbl->num_symbols + 1, sizeof(*tbl->name));
+	tbl->min_price = calloc(tbl->num_symbols + 1, sizeof(*tbl->min_price));
+	tbl->max_price = calloc(tbl->num_symbols + 1, sizeof(*tbl->max_price));
+	if (!tbl->name || !tbl->min_price || !tbl->max_price)
+		goto nomem;
+
+	for (f = 0; f < num_files; f++) {
+		sym[f]->locate = malloc((sym[f]->num_symbols + 1) *
+					sizeof(*sym[f]->locate));
+		if (!sym[f]->locate)
+			goto nomem;
+	}
+	/* walked backwards, so the first file listing a name sets its data */
+	for (f = num_files - 1; f >= 0; f--) {
+		for (i = sym[f]->num_symbols; i-- > 0;) {
+			loc = symbol_locate(tbl, sym[f]->symbol[i].name);
+			assert(loc != SYMBOL_LOCATE_NONE);
+			sym[f]->locate[i] = loc;
+			memcpy(tbl->name[loc], sym[f]->symbol[i].name,
+			       sizeof(tbl->name[loc]));
+			tbl->min_price[loc] = sym[f]->symbol[i].min_price;
+			tbl->max_price[loc] = sym[f]->symbol[i].max_price;
+		}
+	}
+	return 0;
+
+nomem:
+	printf("failed to alloc symbol table of %u symbols\n",
+	       tbl->num_symbols);
+	symbol_table_cleanup(tbl);
+	return ENOMEM;
 }
 
-void cleanup_symbol_file_hash(struct symbols_file * sym)
+void symbol_table_cleanup(struct symbol_table *tbl)
 {
-	dhash_cleanup(&sym->dhash);
+	phash_cleanup(&tbl->phash);
+	free(tbl->name);
+	free(tbl->min_price);
+	free(tbl->max_price);
+	memset(tbl, 0, sizeof(*tbl));
 }
 
 void exclude_symbol_file(struct symbols_file * from_sym,
@@ -0,0 +1,350 @@
+/*
+ * File:   itch_index.c
+ * Summary: sidecar index of an ITCH pcap file
+ *
+ * Built in the same pass as the records are parsed: a timestamp msg adds
+ * a second, an add order msg of a symbol not seen yet adds the symbol to
+ * an open addressing hash. Written, the symbols are compacted and sorted
+ * by name, so a reader finds one by binary search.
+ *
+ * Author: Alexander Nezhinsky (nezhinsky@gmail.com)
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+#include <sys/stat.h>
+
+#include "itch_proto.h"
+#include "itch_index.h"
+
+#define INDEX_MIN_SECS		1024
+#define INDEX_MIN_SYM_SLOTS	4096
+
+void itch_index_init(struct itch_index *idx)
+{
+	memset(idx, 0, sizeof(*idx));
+	idx->hdr.magic = ITCH_INDEX_MAGIC;
+	idx->hdr.version = ITCH_INDEX_VERSION;
+}
+
+void itch_index_cleanup(struct itch_index *idx)
+{
+	free(idx->sec);
+	free(idx->sym);
+	memset(idx, 0, sizeof(*idx));
+}
+
+/* stock fields are padded with spaces or with nuls, kept as the latter */
+static inline void stock_name(char *name, const char *stock)
+{
+	int i;
+
+	memcpy(name, stock, 8);
+	for (i = 7; i >= 0 && (name[i] == ' ' || !name[i]); i--)
+		name[i] = 0;
+}
+
+static inline unsigned int sym_slot(const char *stock, unsigned int slots)
+{
+	uint64_t key;
+
+	memcpy(&key, stock, sizeof(key));
+	return (key * 0x9e3779b97f4a7c15ULL) >> 32 & (slots - 1);
+}
+
+/* the slot of the symbol, or the empty one where it would go */
+static struct itch_index_sym *sym_lookup(struct itch_index_sym *sym,
+					 unsigned int slots, const char *stock)
+{
+	unsigned int i = sym_slot(stock, slots);
+
+	while (sym[i].stock[0] && memcmp(sym[i].stock, stock, 8))
+		i = (i + 1) & (slots - 1);
+	return &sym[i];
+}
+
+/* kept at most half full */
+static int sym_grow(struct itch_index *idx)
+{
+	unsigned int slots = idx->sym_slots ? 2 * idx->sym_slots :
+					      INDEX_MIN_SYM_SLOTS;
+	struct itch_index_sym *sym;
+	unsigned int i;
+
+	sym = calloc(slots, sizeof(*sym));
+	if (!sym)
+		return ENOMEM;
+	for (i = 0; i < idx->sym_slots; i++)
+		if (idx->sym[i].stock[0])
+			*sym_lookup(sym, slots, idx->sym[i].stock) = idx->sym[i];
+	free(idx->sym);
+	idx->sym = sym;
+	idx->sym_slots = slots;
+	return 0;
+}
+
+static int index_add_sym(struct itch_index *idx, const char *stock,
+			 size_t off, uint64_t seq_num)
+{
+	struct itch_index_sym *sym;
+	char name[8];
+
+	stock_name(name, stock);
+	if (!name[0])
+		return 0;
+	if (2 * (idx->hdr.num_syms + 1) > idx->sym_slots && sym_grow(idx))
+		return ENOMEM;
+	sym = sym_lookup(idx->sym, idx->sym_slots, name);
+	if (!sym->stock[0]) {
+		memcpy(sym->stock, name, sizeof(sym->stock));
+		sym->off = off;
+		sym->seq_num = seq_num;
+		idx->hdr.num_syms++;
+	}
+	sym->adds++;
+	return 0;
+}
+
+/* seconds only go forward, a timestamp msg out of order is not indexed */
+static int index_add_sec(struct itch_index *idx, unsigned int sec,
+			 size_t off, uint64_t seq_num)
+{
+	struct itch_index_sec *s;
+	unsigned int size;
+
+	if (idx->hdr.num_secs && idx->sec[idx->hdr.num_secs - 1].sec >= sec)
+		return 0;
+	if (idx->hdr.num_secs == idx->secs_size) {
+		size = idx->secs_size ? 2 * idx->secs_size : INDEX_MIN_SECS;
+		s = realloc(idx->sec, size * sizeof(*s));
+		if (!s)
+			return ENOMEM;
+		idx->sec = s;
+		idx->secs_size = size;
+	}
+	s = &idx->sec[idx->hdr.num_secs++];
+	s->sec = sec;
+	s->pad = 0;
+	s->off = off;
+	s->seq_num = seq_num;
+	return 0;
+}
+
+int itch_index_add(struct itch_index *idx, const struct pcap_rec *rec)
+{
+	struct itch_packet *pkt = rec->data;
+	uint64_t seq_num;
+
+	size_t len = rec->len - sizeof(pkt->mold);
+
+	if (rec->len <= sizeof(pkt->mold))
+		return 0;
+	seq_num = be64toh(pkt->mold.seq_num);
+	if (!idx->hdr.first_off) {
+		idx->hdr.first_off = rec->off;
+		idx->hdr.first_seq = seq_num;
+	}
+	switch (pkt->msg.common.msg_type) {
+	case MSG_TYPE_TIMESTAMP:
+		if (len < sizeof(pkt->msg.time))
+			return 0;
+		return index_add_sec(idx, be32toh(pkt->msg.time.second),
+				     rec->off, seq_num);
+	case MSG_TYPE_ADD_ORDER_NO_MPID:
+		if (len < sizeof(pkt->msg.order))
+			return 0;
+		return index_add_sym(idx, pkt->msg.order.stock, rec->off,
+				     seq_num);
+	default:
+		return 0;
+	}
+}
+
+static int cmp_sym(const void *a, const void *b)
+{
+	return memcmp(((const struct itch_index_sym *)a)->stock,
+		      ((const struct itch_index_sym *)b)->stock, 8);
+}
+
+/* the hash turned into the sorted array it is written as */
+static void index_sort_syms(struct itch_index *idx)
+{
+	unsigned int i, n = 0;
+
+	if (idx->sorted)
+		return;
+	for (i = 0; i < idx->sym_slots; i++)
+		if (idx->sym[i].stock[0])
+			idx->sym[n++] = idx->sym[i];
+	qsort(idx->sym, n, sizeof(*idx->sym), cmp_sym);
+	idx->sorted = 1;
+}
+
+static char *index_fname(const char *pcap_fname)
+{
+	char *fname = malloc(strlen(pcap_fname) + sizeof(ITCH_INDEX_SUFFIX));
+
+	if (fname)
+		sprintf(fname, "%s%s", pcap_fname, ITCH_INDEX_SUFFIX);
+	return fname;
+}
+
+int itch_index_write(struct itch_index *idx, const char *pcap_fname)
+{
+	struct stat st;
+	char *fname;
+	FILE *f;
+	int err = 0;
+
+	if (stat(pcap_fname, &st))
+		return errno;
+	idx->hdr.pcap_size = st.st_size;
+	idx->hdr.pcap_mtime_sec = st.st_mtim.tv_sec;
+	idx->hdr.pcap_mtime_nsec = st.st_mtim.tv_nsec;
+	index_sort_syms(idx);
+
+	fname = index_fname(pcap_fname);
+	if (!fname)
+		return ENOMEM;
+	f = fopen(fname, "wb");
+	free(fname);
+	if (!f)
+		return errno;
+	if (fwrite(&idx->hdr, sizeof(idx->hdr), 1, f) != 1 ||
+	    fwrite(idx->sec, sizeof(*idx->sec), idx->hdr.num_secs, f) !=
+	    idx->hdr.num_secs ||
+	    fwrite(idx->sym, sizeof(*idx->sym), idx->hdr.num_syms, f) !=
+	    idx->hdr.num_syms)
+		err = errno ? errno : EIO;
+	if (fclose(f) && !err)
+		err = errno;
+	return err;
+}
+
+int itch_index_read(struct itch_index *idx, const char *pcap_fname)
+{
+	struct stat st;
+	char *fname;
+	FILE *f;
+	int err = 0;
+
+	itch_index_init(idx);
+	if (stat(pcap_fname, &st))
+		return errno;
+	fname = index_fname(pcap_fname);
+	if (!fname)
+		return ENOMEM;
+	f = fopen(fname, "rb");
+	free(fname);
+	if (!f)
+		return errno;
+
+	if (fread(&idx->hdr, sizeof(idx->hdr), 1, f) != 1 ||
+	    idx->hdr.magic != ITCH_INDEX_MAGIC ||
+	    idx->hdr.version != ITCH_INDEX_VERSION) {
+		err = EINVAL;
+		goto out;
+	}
+	if (idx->hdr.pcap_size != (uint64_t)st.st_size ||
+	    idx->hdr.pcap_mtime_sec != st.st_mtim.tv_sec ||
+	    idx->hdr.pcap_mtime_nsec != st.st_mtim.tv_nsec) {
+		err = ESTALE;
+		goto out;
+	}
+	idx->sec = malloc((idx->hdr.num_secs + 1) * sizeof(*idx->sec));
+	idx->sym = malloc((idx->hdr.num_syms + 1) * sizeof(*idx->sym));
+	if (!idx->sec || !idx->sym) {
+		err = ENOMEM;
+		goto out;
+	}
+	idx->secs_size = idx->hdr.num_secs;
+	idx->sorted = 1;
+	if (fread(idx->sec, sizeof(*idx->sec), idx->hdr.num_secs, f) !=
+	    idx->hdr.num_secs ||
+	    fread(idx->sym, sizeof(*idx->sym), idx->hdr.num_syms, f) !=
+	    idx->hdr.num_syms)
+		err = EINVAL;
+out:
+	fclose(f);
+	if (err)
+		itch_index_cleanup(idx);
+	return err;
+}
+
+size_t itch_index_seek_sec(const struct itch_index *idx, unsigned int sec,
+			   size_t end)
+{
+	unsigned int lo = 0, hi = idx->hdr.num_secs, mid;
+
+	if (!sec)
+		return idx->hdr.first_off ? : end;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (idx->sec[mid].sec < sec)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo < idx->hdr.num_secs ? idx->sec[lo].off : end;
+}
+
+unsigned int itch_index_sec_of(const struct itch_index *idx, size_t off)
+{
+	unsigned int lo = 0, hi = idx->hdr.num_secs, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (idx->sec[mid].off <= off)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo ? idx->sec[lo - 1].sec : 0;
+}
+
+size_t itch_index_seek_seq(const struct itch_index *idx,
+			   struct pcap_map *map, uint64_t seq_num)
+{
+	unsigned int lo = 0, hi = idx->hdr.num_secs, mid;
+	struct pcap_iter iter;
+	struct pcap_rec rec;
+	struct itch_packet *pkt;
+	size_t from = idx->hdr.first_off;
+
+	if (!from)
+		return map->size;
+	/* the last second starting at or before seq_num */
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (idx->sec[mid].seq_num <= seq_num)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo && idx->sec[lo - 1].off > from)
+		from = idx->sec[lo - 1].off;
+
+	pcap_iter_init_range(&iter, map, from, map->size);
+	while (!pcap_iter_next(&iter, &rec)) {
+		pkt = rec.data;
+		if (rec.len >= sizeof(pkt->mold) &&
+		    be64toh(pkt->mold.seq_num) >= seq_num)
+			return rec.off;
+	}
+	return map->size;
+}
+
+const struct itch_index_sym *
+itch_index_find_sym(const struct itch_index *idx, const char *stock)
+{
+	struct itch_index_sym key;
+
+	if (!idx->sorted)
+		return NULL;
+	stock_name(key.stock, stock);
+	return bsearch(&key, idx->sym, idx->hdr.num_syms, sizeof(*idx->sym),
+		       cmp_sym);
+}
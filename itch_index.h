@@ -0,0 +1,101 @@
+/*
+ * File:   itch_index.h
+ * Summary: sidecar index of an ITCH pcap file, for seeking to a second,
+ *          a seq.num or the first order of a symbol
+ * Author: Alexander Nezhinsky (nezhinsky@gmail.com)
+ */
+
+#ifndef ITCH_INDEX_H
+#define	ITCH_INDEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "pcap.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * The index of file.pcap is file.pcap.idx: a header, the seconds by their
+ * timestamp msgs, then the symbols sorted by name. It holds the size and
+ * mtime of the pcap file it was built from, an index of a file changed
+ * since then is stale.
+ */
+#define ITCH_INDEX_MAGIC	0x58444963	/* "cIDX" */
+#define ITCH_INDEX_VERSION	1
+#define ITCH_INDEX_SUFFIX	".idx"
+
+	struct itch_index_hdr {
+		uint32_t magic;
+		uint32_t version;
+		uint64_t pcap_size;
+		int64_t pcap_mtime_sec;
+		int64_t pcap_mtime_nsec;
+		uint64_t first_off;	/* of the first record */
+		uint64_t first_seq;
+		uint32_t num_secs;
+		uint32_t num_syms;
+	};
+
+/* a second starts at its timestamp msg */
+	struct itch_index_sec {
+		uint32_t sec;
+		uint32_t pad;
+		uint64_t off;
+		uint64_t seq_num;
+	};
+
+/* a symbol's first add order msg, and the number of them; the name is
+ * padded with nuls */
+	struct itch_index_sym {
+		char stock[8];
+		uint64_t off;
+		uint64_t seq_num;
+		uint64_t adds;
+	};
+
+	struct itch_index {
+		struct itch_index_hdr hdr;
+		struct itch_index_sec *sec;
+		unsigned int secs_size;
+		struct itch_index_sym *sym;	/* hashed while built */
+		unsigned int sym_slots;
+		int sorted;	/* sym[] sorted, hdr.num_syms of them */
+	};
+
+	void itch_index_init(struct itch_index *idx);
+	void itch_index_cleanup(struct itch_index *idx);
+
+/* records are added in file order; returns 0 or ENOMEM */
+	int itch_index_add(struct itch_index *idx, const struct pcap_rec *rec);
+
+/* written next to pcap_fname; returns 0 or errno */
+	int itch_index_write(struct itch_index *idx, const char *pcap_fname);
+
+/* returns 0, ENOENT if there is none, ESTALE if the pcap file changed
+ * since it was built, EINVAL if it is not an index */
+	int itch_index_read(struct itch_index *idx, const char *pcap_fname);
+
+/* offset of the first record of second sec, or of the first one after it;
+ * end if there are none */
+	size_t itch_index_seek_sec(const struct itch_index *idx,
+				   unsigned int sec, size_t end);
+
+/* the second the record at off falls in, 0 before the first one */
+	unsigned int itch_index_sec_of(const struct itch_index *idx, size_t off);
+
+/* offset of the record with seq.num, walked to from the second it falls
+ * in, or of the first one past it; map->size if there are none */
+	size_t itch_index_seek_seq(const struct itch_index *idx,
+				   struct pcap_map *map, uint64_t seq_num);
+
+/* the symbol's entry, NULL if it has no orders */
+	const struct itch_index_sym *
+	itch_index_find_sym(const struct itch_index *idx, const char *stock);
+
+#ifdef	__cplusplus
+}
+#endif
+#endif				/* ITCH_INDEX_H */
@@ -14,6 +14,15 @@
 #define TRADING_STATE_QUOTE_ONLY	'Q'	/* quotation only period for cross-SRO halt/pause */
 #define TRADING_STATE_TRADING		'T'	/* currently trading on NASDAQ */
 
+#define SYSTEM_EVENT_START_MSGS		'O'	/* start of messages, first of the day */
+#define SYSTEM_EVENT_START_SYSTEM	'S'	/* start of system hours */
+#define SYSTEM_EVENT_START_MARKET	'Q'	/* start of market hours */
+#define SYSTEM_EVENT_END_MARKET		'M'	/* end of market hours */
+#define SYSTEM_EVENT_END_SYSTEM		'E'	/* end of system hours */
+#define SYSTEM_EVENT_END_MSGS		'C'	/* end of messages, last of the day */
+
+#define MSG_TYPE_SYSTEM_EVENT		'S'
+#define MSG_TYPE_STOCK_DIRECTORY	'R'
 #define MSG_TYPE_TRADING_ACTION		'H'
 #define MSG_TYPE_TIMESTAMP		'T'
 #define MSG_TYPE_ADD_ORDER_NO_MPID	'A'
@@ -33,6 +42,22 @@ struct itch_msg_timestamp {
 	uint32_t second;	/* seconds since midnight */
 } __attribute__ ((packed));
 
+struct itch_msg_system_event {
+	char msg_type;		/* 'S' - system event message */
+	uint32_t timestamp_ns;	/* ns portion f the timestamp */
+	char event_code;	/* one of SYSTEM_EVENT_xxx */
+} __attribute__ ((packed));
+
+struct itch_msg_stock_directory {
+	char msg_type;		/* 'R' - stock directory message */
+	uint32_t timestamp_ns;	/* ns portion f the timestamp */
+	char stock[ITCH_SYMBOL_LEN];	/* stock symbol right padded with spaces */
+	char market_category;	/* listing market of the stock */
+	char financial_status;	/* for NASDAQ listed stocks */
+	uint32_t round_lot_size;	/* num of shares in a round lot */
+	char round_lots_only;	/* 'Y' - only round lots accepted */
+} __attribute__ ((packed));
+
 struct itch_msg_stock_trade {
 	char msg_type;		/* 'H' - stock trading action message */
 	uint32_t timestamp_ns;	/* ns portion f the timestamp */
@@ -104,6 +129,8 @@ struct itch_msg_common {
 union itch_msg {
 	struct itch_msg_common common;
 	struct itch_msg_timestamp time;
+	struct itch_msg_system_event sys;
+	struct itch_msg_stock_directory dir;
 	struct itch_msg_stock_trade trade;
 	struct itch_msg_add_order_no_mpid order;
 	struct itch_msg_add_order_with_mpid order_mpid;
@@ -0,0 +1,1083 @@
+/*
+ * File: itchybench.c
+ * Summary: micro-benchmarks for the itchygen building blocks
+ *
+ * Copyright (c) 2014, Alexander Nezhinsky (nezhinsky@gmail.com)
+ * All rights reserved.
+ *
+ * Licensed under BSD-MIT :
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <assert.h>
+#include <getopt.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "itch_proto.h"
+#include "itchygen.h"
+#include "double_hash.h"
+#include "double_hash_mt.h"
+#include "crc.h"
+#include "rand_util.h"
+#include "pcap.h"
+#include "phash.h"
+#include "order_book.h"
+#include "itch_index.h"
+#include "str_args.h"
+
+static char program_name[] = "itchybench";
+
+struct itchybench_info {
+	char *bench;
+	char *pcap_fname;
+	unsigned int from_sec, to_sec;	/* replayed, by the index */
+	int seek;
+	unsigned int max_threads;
+	unsigned long num_keys;
+	unsigned int rand_seed;
+	int verbose_mode;
+};
+
+void usage(int status, char *msg)
+{
+	if (msg)
+		fprintf(stderr, "%s\n", msg);
+	if (status)
+		exit(status);
+
+	printf("itchygen micro-benchmarks, version %s\n\n"
+	       "Usage: %s [OPTION]\n"
+	       "-b, --bench         benchmark to run: crc, dhash-mt, gen, book\n"
+	       "-f, --file          PCAP file to replay, for book\n"
+	       "-T, --from-sec      replay from this second on, by the index\n"
+	       "-E, --to-sec        replay up to this second, included\n"
+	       "-j, --threads       max number of threads, default: 16\n"
+	       "-n, --num           number of keys, default: 1M\n"
+	       "-S, --rand-seed     seed for the generated keys\n"
+	       "-v, --verbose       produce verbose output\n"
+	       "-V, --version       print version and exit\n"
+	       "-h, --help          display this help and exit\n",
+	       ITCHYGEN_VER_STR, program_name);
+	exit(0);
+}
+
+static struct option const long_options[] = {
+	{"bench", required_argument, 0, 'b'},
+	{"file", required_argument, 0, 'f'},
+	{"from-sec", required_argument, 0, 'T'},
+	{"to-sec", required_argument, 0, 'E'},
+	{"threads", required_argument, 0, 'j'},
+	{"num", required_argument, 0, 'n'},
+	{"rand-seed", required_argument, 0, 'S'},
+	{"verbose", no_argument, 0, 'v'},
+	{"version", no_argument, 0, 'V'},
+	{"help", no_argument, 0, 'h'},
+	{0, 0, 0, 0},
+};
+
+static char *short_options = "b:f:T:E:j:n:S:vVh";
+
+static inline double time_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + 1.0e-9 * ts.tv_nsec;
+}
+
+/* distinct keys: multiplication by an odd constant is a bijection */
+static uint32_t *alloc_keys(unsigned long num_keys, unsigned int seed)
+{
+	uint32_t *keys;
+	unsigned long i;
+
+	keys = malloc(num_keys * sizeof(*keys));
+	if (!keys) {
+		printf("failed to alloc %lu keys\n", num_keys);
+		exit(ENOMEM);
+	}
+	for (i = 0; i < num_keys; i++)
+		keys[i] = (uint32_t)((i + 1) * 0x9e3779b1u) ^ seed;
+	return keys;
+}
+
+/*
+ * dhash-mt: throughput of add/find/del with disjoint key sets per thread,
+ * then a stress pass where all threads race on the same keys
+ */
+
+struct mt_bench_thrd {
+	pthread_t thread;
+	struct dhash_mt_table *mt;
+	pthread_barrier_t *barrier;
+	unsigned int id;
+	unsigned int num_thrds;
+	uint32_t *keys;
+	unsigned long num_keys;
+	int shared_keys;
+	unsigned long added;
+	unsigned long found;
+	unsigned long deleted;
+	unsigned long overflows;
+	double phase_time[4];
+};
+
+static void *mt_bench_thrd(void *arg)
+{
+	struct mt_bench_thrd *t = arg;
+	unsigned long i, first, last;
+	int err;
+
+	if (t->shared_keys) {
+		first = 0;
+		last = t->num_keys;
+	} else {
+		first = t->num_keys * t->id / t->num_thrds;
+		last = t->num_keys * (t->id + 1) / t->num_thrds;
+	}
+
+	pthread_barrier_wait(t->barrier);
+	t->phase_time[0] = time_now();
+	for (i = first; i < last; i++) {
+		err = dhash_mt_add(t->mt, t->keys[i]);
+		if (!err)
+			t->added++;
+		else if (err == ENOMEM)
+			t->overflows++;
+		else
+			assert(err == EEXIST && t->shared_keys);
+	}
+	pthread_barrier_wait(t->barrier);
+	t->phase_time[1] = time_now();
+	for (i = first; i < last; i++) {
+		if (!dhash_mt_find(t->mt, t->keys[i]))
+			t->found++;
+	}
+	pthread_barrier_wait(t->barrier);
+	t->phase_time[2] = time_now();
+	for (i = first; i < last; i++) {
+		if (!dhash_mt_del(t->mt, t->keys[i]))
+			t->deleted++;
+	}
+	pthread_barrier_wait(t->barrier);
+	t->phase_time[3] = time_now();
+	return NULL;
+}
+
+static int mt_bench_run(struct itchybench_info *ib, struct dhash_mt_table *mt,
+			uint32_t *keys, unsigned int num_thrds, int shared_keys)
+{
+	struct mt_bench_thrd *thrd;
+	pthread_barrier_t barrier;
+	unsigned long added = 0, found = 0, deleted = 0, overflows = 0;
+	unsigned long expect_found;
+	struct dhash_stat ds;
+	double t[3];
+	unsigned int i;
+	int err, failed = 0;
+
+	thrd = calloc(num_thrds, sizeof(*thrd));
+	assert(thrd);
+	pthread_barrier_init(&barrier, NULL, num_thrds);
+
+	for (i = 0; i < num_thrds; i++) {
+		thrd[i].mt = mt;
+		thrd[i].barrier = &barrier;
+		thrd[i].id = i;
+		thrd[i].num_thrds = num_thrds;
+		thrd[i].keys = keys;
+		thrd[i].num_keys = ib->num_keys;
+		thrd[i].shared_keys = shared_keys;
+		err = pthread_create(&thrd[i].thread, NULL, mt_bench_thrd,
+				     &thrd[i]);
+		if (err) {
+			errno = err;
+			printf("failed to create bench thread, %m\n");
+			exit(err);
+		}
+	}
+	for (i = 0; i < num_thrds; i++) {
+		pthread_join(thrd[i].thread, NULL);
+		added += thrd[i].added;
+		found += thrd[i].found;
+		deleted += thrd[i].deleted;
+		overflows += thrd[i].overflows;
+	}
+	pthread_barrier_destroy(&barrier);
+
+	/* barriers make the phase boundaries common to all threads */
+	for (i = 0; i < 3; i++)
+		t[i] = thrd[0].phase_time[i + 1] - thrd[0].phase_time[i];
+
+	dhash_mt_stat(mt, &ds);
+	expect_found = shared_keys ? added * num_thrds : added;
+	if (added + overflows != ib->num_keys || found != expect_found ||
+	    deleted != added || ds.num_entries != 0) {
+		printf("FAILED: keys: %lu added: %lu overflows: %lu "
+		       "found: %lu deleted: %lu left: %u\n",
+		       ib->num_keys, added, overflows, found, deleted,
+		       ds.num_entries);
+		failed = 1;
+	}
+
+	if (!shared_keys)
+		printf("\tthreads: %2u  add: %7.2f  find: %7.2f  "
+		       "del: %7.2f Mops/sec\n", num_thrds,
+		       1.0e-6 * ib->num_keys / t[0],
+		       1.0e-6 * ib->num_keys / t[1],
+		       1.0e-6 * ib->num_keys / t[2]);
+	else if (ib->verbose_mode || failed)
+		printf("\tstress threads: %2u  keys: %lu added: %lu "
+		       "overflows: %lu %s\n", num_thrds, ib->num_keys,
+		       added, overflows, failed ? "FAILED" : "ok");
+
+	free(thrd);
+	return failed;
+}
+
+static int bench_dhash_mt(struct itchybench_info *ib)
+{
+	struct dhash_mt_table mt;
+	struct dhash_stat ds;
+	uint32_t poly[MAX_POLY];
+	uint32_t *keys;
+	unsigned int num_poly, n;
+	int err, failed = 0;
+
+	num_poly = get_default_poly(poly, MAX_POLY);
+	err = dhash_mt_init(&mt, CRC_WIDTH, poly, num_poly);
+	if (err) {
+		errno = err;
+		printf("failed to init hash table, %m\n");
+		return err;
+	}
+	keys = alloc_keys(ib->num_keys, ib->rand_seed);
+
+	printf("dhash-mt: keys: %lu, buckets: %zu, stripes: %zu\n",
+	       ib->num_keys, mt.dhash.num_crc_vals, mt.stripe_mask + 1);
+	for (n = 1; n <= ib->max_threads; n <<= 1) {
+		failed |= mt_bench_run(ib, &mt, keys, n, 0);
+		failed |= mt_bench_run(ib, &mt, keys, n, 1);
+	}
+	dhash_mt_stat(&mt, &ds);
+	if (mt.dhash.num_free != mt.dhash.num_crc_vals * NUM_BUCKET_VALS ||
+	    ds.bucket_num[0] != mt.dhash.num_crc_vals) {
+		printf("FAILED: num_free: %zu empty buckets: %u "
+		       "after all keys deleted\n",
+		       mt.dhash.num_free, ds.bucket_num[0]);
+		failed = 1;
+	}
+	printf("dhash-mt stress: %s\n", failed ? "FAILED" : "ok");
+
+	free(keys);
+	dhash_mt_cleanup(&mt);
+	return failed ? EINVAL : 0;
+}
+
+/*
+ * crc: every kernel is checked against the bitwise reference over all
+ * the widths with random polynomials, then timed with the hash polys
+ */
+
+#define CRC_BENCH_BUF_SZ	(1 << 20)
+#define CRC_CHECK_KEYS		(1 << 14)
+#define CRC_CHECK_ARRAYS	1024
+
+static inline uint32_t rand_full_uint32(void)
+{
+	return (uint32_t)rand_uint32() ^ ((uint32_t)rand_uint32() << 16);
+}
+
+static int crc_check(struct crc_poly *crc_poly, uint32_t *keys,
+		     uint8_t *buf)
+{
+	crc_t ref;
+	int i, off, len;
+
+	for (i = 0; i < CRC_CHECK_KEYS; i++) {
+		ref = calc_crc_uint32_bitwise(crc_poly, keys[i]);
+		if (calc_crc_uint32_table(crc_poly, keys[i]) != ref)
+			goto uint32_failed;
+#ifdef __PCLMUL__
+		if (calc_crc_uint32_clmul(crc_poly, keys[i]) != ref)
+			goto uint32_failed;
+#endif
+	}
+	for (i = 0; i < CRC_CHECK_ARRAYS; i++) {
+		off = rand_int_range(0, 63);
+		len = rand_int_range(0, 255);
+		if (calc_crc_array(crc_poly, buf + off, len) !=
+		    calc_crc_array_bitwise(crc_poly, buf + off, len)) {
+			printf("FAILED: poly: 0x%x width: %zu array off: %d "
+			       "len: %d\n", crc_poly->poly, crc_poly->width,
+			       off, len);
+			return 1;
+		}
+	}
+	return 0;
+
+uint32_failed:
+	printf("FAILED: poly: 0x%x width: %zu data: 0x%08x\n",
+	       crc_poly->poly, crc_poly->width, keys[i]);
+	return 1;
+}
+
+typedef crc_t (*crc_uint32_fn)(struct crc_poly *crc_poly, uint32_t data);
+
+static void crc_bench_uint32(struct itchybench_info *ib, const char *name,
+			     crc_uint32_fn calc_crc, struct crc_poly *crc_poly,
+			     uint32_t *keys)
+{
+	crc_t sum = 0;
+	unsigned long i;
+	double t;
+
+	t = time_now();
+	for (i = 0; i < ib->num_keys; i++)
+		sum ^= calc_crc(crc_poly, keys[i]);
+	t = time_now() - t;
+	printf("\tuint32 %-8s %8.2f Mcrc/sec  (xor: 0x%x)\n", name,
+	       1.0e-6 * ib->num_keys / t, sum);
+}
+
+static int bench_crc(struct itchybench_info *ib)
+{
+	struct crc_poly *crc_poly;
+	uint32_t poly[MAX_POLY];
+	uint32_t *keys;
+	uint8_t *buf;
+	crc_t sum;
+	uint32_t width, mask;
+	int i, failed = 0;
+	double t;
+
+	crc_poly = malloc(sizeof(*crc_poly));
+	buf = malloc(CRC_BENCH_BUF_SZ);
+	if (!crc_poly || !buf) {
+		printf("failed to alloc crc bench buffers\n");
+		return ENOMEM;
+	}
+	keys = alloc_keys(ib->num_keys > CRC_CHECK_KEYS ?
+			  ib->num_keys : CRC_CHECK_KEYS, ib->rand_seed);
+	rand_util_init(1, &ib->rand_seed);
+	for (i = 0; i < CRC_BENCH_BUF_SZ; i++)
+		buf[i] = (uint8_t)rand_uint32();
+
+	for (width = 1; width < 32; width++) {
+		mask = (1u << width) - 1;
+		for (i = 0; i < 4; i++) {
+			crc_init(crc_poly, (1u << width) |
+				 (rand_full_uint32() & mask), width);
+			failed |= crc_check(crc_poly, keys, buf);
+		}
+	}
+	printf("crc check against bitwise, widths 1-31: %s\n",
+	       failed ? "FAILED" : "ok");
+
+	get_default_poly(poly, MAX_POLY);
+	crc_init(crc_poly, poly[0], CRC_WIDTH);
+	printf("crc: poly: 0x%x width: %d keys: %lu\n", poly[0], CRC_WIDTH,
+	       ib->num_keys);
+	crc_bench_uint32(ib, "bitwise", calc_crc_uint32_bitwise, crc_poly,
+			 keys);
+	crc_bench_uint32(ib, "slice-4", calc_crc_uint32_table, crc_poly,
+			 keys);
+#ifdef __PCLMUL__
+	crc_bench_uint32(ib, "clmul", calc_crc_uint32_clmul, crc_poly, keys);
+#endif
+
+	t = time_now();
+	sum = calc_crc_array_bitwise(crc_poly, buf, CRC_BENCH_BUF_SZ);
+	t = time_now() - t;
+	printf("\tarray  %-8s %8.2f MB/sec     (crc: 0x%x)\n", "bitwise",
+	       1.0e-6 * CRC_BENCH_BUF_SZ / t, sum);
+	t = time_now();
+	for (i = 0; i < 16; i++)
+		sum = calc_crc_array(crc_poly, buf, CRC_BENCH_BUF_SZ);
+	t = time_now() - t;
+	printf("\tarray  %-8s %8.2f MB/sec     (crc: 0x%x)\n", "slice-8",
+	       1.0e-6 * 16 * CRC_BENCH_BUF_SZ / t, sum);
+
+	free(keys);
+	free(buf);
+	free(crc_poly);
+	return failed ? EINVAL : 0;
+}
+
+/*
+ * gen: drawing the parameters of new orders the way itchygen does,
+ * one order at a time, then a batch of orders at a time field by field;
+ * a batch of one must draw exactly what the single draws do
+ */
+
+#define GEN_BENCH_SYMBOLS	4096
+#define GEN_BENCH_SUBSCR	64
+#define GEN_BENCH_RATE		100000.0
+#define GEN_BENCH_MAX_BATCH	4096
+#define GEN_CHECK_MAX_RANGE	65535
+
+struct gen_bench_syms {
+	uint16_t all[GEN_BENCH_SYMBOLS];
+	uint16_t subscr[GEN_BENCH_SUBSCR];
+	int min_price[GEN_BENCH_SYMBOLS];
+	int max_price[GEN_BENCH_SYMBOLS];
+	struct rand_interval subscr_int[2];
+	struct rand_range all_range;
+	struct rand_range subscr_range;
+};
+
+static inline double gen_bench_sum(double dtime, unsigned int locate,
+				   int buy, int shares, int price)
+{
+	return dtime + locate + buy + shares + price;
+}
+
+static double gen_bench_single(struct itchybench_info *ib,
+			       struct gen_bench_syms *gs, double *t)
+{
+	unsigned int loc;
+	unsigned long i;
+	double dtime, sum = 0.0;
+	int buy, shares, price;
+
+	rand_util_init(1, &ib->rand_seed);
+	*t = time_now();
+	for (i = 0; i < ib->num_keys; i++) {
+		dtime = rand_exp_time_by_rate(GEN_BENCH_RATE);
+		if (rand_index(gs->subscr_int, 2) == 0)
+			loc = gs->subscr[rand_int_range(0, GEN_BENCH_SUBSCR - 1)];
+		else
+			loc = gs->all[rand_int_range(0, GEN_BENCH_SYMBOLS - 1)];
+		buy = rand_int_range(0, 1);
+		shares = rand_int_range(1, 250);
+		price = rand_int_range(gs->min_price[loc], gs->max_price[loc]);
+		sum += gen_bench_sum(dtime, loc, buy, shares, price);
+	}
+	*t = time_now() - *t;
+	return sum;
+}
+
+static double gen_bench_batch(struct itchybench_info *ib,
+			      struct gen_bench_syms *gs, unsigned int size,
+			      double *t)
+{
+	static long int rnd[6 * GEN_BENCH_MAX_BATCH];
+	static double dtime[GEN_BENCH_MAX_BATCH];
+	static unsigned char subscr[GEN_BENCH_MAX_BATCH];
+	static uint16_t locate[GEN_BENCH_MAX_BATCH];
+	static int buy[GEN_BENCH_MAX_BATCH], shares[GEN_BENCH_MAX_BATCH];
+	static int price[GEN_BENCH_MAX_BATCH];
+	unsigned long done;
+	unsigned int i, n, loc;
+	long int *r;
+	double sum = 0.0;
+
+	rand_util_init(1, &ib->rand_seed);
+	*t = time_now();
+	for (done = 0; done < ib->num_keys; done += n) {
+		n = ib->num_keys - done < size ? ib->num_keys - done : size;
+		r = rnd;
+		rand_fill(r, 6 * n);
+		rand_exp_fill_by_rate(dtime, r, n, GEN_BENCH_RATE);
+		r += n;
+		rand_index_fill(subscr, r, n, gs->subscr_int, 2);
+		r += n;
+		for (i = 0; i < n; i++)
+			locate[i] = subscr[i] ?
+			    gs->all[rand_range_map(&gs->all_range, r[i])] :
+			    gs->subscr[rand_range_map(&gs->subscr_range, r[i])];
+		r += n;
+		rand_int_range_fill(buy, r, n, 0, 1);
+		r += n;
+		rand_int_range_fill(shares, r, n, 1, 250);
+		r += n;
+		for (i = 0; i < n; i++) {
+			loc = locate[i];
+			price[i] = rand_int_range_map(r[i], gs->min_price[loc],
+						      gs->max_price[loc]);
+		}
+		for (i = 0; i < n; i++)
+			sum += gen_bench_sum(dtime[i], locate[i], buy[i],
+					     shares[i], price[i]);
+	}
+	*t = time_now() - *t;
+	return sum;
+}
+
+/* the extreme draws map to the ends of every range, and never past them */
+static int gen_range_check(void)
+{
+	struct rand_range rr;
+	uint32_t n;
+
+	for (n = 1; n <= GEN_CHECK_MAX_RANGE; n++) {
+		rand_range_init(&rr, 0, n - 1);
+		if (rand_range_map(&rr, 0) != 0 ||
+		    rand_range_map(&rr, RAND_MAX) != (int)n - 1 ||
+		    rand_int_range_map(0, 0, n - 1) != 0 ||
+		    rand_int_range_map(RAND_MAX, 0, n - 1) != (int)n - 1) {
+			printf("range map failed, range: %u\n", n);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int bench_gen(struct itchybench_info *ib)
+{
+	struct gen_bench_syms *gs;
+	unsigned int size, i;
+	double sum, sum1, t;
+	int failed = 0;
+
+	gs = malloc(sizeof(*gs));
+	if (!gs) {
+		printf("failed to alloc gen bench symbols\n");
+		return ENOMEM;
+	}
+	rand_util_init(1, &ib->rand_seed);
+	for (i = 0; i < GEN_BENCH_SYMBOLS; i++) {
+		gs->all[i] = i;
+		gs->min_price[i] = rand_int_range(10, 600);
+		gs->max_price[i] = 3 * gs->min_price[i];
+	}
+	for (i = 0; i < GEN_BENCH_SUBSCR; i++)
+		gs->subscr[i] = rand_int_range(0, GEN_BENCH_SYMBOLS - 1);
+	gs->subscr_int[0].pcts_total = 30;
+	gs->subscr_int[1].pcts_total = 70;
+	rand_interval_init(gs->subscr_int, 2);
+	rand_range_init(&gs->all_range, 0, GEN_BENCH_SYMBOLS - 1);
+	rand_range_init(&gs->subscr_range, 0, GEN_BENCH_SUBSCR - 1);
+
+	printf("gen: orders: %lu, symbols: %d, subscribed: %d\n",
+	       ib->num_keys, GEN_BENCH_SYMBOLS, GEN_BENCH_SUBSCR);
+	sum = gen_bench_single(ib, gs, &t);
+	printf("\tsingle       %8.2f Morders/sec\n", 1.0e-6 * ib->num_keys / t);
+	for (size = 1; size <= GEN_BENCH_MAX_BATCH; size <<= 2) {
+		sum1 = gen_bench_batch(ib, gs, size, &t);
+		printf("\tbatch %-6u %8.2f Morders/sec\n", size,
+		       1.0e-6 * ib->num_keys / t);
+		if (size == 1 && sum1 != sum)
+			failed = 1;
+	}
+	printf("gen batch of 1 vs single draws: %s\n",
+	       failed ? "FAILED" : "ok");
+	i = gen_range_check();
+	printf("gen range map check, ranges 1-%d: %s\n", GEN_CHECK_MAX_RANGE,
+	       i ? "FAILED" : "ok");
+	failed |= i;
+
+	free(gs);
+	return failed ? EINVAL : 0;
+}
+
+/*
+ * book: replaying a stream through an order map and per-symbol books,
+ * the way a feed handler builds them. The messages are copied out of the
+ * pcap file up front, so the replay touches memory only. It runs once for
+ * the throughput, then once more timing every message into per-type
+ * histograms; both runs must end with the same books.
+ */
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+
+static inline uint64_t bench_ticks(void)
+{
+	return __rdtsc();
+}
+#else
+static inline uint64_t bench_ticks(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+/* log-linear, HDR style: values below 2 * HIST_SUB are exact, above that
+ * every power of two is split into HIST_SUB buckets, ~3% apart */
+#define HIST_SUB_BITS	5
+#define HIST_SUB	(1 << HIST_SUB_BITS)
+#define HIST_BUCKETS	((65 - HIST_SUB_BITS) * HIST_SUB)
+
+struct hist {
+	unsigned long long count;
+	unsigned long long sum;
+	uint64_t max;
+	unsigned long long bucket[HIST_BUCKETS];
+};
+
+static inline unsigned int hist_index(uint64_t v)
+{
+	unsigned int shift;
+
+	if (v < 2 * HIST_SUB)
+		return v;
+	shift = 63 - __builtin_clzll(v) - HIST_SUB_BITS;
+	return (shift + 1) * HIST_SUB + (v >> shift) - HIST_SUB;
+}
+
+/* the least value of the bucket */
+static inline uint64_t hist_value(unsigned int i)
+{
+	if (i < 2 * HIST_SUB)
+		return i;
+	return (uint64_t)(HIST_SUB + i % HIST_SUB) << (i / HIST_SUB - 1);
+}
+
+static inline void hist_add(struct hist *h, uint64_t v)
+{
+	h->count++;
+	h->sum += v;
+	if (v > h->max)
+		h->max = v;
+	h->bucket[hist_index(v)]++;
+}
+
+static uint64_t hist_percentile(struct hist *h, double pct)
+{
+	unsigned long long rank = h->count * pct / 100.0, n = 0;
+	unsigned int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		n += h->bucket[i];
+		if (n > rank)
+			return hist_value(i);
+	}
+	return h->max;
+}
+
+/* timed separately: A C X U T and the rest */
+#define BOOK_BENCH_TYPES	6
+
+static const char book_bench_type[BOOK_BENCH_TYPES + 1] = "ACXUT?";
+
+static inline unsigned int book_bench_type_index(char msg_type)
+{
+	switch (msg_type) {
+	case MSG_TYPE_ADD_ORDER_NO_MPID:
+		return 0;
+	case MSG_TYPE_ORDER_EXECUTED:
+		return 1;
+	case MSG_TYPE_ORDER_CANCEL:
+		return 2;
+	case MSG_TYPE_ORDER_REPLACE:
+		return 3;
+	case MSG_TYPE_TIMESTAMP:
+		return 4;
+	default:
+		return 5;
+	}
+}
+
+struct book_bench_order {
+	uint32_t shares;	/* remaining */
+	uint32_t price;
+	uint32_t locate;
+	uint32_t side;
+};
+
+struct book_bench {
+	union itch_msg *msg;
+	size_t num_msgs;
+	struct phash symbols;	/* of the added orders, slot is the locate */
+	struct order_book *book;
+	struct dhash_table orders;	/* by ref.num */
+	unsigned int time_sec;
+	unsigned long long unknown_refns;
+	unsigned long long overflows;
+};
+
+/* the msgs of the seconds from_sec - to_sec, of the whole file unless
+ * seeking by its index */
+static int book_bench_load(struct book_bench *bb, struct itchybench_info *ib)
+{
+	const char *fname = ib->pcap_fname;
+	struct pcap_map map;
+	struct pcap_iter iter;
+	struct pcap_rec rec;
+	struct itch_packet *pkt;
+	struct itch_index index;
+	uint64_t *keys;
+	uint32_t poly[MAX_POLY];
+	size_t n, num_keys, len, num_poly, from, to;
+	int err;
+
+	err = pcap_map_open(&map, fname, 0);
+	if (err) {
+		errno = err;
+		printf("failed to open pcap file %s, %m\n", fname);
+		return err;
+	}
+	from = sizeof(struct pcap_global_hdr);
+	to = map.size;
+	if (ib->seek) {
+		err = itch_index_read(&index, fname);
+		if (err) {
+			errno = err;
+			printf("failed to read index of %s, %m\n", fname);
+			pcap_map_close(&map);
+			return err;
+		}
+		from = itch_index_seek_sec(&index, ib->from_sec, map.size);
+		to = itch_index_seek_sec(&index, ib->to_sec + 1, map.size);
+		itch_index_cleanup(&index);
+	}
+	pcap_iter_init_range(&iter, &map, from, to);
+	for (n = 0; !pcap_iter_next(&iter, &rec); n++)
+		;
+
+	bb->msg = calloc(n, sizeof(*bb->msg));
+	keys = malloc(n * sizeof(*keys));
+	if (!bb->msg || !keys) {
+		printf("failed to alloc %zu messages\n", n);
+		exit(ENOMEM);
+	}
+	num_keys = 0;
+	pcap_iter_init_range(&iter, &map, from, to);
+	for (n = 0; !pcap_iter_next(&iter, &rec); n++) {
+		pkt = rec.data;
+		len = rec.len - sizeof(pkt->mold);
+		if (len > sizeof(*bb->msg))
+			len = sizeof(*bb->msg);
+		memcpy(&bb->msg[n], &pkt->msg, len);
+		if (pkt->msg.common.msg_type == MSG_TYPE_ADD_ORDER_NO_MPID)
+			keys[num_keys++] = name8_to_u64(pkt->msg.order.stock);
+	}
+	bb->num_msgs = n;
+	pcap_map_close(&map);
+
+	err = phash_build(&bb->symbols, keys, num_keys);
+	free(keys);
+	if (err) {
+		printf("failed to build symbols hash\n");
+		return err;
+	}
+	bb->book = calloc(bb->symbols.num_keys + 1, sizeof(*bb->book));
+	if (!bb->book) {
+		printf("failed to alloc order books\n");
+		exit(ENOMEM);
+	}
+	num_poly = get_default_poly(poly, MAX_POLY);
+	return dhash_map_init(&bb->orders, CRC_WIDTH, poly, num_poly,
+			      sizeof(struct book_bench_order));
+}
+
+/* returns 0 and the order as it was before, ENOENT for an unknown refn */
+static inline int book_bench_reduce(struct book_bench *bb, uint32_t refn,
+				    uint32_t shares,
+				    struct book_bench_order *order)
+{
+	struct book_bench_order *o;
+	uint32_t done;
+
+	o = dhash_map_find(&bb->orders, refn);
+	if (unlikely(!o)) {
+		bb->unknown_refns++;
+		return ENOENT;
+	}
+	done = shares < o->shares ? shares : o->shares;
+	order_book_reduce(&bb->book[o->locate], o->side, o->price, done,
+			  done == o->shares);
+	*order = *o;
+	o->shares -= done;
+	if (!o->shares)
+		dhash_map_del(&bb->orders, refn, NULL);
+	return 0;
+}
+
+static inline void book_bench_add(struct book_bench *bb, uint32_t refn,
+				  struct book_bench_order *order)
+{
+	if (unlikely(dhash_map_add(&bb->orders, refn, order))) {
+		bb->overflows++;
+		return;
+	}
+	if (unlikely(order_book_add(&bb->book[order->locate], order->side,
+				    order->price, order->shares))) {
+		printf("failed to alloc order book levels\n");
+		exit(ENOMEM);
+	}
+}
+
+static inline void book_bench_msg(struct book_bench *bb,
+				  const union itch_msg *msg)
+{
+	struct book_bench_order order;
+	int slot;
+
+	switch (msg->common.msg_type) {
+	case MSG_TYPE_ADD_ORDER_NO_MPID:
+		slot = phash_find(&bb->symbols, name8_to_u64(msg->order.stock));
+		order.locate = slot >= 0 ? slot : bb->symbols.num_keys;
+		order.side = msg->order.buy_sell == ITCH_ORDER_BUY ?
+		    BOOK_BID : BOOK_ASK;
+		order.shares = be32toh(msg->order.shares);
+		order.price = be32toh(msg->order.price);
+		book_bench_add(bb, (uint32_t)be64toh(msg->order.ref_num),
+			       &order);
+		break;
+	case MSG_TYPE_ORDER_EXECUTED:
+		book_bench_reduce(bb, (uint32_t)be64toh(msg->exec.ref_num),
+				  be32toh(msg->exec.shares), &order);
+		break;
+	case MSG_TYPE_ORDER_CANCEL:
+		book_bench_reduce(bb, (uint32_t)be64toh(msg->cancel.ref_num),
+				  be32toh(msg->cancel.shares), &order);
+		break;
+	case MSG_TYPE_ORDER_REPLACE:
+		if (book_bench_reduce(bb,
+				      (uint32_t)be64toh(msg->replace.orig_ref_num),
+				      UINT32_MAX, &order))
+			break;
+		order.shares = be32toh(msg->replace.shares);
+		order.price = be32toh(msg->replace.price);
+		book_bench_add(bb, (uint32_t)be64toh(msg->replace.new_ref_num),
+			       &order);
+		break;
+	case MSG_TYPE_TIMESTAMP:
+		bb->time_sec = be32toh(msg->time.second);
+		break;
+	}
+}
+
+static void book_bench_reset(struct book_bench *bb)
+{
+	unsigned int loc;
+
+	for (loc = 0; loc <= bb->symbols.num_keys; loc++) {
+		order_book_cleanup(&bb->book[loc]);
+		order_book_init(&bb->book[loc]);
+	}
+	dhash_reset(&bb->orders);
+	bb->time_sec = 0;
+	bb->unknown_refns = 0;
+	bb->overflows = 0;
+}
+
+/* top changes of all the books, telling two replays apart */
+static unsigned long long book_bench_tops(struct book_bench *bb,
+					  unsigned long long *errors)
+{
+	unsigned long long tops = 0;
+	unsigned int loc;
+
+	*errors = 0;
+	for (loc = 0; loc <= bb->symbols.num_keys; loc++) {
+		tops += bb->book[loc].top_changes;
+		*errors += bb->book[loc].errors;
+	}
+	return tops;
+}
+
+static double book_bench_replay(struct book_bench *bb)
+{
+	size_t i;
+	double t;
+
+	book_bench_reset(bb);
+	t = time_now();
+	for (i = 0; i < bb->num_msgs; i++)
+		book_bench_msg(bb, &bb->msg[i]);
+	return time_now() - t;
+}
+
+/* returns ns per tick */
+static double book_bench_replay_timed(struct book_bench *bb,
+				      struct hist *hist)
+{
+	uint64_t t0, t1, start;
+	size_t i;
+	double t;
+
+	book_bench_reset(bb);
+	t = time_now();
+	start = bench_ticks();
+	t1 = start;
+	for (i = 0; i < bb->num_msgs; i++) {
+		t0 = t1;
+		book_bench_msg(bb, &bb->msg[i]);
+		t1 = bench_ticks();
+		hist_add(&hist[book_bench_type_index(bb->msg[i].common.msg_type)],
+			 t1 - t0);
+	}
+	t = time_now() - t;
+	return t1 > start ? t * 1.0e9 / (t1 - start) : 1.0;
+}
+
+static int bench_book(struct itchybench_info *ib)
+{
+	struct book_bench bb;
+	struct hist *hist, *h;
+	unsigned long long tops, tops_timed, errors, errors_timed;
+	unsigned int i;
+	double t, ns;
+
+	if (!ib->pcap_fname)
+		usage(EINVAL, "error: book benchmark needs a pcap file");
+
+	memset(&bb, 0, sizeof(bb));
+	if (book_bench_load(&bb, ib))
+		return EINVAL;
+	hist = calloc(BOOK_BENCH_TYPES, sizeof(*hist));
+	if (!hist) {
+		printf("failed to alloc histograms\n");
+		return ENOMEM;
+	}
+
+	printf("book: %s, msgs: %zu, symbols: %u\n", ib->pcap_fname,
+	       bb.num_msgs, bb.symbols.num_keys);
+	t = book_bench_replay(&bb);
+	tops = book_bench_tops(&bb, &errors);
+	printf("\treplay %8.2f M msgs/sec (%.3f sec), unknown ref.nums: %llu, "
+	       "overflows: %llu\n", 1.0e-6 * bb.num_msgs / t, t,
+	       bb.unknown_refns, bb.overflows);
+
+	ns = book_bench_replay_timed(&bb, hist);
+	tops_timed = book_bench_tops(&bb, &errors_timed);
+	printf("\tper msg ns:    count     mean      p50      p90      p99"
+	       "    p99.9   p99.99      max\n");
+	for (i = 0; i < BOOK_BENCH_TYPES; i++) {
+		h = &hist[i];
+		if (!h->count)
+			continue;
+		printf("\t%c      %11llu %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f "
+		       "%8.1f\n", book_bench_type[i], h->count,
+		       ns * h->sum / h->count,
+		       ns * hist_percentile(h, 50.0),
+		       ns * hist_percentile(h, 90.0),
+		       ns * hist_percentile(h, 99.0),
+		       ns * hist_percentile(h, 99.9),
+		       ns * hist_percentile(h, 99.99), ns * h->max);
+	}
+	printf("book errors: %llu, timed vs plain replay: %s\n", errors,
+	       tops == tops_timed && errors == errors_timed ? "ok" : "FAILED");
+
+	for (i = 0; i <= bb.symbols.num_keys; i++)
+		order_book_cleanup(&bb.book[i]);
+	free(bb.book);
+	dhash_cleanup(&bb.orders);
+	phash_cleanup(&bb.symbols);
+	free(bb.msg);
+	free(hist);
+	return tops == tops_timed && !errors ? 0 : EINVAL;
+}
+
+int main(int argc, char **argv)
+{
+	struct itchybench_info itchybench;
+	int ch, longindex = 0, err = 0;
+	const char *optname;
+
+	if (argc < 2)
+		usage(0, NULL);
+
+	memset(&itchybench, 0, sizeof(itchybench));
+	itchybench.max_threads = 16;
+	itchybench.num_keys = 1 << 20;
+	itchybench.to_sec = UINT32_MAX - 1;
+
+	opterr = 0;		/* global getopt variable */
+	for (;;) {
+		ch = getopt_long(argc, argv, short_options,
+				 long_options, &longindex);
+		if (ch < 0)
+			break;
+
+		optname = long_options[longindex].name;
+
+		switch (ch) {
+		case 'b':
+			itchybench.bench = optarg;
+			break;
+		case 'f':
+			itchybench.pcap_fname = optarg;
+			break;
+		case 'T':
+			err = str_to_int_ge(optarg, itchybench.from_sec, 0);
+			if (err)
+				usage(bad_optarg(err, optname, optarg), NULL);
+			itchybench.seek = 1;
+			break;
+		case 'E':
+			err = str_to_int_ge(optarg, itchybench.to_sec, 0);
+			if (err)
+				usage(bad_optarg(err, optname, optarg), NULL);
+			itchybench.seek = 1;
+			break;
+		case 'j':
+			err = str_to_int_range(optarg, itchybench.max_threads,
+					       1, 256, 10);
+			if (err)
+				usage(bad_optarg(err, optname, optarg), NULL);
+			break;
+		case 'n':
+			err = str_to_int_gt(optarg, itchybench.num_keys, 0);
+			if (err)
+				usage(bad_optarg(err, optname, optarg), NULL);
+			break;
+		case 'S':
+			err = str_to_int(optarg, itchybench.rand_seed, 0);
+			if (err)
+				usage(bad_optarg(err, optname, optarg), NULL);
+			break;
+		case 'v':
+			itchybench.verbose_mode = 1;
+			break;
+		case 'V':
+			version();
+			break;
+		case 'h':
+			usage(0, NULL);
+			break;
+		default:
+			if (optind == 1)
+				optind++;
+			printf("don't understand: %s\n", argv[optind - 1]);
+			usage(EINVAL, "error: unsupported arguments");
+			break;
+		}
+	}
+
+	if (!itchybench.bench)
+		usage(EINVAL, "error: benchmark name not supplied");
+
+	if (!strcmp(itchybench.bench, "crc"))
+		err = bench_crc(&itchybench);
+	else if (!strcmp(itchybench.bench, "dhash-mt"))
+		err = bench_dhash_mt(&itchybench);
+	else if (!strcmp(itchybench.bench, "gen"))
+		err = bench_gen(&itchybench);
+	else if (!strcmp(itchybench.bench, "book"))
+		err = bench_book(&itchybench);
+	else
+		usage(EINVAL, "error: unknown benchmark");
+
+	return err;
+}
@@ -55,18 +55,153 @@
 
 static char program_name[] = "itchygen";
 
+/*
+ * Events are allocated from a pool of fixed-size chunks, which are never
+ * moved or freed before exit: a 32-bit handle (chunk, index) stays valid
+ * and the writer resolves handles without taking a lock. The scheduling
+ * part of an event is kept apart from its payload, so that walking a time
+ * unit's list touches 8 bytes per event.
+ */
+#define EV_CHUNK_SHIFT	16
+#define EV_CHUNK_SIZE	(1U << EV_CHUNK_SHIFT)
+#define EV_MAX_CHUNKS	(1U << (32 - EV_CHUNK_SHIFT))
+
+struct event_sched {
+	uint32_t unit_time;	/* order within the time unit */
+	uint32_t next;		/* next event on the same list */
+};
+
+struct event_chunk {
+	struct event_sched sched[EV_CHUNK_SIZE];
+	struct order_event event[EV_CHUNK_SIZE];
+};
+
+/* order records come in chunks of the same size */
+struct order_chunk {
+	struct order_rec rec[EV_CHUNK_SIZE];
+};
+
+/* submitted events go to the writer in batches; every batch comes back
+ * with its events and the order records the writer dropped the last
+ * reference to, so all the pool bookkeeping stays in the generator thread */
+struct event_batch {
+	struct ulist_node node;
+	uint32_t first;		/* events to write, linked by sched.next */
+	uint32_t last;
+	unsigned int num;
+	uint32_t done_order_first;	/* records to return to the pool */
+	uint32_t done_order_last;
+	unsigned int num_done_orders;
+};
+
+struct event_pool {
+	struct event_chunk **chunk;	/* EV_MAX_CHUNKS, never reallocated */
+	unsigned int num_chunks;
+	uint32_t free_head;
+	/* the live counts drop as soon as the writer is done, not when its
+	 * batches are reclaimed, so they are updated atomically */
+	unsigned long num_live;
+	unsigned long max_live;
+	struct order_chunk **ord_chunk;	/* EV_MAX_CHUNKS as well */
+	unsigned int num_ord_chunks;
+	uint32_t ord_free_head;
+	unsigned long num_orders_live;
+	unsigned long max_orders_live;
+	unsigned int num_batches;
+	struct event_batch *cur_batch;
+	struct ulist_head spare_batches;
+	struct usync_queue done_queue;
+};
+
+/* bit per time unit holding events, then a bit per non-zero word of
+ * the level below, up to a single word: the next busy unit is found
+ * with a few ctz's, however many empty units lie in between */
+#define TBITMAP_MAX_LEVELS	6
+
+struct time_bitmap {
+	unsigned int num_levels;
+	unsigned int num_words[TBITMAP_MAX_LEVELS];
+	uint64_t *level[TBITMAP_MAX_LEVELS];
+};
+
+#define TBIT_NONE	(~0U)
+#define TUNIT_NONE	(~0ULL)
+#define TUNIT_HIST_BUCKETS	16
+
+/* an event parked past the ring window; ties on time keep insertion order */
+struct time_far {
+	uint64_t time;
+	uint32_t h;
+	uint32_t seq;
+};
+
+/*
+ * The unit lists form a ring of ring_units slots covering the units from
+ * first_unit on; unit ids are absolute, the slot is the id modulo the
+ * ring. Events further ahead wait in a min-heap and move into the ring
+ * as first_unit advances, so the horizon is not bounded by the run time.
+ */
 struct time_list {
-	struct ulist_head *head;
-	unsigned int time_units;
-	unsigned int first_unit;
-	unsigned int last_unit;
+	uint32_t *head;		/* per slot, sorted by unit_time */
+	uint32_t *tail;
+	struct time_bitmap busy;	/* per slot */
+	unsigned int shift;	/* units of 2^shift nsec */
+	double expect_events;	/* per unit, by the rate and order mix */
+	unsigned int ring_units;
+	unsigned long long first_unit;
+	uint64_t last_time;	/* latest listed event */
+	struct time_far *far;
+	unsigned int num_far;
+	unsigned int far_size;
+	uint32_t far_seq;
+	unsigned long long far_events;
+	unsigned int max_far;
+	/* events queued per unit, counted as the units are drained */
+	unsigned long long drain_unit;
+	unsigned int drain_events;
+	unsigned long long busy_units;
+	unsigned long long listed_events;
+	unsigned int max_events;
+	unsigned long long occupancy[TUNIT_HIST_BUCKETS];	/* log2 */
 };
 
 #define DEFAULT_MIN_TIME2UPD	10
 
+/*
+ * Parameters of the coming new orders, drawn a batch at a time into
+ * per-field arrays: all draws of a field are taken together and mapped
+ * by a single loop, apart from the scheduling and the update chains
+ */
+#define DEFAULT_GEN_BATCH	256
+#define MAX_GEN_BATCH		65536
+#define ORDER_BATCH_DRAWS	6	/* per order, with a subscription list */
+
+struct order_batch {
+	unsigned int size;
+	unsigned int num;
+	unsigned int next;
+	long int *rnd;
+	double *dtime;		/* since the previous order, sec */
+	unsigned char *subscr;	/* subscription interval, 0 if subscribed */
+	uint16_t *locate;
+	int *buy;
+	int *shares;		/* in round lots */
+	int *price;
+	struct rand_range all_sym;	/* symbol index in the files */
+	struct rand_range list_sym;
+};
+
+/* ref.nums added to the hash in one batch, handed out one by one */
+struct refn_pool {
+	unsigned int num;
+	unsigned int next;
+	uint32_t refn[DHASH_BATCH_MAX];
+};
+
 struct itchygen_info {
 	struct symbols_file all_sym;
 	struct symbols_file list_sym;
+	struct symbol_table symbols;
 
 	unsigned int run_time;
 	unsigned long orders_rate;
@@ -75,9 +210,11 @@ struct itchygen_info {
 
 	unsigned int time2update;
 	unsigned int time2update_min;
-	double time2update_min_f;
+	uint64_t time2update_min_ns;
+	double time2update_exp_mean;	/* sec, of the part above the minimum */
 
 	int num_prob_args;
+	unsigned int gen_batch;
 	int seq_ref_num;
 	int no_hash_del;
 	int debug_mode;
@@ -98,8 +235,11 @@ struct itchygen_info {
 	unsigned int num_poly;
 	uint32_t poly[MAX_POLY];
 	struct dhash_table dhash;
+	struct refn_pool refn_pool;
+	struct order_batch order_batch;
 	struct itchygen_stat stat;
-	double cur_time;
+	uint64_t cur_time;	/* nsec */
+	struct event_pool ev_pool;
 	struct time_list time_list;
 	struct usync_queue ev_queue;
 	struct rand_interval order_type_prob_int[MODIFY_ORDER_NUM_TYPES];
@@ -124,6 +264,10 @@ static void print_params(struct itchygen_info *itchygen)
 		itchygen->order_type_prob_int[ORDER_EXEC].pcts_total,
 		itchygen->order_type_prob_int[ORDER_CANCEL].pcts_total,
 		itchygen->order_type_prob_int[ORDER_REPLACE].pcts_total);
+	printf("\ttime unit: %.3f ms (2^%u nsec), expected %.1f events/unit\n",
+	       (double)(1ULL << itchygen->time_list.shift) / 1.0e6,
+	       itchygen->time_list.shift, itchygen->time_list.expect_events);
+	printf("\tnew orders drawn in batches of %u\n", itchygen->gen_batch);
 
 	printf("\t[%02x:%02x:%02x:%02x:%02x:%02x] %s:%d -> "
 		"[%02x:%02x:%02x:%02x:%02x:%02x] %s:%d\n",
@@ -149,9 +293,10 @@ static void print_params(struct itchygen_info *itchygen)
 
 	printf("\toutput pcap file: %s\n",
 		itchygen->out_fname ? : "itchygen.pcap");
-	printf("\tsymbols file: %s, lines: %d, used: %d\n",
+	printf("\tsymbols file: %s, lines: %d, used: %d%s\n",
 		itchygen->all_sym.fname, itchygen->all_sym.num_lines,
-		itchygen->all_sym.num_symbols);
+		itchygen->all_sym.num_symbols,
+		itchygen->all_sym.cached ? " (cached)" : "");
 	if (itchygen->list_sym.fname) {
 		printf("\tsubscription file: %s, lines: %d, used: %d, "
 			"probability: %d%%\n",
@@ -165,170 +310,532 @@ static void print_params(struct itchygen_info *itchygen)
 		       "when either time or orders run out\n\n");
 }
 
-static unsigned long long generate_ref_num(struct itchygen_info *itchygen)
+static void refn_pool_fill(struct itchygen_info *itchygen)
+{
+	struct refn_pool *pool = &itchygen->refn_pool;
+	uint32_t refn[DHASH_BATCH_MAX];
+	int err[DHASH_BATCH_MAX];
+	int i, last_added, full;
+
+	pool->num = 0;
+	pool->next = 0;
+	do {
+		last_added = -1;
+		full = 0;
+		for (i = 0; i < DHASH_BATCH_MAX; i++) {
+			if (!itchygen->seq_ref_num)
+				refn[i] = rand_uint32();
+			else
+				refn[i] = (uint32_t) (++itchygen->cur_ref_num);
+		}
+		dhash_add_batch(&itchygen->dhash, refn, err, DHASH_BATCH_MAX);
+
+		for (i = 0; i < DHASH_BATCH_MAX; i++) {
+			if (likely(!err[i])) {	/* added successfully */
+				pool->refn[pool->num++] = refn[i];
+				last_added = i;
+			} else if (err[i] == EEXIST)	/* only in random mode */
+				assert(!itchygen->seq_ref_num);
+			else if (err[i] == ENOMEM)	/* no space in bucket(s) */
+				itchygen->stat.bucket_overflows++;
+			else {
+				assert(err[i] == ENOSPC);
+				full = 1;
+			}
+		}
+		if (full && !pool->num) {
+			printf("hash table full, can't generate refnum\n");
+			exit(1);
+		}
+		/* the ones past the last added are drawn again */
+		if (full && itchygen->seq_ref_num)
+			itchygen->cur_ref_num -= DHASH_BATCH_MAX - 1 - last_added;
+	} while (!pool->num);
+}
+
+/* the ref.nums added but not handed out leave the hash */
+static void refn_pool_drain(struct itchygen_info *itchygen)
 {
-	uint32_t refn32;
+	struct refn_pool *pool = &itchygen->refn_pool;
 	int err;
 
- generate:
-	if (!itchygen->seq_ref_num)
-		refn32 = rand_uint32();
-	else
-		refn32 = (uint32_t) (++itchygen->cur_ref_num);
-
-	err = dhash_add(&itchygen->dhash, refn32);
-	if (likely(!err))	/* added successfully */
-		return (unsigned long long)refn32;
-	else if (err == EEXIST) {	/* only in random refnum mode */
-		assert(!itchygen->seq_ref_num);
-		goto generate;
-	} else if (err == ENOMEM) {	/* no space in the bucket(s) */
-		itchygen->stat.bucket_overflows++;
-		goto generate;
-	} else {
-		assert(err == ENOSPC);
-		printf("hash table full, can't generate refnum\n");
-		exit(1);
+	for (; pool->next < pool->num; pool->next++) {
+		err = dhash_del(&itchygen->dhash, pool->refn[pool->next]);
+		assert(!err);
 	}
 }
 
-static inline double gen_inter_order_time(struct itchygen_info *itchygen)
+static unsigned long long generate_ref_num(struct itchygen_info *itchygen)
+{
+	struct refn_pool *pool = &itchygen->refn_pool;
+
+	if (unlikely(pool->next == pool->num))
+		refn_pool_fill(itchygen);
+	return (unsigned long long)pool->refn[pool->next++];
+}
+
+/* exponential samples are drawn in seconds and converted to nsec once,
+ * rounded to the nearest so that the sums do not drift; the timeline
+ * itself is integer; i is the order in the batch */
+static inline uint64_t gen_inter_order_time(struct itchygen_info *itchygen,
+					    unsigned int i)
 {
-	return rand_exp_time_by_rate((double)itchygen->orders_rate);
+	return (uint64_t)(itchygen->order_batch.dtime[i] *
+			  (double)NSEC_PER_SEC + 0.5);
 }
 
-static inline double gen_time_to_update(struct itchygen_info *itchygen)
+static inline uint64_t gen_time_to_update(struct itchygen_info *itchygen)
 {
-	/* mean time-to-update given in msecs */
-	unsigned int mean_time_msec =
-		(itchygen->time2update > itchygen->time2update_min) ?
-		(itchygen->time2update - itchygen->time2update_min) : 0;
-	double mean_sec = 0.001 * (double)mean_time_msec;
 	/* lower limit 10 msec */
-	return itchygen->time2update_min_f + rand_exp_time_by_mean(mean_sec);
+	return itchygen->time2update_min_ns +
+	    (uint64_t)(rand_exp_time_by_mean(itchygen->time2update_exp_mean) *
+		       (double)NSEC_PER_SEC + 0.5);
 }
 
-static void order_event_free_back(struct order_event *event)
+static void order_batch_init(struct itchygen_info *itchygen,
+			     unsigned int size)
 {
-	struct order_event *prev_event;
+	struct order_batch *ob = &itchygen->order_batch;
+
+	memset(ob, 0, sizeof(*ob));
+	ob->size = size;
+	rand_range_init(&ob->all_sym, 0, itchygen->all_sym.num_symbols - 1);
+	if (itchygen->list_sym.fname)
+		rand_range_init(&ob->list_sym, 0,
+				itchygen->list_sym.num_symbols - 1);
+	ob->rnd = malloc(ORDER_BATCH_DRAWS * size * sizeof(*ob->rnd));
+	ob->dtime = malloc(size * sizeof(*ob->dtime));
+	ob->subscr = malloc(size * sizeof(*ob->subscr));
+	ob->locate = malloc(size * sizeof(*ob->locate));
+	ob->buy = malloc(size * sizeof(*ob->buy));
+	ob->shares = malloc(size * sizeof(*ob->shares));
+	ob->price = malloc(size * sizeof(*ob->price));
+	assert(ob->rnd && ob->dtime && ob->subscr && ob->locate && ob->buy &&
+	       ob->shares && ob->price);
+}
 
-	do {
-		prev_event = event->prev_event;
-		free(event);
+static void order_batch_cleanup(struct order_batch *ob)
+{
+	free(ob->rnd);
+	free(ob->dtime);
+	free(ob->subscr);
+	free(ob->locate);
+	free(ob->buy);
+	free(ob->shares);
+	free(ob->price);
+}
+
+/* the draws of a field are consecutive: a batch of one draws in the order
+ * the fields were drawn one at a time */
+static void order_batch_fill(struct itchygen_info *itchygen, unsigned int n)
+{
+	struct order_batch *ob = &itchygen->order_batch;
+	long int *r = ob->rnd;
+	unsigned int i, loc;
+
+	rand_fill(r, (itchygen->list_sym.fname ?
+		      ORDER_BATCH_DRAWS : ORDER_BATCH_DRAWS - 1) * n);
+
+	rand_exp_fill_by_rate(ob->dtime, r, n, (double)itchygen->orders_rate);
+	r += n;
+	if (itchygen->list_sym.fname) {
+		rand_index_fill(ob->subscr, r, n, itchygen->subscribed_prob_int,
+				2);
+		r += n;
+	} else {
+		memset(ob->subscr, 1, n);
+	}
+	for (i = 0; i < n; i++) {
+		if (ob->subscr[i])
+			ob->locate[i] = itchygen->all_sym.locate[
+			    rand_range_map(&ob->all_sym, r[i])];
+		else
+			ob->locate[i] = itchygen->list_sym.locate[
+			    rand_range_map(&ob->list_sym, r[i])];
+	}
+	r += n;
+	rand_int_range_fill(ob->buy, r, n, 0, 1);
+	r += n;
+	rand_int_range_fill(ob->shares, r, n, 1, 250);
+	r += n;
+	for (i = 0; i < n; i++) {
+		loc = ob->locate[i];
+		ob->price[i] = rand_int_range_map(r[i],
+					itchygen->symbols.min_price[loc],
+					itchygen->symbols.max_price[loc]);
+	}
+
+	ob->num = n;
+	ob->next = 0;
+}
+
+static inline struct order_event *ev_ptr(struct event_pool *pool,
+					 uint32_t h)
+{
+	return &pool->chunk[h >> EV_CHUNK_SHIFT]->event[h & (EV_CHUNK_SIZE - 1)];
+}
+
+static inline struct event_sched *ev_sched(struct event_pool *pool,
+					   uint32_t h)
+{
+	return &pool->chunk[h >> EV_CHUNK_SHIFT]->sched[h & (EV_CHUNK_SIZE - 1)];
+}
+
+static inline struct order_rec *ord_ptr(struct event_pool *pool, uint32_t h)
+{
+	return &pool->ord_chunk[h >> EV_CHUNK_SHIFT]->rec[h & (EV_CHUNK_SIZE - 1)];
+}
+
+static void event_pool_init(struct event_pool *pool)
+{
+	memset(pool, 0, sizeof(*pool));
+	pool->chunk = calloc(EV_MAX_CHUNKS, sizeof(*pool->chunk));
+	pool->ord_chunk = calloc(EV_MAX_CHUNKS, sizeof(*pool->ord_chunk));
+	assert(pool->chunk && pool->ord_chunk);
+	pool->free_head = EVENT_HANDLE_NONE;
+	pool->ord_free_head = EVENT_HANDLE_NONE;
+	ulist_head_init(&pool->spare_batches);
+	usync_queue_init(&pool->done_queue);
+}
+
+/* take back the batches the writer is done with, along with their events
+ * and released order records */
+static void event_pool_reclaim(struct event_pool *pool)
+{
+	struct ulist_head done_list = ULIST_HEAD_INIT(done_list);
+	struct event_batch *batch, *next;
+
+	if (usync_queue_try_pull_list(&pool->done_queue, &done_list))
+		return;
+
+	ulist_for_each_safe(&done_list, batch, next, node) {
+		ulist_del_from(&done_list, &batch->node);
+		if (batch->num) {
+			ev_sched(pool, batch->last)->next = pool->free_head;
+			pool->free_head = batch->first;
+		}
+		if (batch->num_done_orders) {
+			ord_ptr(pool, batch->done_order_last)->next =
+			    pool->ord_free_head;
+			pool->ord_free_head = batch->done_order_first;
+		}
+		ulist_add(&pool->spare_batches, &batch->node);
+	}
+}
+
+static int event_pool_grow(struct event_pool *pool)
+{
+	struct event_chunk *chunk;
+	uint32_t h, i;
+
+	/* the last chunk is never used, its last handle reads as none */
+	if (pool->num_chunks == EV_MAX_CHUNKS - 1)
+		return ENOMEM;
+	chunk = malloc(sizeof(*chunk));
+	if (!chunk)
+		return ENOMEM;
+
+	h = pool->num_chunks << EV_CHUNK_SHIFT;
+	for (i = 0; i < EV_CHUNK_SIZE - 1; i++)
+		chunk->sched[i].next = h + i + 1;
+	chunk->sched[i].next = pool->free_head;
+	pool->chunk[pool->num_chunks++] = chunk;
+	pool->free_head = h;
+	return 0;
+}
+
+static int order_pool_grow(struct event_pool *pool)
+{
+	struct order_chunk *chunk;
+	uint32_t h, i;
+
+	if (pool->num_ord_chunks == EV_MAX_CHUNKS - 1)
+		return ENOMEM;
+	chunk = malloc(sizeof(*chunk));
+	if (!chunk)
+		return ENOMEM;
+
+	h = pool->num_ord_chunks << EV_CHUNK_SHIFT;
+	for (i = 0; i < EV_CHUNK_SIZE - 1; i++)
+		chunk->rec[i].next = h + i + 1;
+	chunk->rec[i].next = pool->ord_free_head;
+	pool->ord_chunk[pool->num_ord_chunks++] = chunk;
+	pool->ord_free_head = h;
+	return 0;
+}
+
+static void event_pool_cleanup(struct event_pool *pool)
+{
+	struct event_batch *batch;
+	unsigned int i;
+
+	event_pool_reclaim(pool);
+	while ((batch = ulist_pop(&pool->spare_batches, struct event_batch,
+				  node)) != NULL)
+		free(batch);
+	free(pool->cur_batch);
+	for (i = 0; i < pool->num_chunks; i++)
+		free(pool->chunk[i]);
+	free(pool->chunk);
+	for (i = 0; i < pool->num_ord_chunks; i++)
+		free(pool->ord_chunk[i]);
+	free(pool->ord_chunk);
+}
+
+static uint32_t event_alloc(struct itchygen_info *itchygen,
+			    struct order_event **event)
+{
+	struct event_pool *pool = &itchygen->ev_pool;
+	unsigned long live;
+	uint32_t h;
+
+	if (unlikely(pool->free_head == EVENT_HANDLE_NONE)) {
+		event_pool_reclaim(pool);
+		if (pool->free_head == EVENT_HANDLE_NONE &&
+		    event_pool_grow(pool)) {
+			printf("failed to alloc events, %lu in use\n",
+			       pool->num_live);
+			exit(ENOMEM);
+		}
+	}
+	h = pool->free_head;
+	pool->free_head = ev_sched(pool, h)->next;
+	live = __atomic_add_fetch(&pool->num_live, 1, __ATOMIC_RELAXED);
+	if (live > pool->max_live)
+		pool->max_live = live;
+
+	*event = ev_ptr(pool, h);
+	return h;
+}
+
+/* the new record holds the generator's reference */
+static uint32_t order_rec_alloc(struct itchygen_info *itchygen,
+				struct order_rec **order)
+{
+	struct event_pool *pool = &itchygen->ev_pool;
+	unsigned long live;
+	uint32_t h;
+
+	if (unlikely(pool->ord_free_head == EVENT_HANDLE_NONE)) {
+		event_pool_reclaim(pool);
+		if (pool->ord_free_head == EVENT_HANDLE_NONE &&
+		    order_pool_grow(pool)) {
+			printf("failed to alloc orders, %lu in use\n",
+			       pool->num_orders_live);
+			exit(ENOMEM);
+		}
+	}
+	h = pool->ord_free_head;
+	*order = ord_ptr(pool, h);
+	pool->ord_free_head = (*order)->next;
+	live = __atomic_add_fetch(&pool->num_orders_live, 1, __ATOMIC_RELAXED);
+	if (live > pool->max_orders_live)
+		pool->max_orders_live = live;
+
+	(*order)->refcnt = 1;
+	return h;
+}
+
+/* an event refers to the record: the writer drops the reference */
+static inline void order_rec_get(struct order_rec *order)
+{
+	__atomic_add_fetch(&order->refcnt, 1, __ATOMIC_RELAXED);
+}
+
+/* generator side, once no more events of the record will be made */
+static void order_rec_put(struct itchygen_info *itchygen, uint32_t h)
+{
+	struct event_pool *pool = &itchygen->ev_pool;
+	struct order_rec *order = ord_ptr(pool, h);
+
+	if (__atomic_sub_fetch(&order->refcnt, 1, __ATOMIC_ACQ_REL))
+		return;
+	order->next = pool->ord_free_head;
+	pool->ord_free_head = h;
+	__atomic_sub_fetch(&pool->num_orders_live, 1, __ATOMIC_RELAXED);
+}
+
+/* writer side: the last reference goes back with the batch */
+static void order_rec_put_batch(struct event_pool *pool,
+				struct event_batch *batch, uint32_t h)
+{
+	struct order_rec *order = ord_ptr(pool, h);
+
+	if (__atomic_sub_fetch(&order->refcnt, 1, __ATOMIC_ACQ_REL))
+		return;
+	order->next = batch->done_order_first;
+	if (batch->done_order_first == EVENT_HANDLE_NONE)
+		batch->done_order_last = h;
+	batch->done_order_first = h;
+	batch->num_done_orders++;
+	__atomic_sub_fetch(&pool->num_orders_live, 1, __ATOMIC_RELAXED);
+}
+
+static struct event_batch *event_batch_get(struct event_pool *pool)
+{
+	struct event_batch *batch;
+
+	batch = ulist_pop(&pool->spare_batches, struct event_batch, node);
+	if (!batch) {
+		event_pool_reclaim(pool);
+		batch = ulist_pop(&pool->spare_batches, struct event_batch,
+				  node);
+	}
+	if (!batch) {
+		batch = malloc(sizeof(*batch));
+		assert(batch);
+		pool->num_batches++;
 	}
-	while ((event = prev_event) != NULL);
+	batch->first = batch->last = EVENT_HANDLE_NONE;
+	batch->num = 0;
+	batch->done_order_first = batch->done_order_last = EVENT_HANDLE_NONE;
+	batch->num_done_orders = 0;
+	return batch;
+}
+
+static void event_batch_add(struct itchygen_info *itchygen, uint32_t h)
+{
+	struct event_pool *pool = &itchygen->ev_pool;
+	struct event_batch *batch = pool->cur_batch;
+
+	if (!batch)
+		batch = pool->cur_batch = event_batch_get(pool);
+
+	ev_sched(pool, h)->next = EVENT_HANDLE_NONE;
+	if (batch->first == EVENT_HANDLE_NONE)
+		batch->first = h;
+	else
+		ev_sched(pool, batch->last)->next = h;
+	batch->last = h;
+	batch->num++;
+}
+
+static void event_batch_push(struct itchygen_info *itchygen)
+{
+	struct event_batch *batch = itchygen->ev_pool.cur_batch;
+
+	if (!batch)
+		return;
+	itchygen->ev_pool.cur_batch = NULL;
+	usync_queue_push_node(&itchygen->ev_queue, &batch->node);
 }
 
 static int pcap_order_add(struct itchygen_info *itchygen,
-			  struct order_event *event)
+			  struct order_rec *order, struct order_event *event,
+			  unsigned long long seq_num)
 {
 	struct itch_packet pkt = {
 		.mold = {
-			 .seq_num = htobe64(event->seq_num),
+			 .seq_num = htobe64(seq_num),
 			 .msg_cnt = htobe16(1),
 			 },
 		.msg.order = {
 			      .msg_type = MSG_TYPE_ADD_ORDER_NO_MPID,
-			      .timestamp_ns = htobe32(event->t_nsec),
-			      .ref_num = htobe64(event->ref_num),
+			      .timestamp_ns = htobe32(order_event_nsec(event)),
+			      .ref_num = htobe64(order->ref_num),
 			      .buy_sell =
 			      event->add.buy ? ITCH_ORDER_BUY : ITCH_ORDER_SELL,
-			      .shares = htobe32(event->add.shares),
-			      .price = htobe32(event->add.price),
+			      .shares = htobe32(event->shares),
+			      .price = htobe32(event->price),
 			      },
 	};
 
 	memcpy(&pkt.mold.session, "sessionabc", 10);
-	memcpy(pkt.msg.order.stock, event->symbol->name,
+	memcpy(pkt.msg.order.stock, itchygen->symbols.name[order->locate],
 	       sizeof(pkt.msg.order.stock));
 
-	return pcap_file_add_record(event->t_sec,
-				    (event->t_nsec / 1000) + 3,
+	return pcap_file_add_record(order_event_sec(event),
+				    (order_event_nsec(event) / 1000) + 3,
 				    &pkt,
 				    sizeof(pkt.mold) + sizeof(pkt.msg.order));
 }
 
 static int pcap_order_cancel(struct itchygen_info *itchygen,
-			     struct order_event *event)
+			     struct order_rec *order, struct order_event *event,
+			     unsigned long long seq_num)
 {
 	struct itch_packet pkt = {
 		.mold = {
-			 .seq_num = htobe64(event->seq_num),
+			 .seq_num = htobe64(seq_num),
 			 .msg_cnt = htobe16(1),
 			 },
 		.msg.cancel = {
 			       .msg_type = MSG_TYPE_ORDER_CANCEL,
-			       .timestamp_ns = htobe32(event->t_nsec),
-			       .ref_num = htobe64(event->ref_num),
-			       .shares = htobe32(event->cancel.shares),
+			       .timestamp_ns = htobe32(order_event_nsec(event)),
+			       .ref_num = htobe64(order->ref_num),
+			       .shares = htobe32(event->shares),
 			       },
 	};
 
 	memcpy(&pkt.mold.session, "sessionabc", 10);
-	return pcap_file_add_record(event->t_sec,
-				    (event->t_nsec / 1000) + 3,
+	return pcap_file_add_record(order_event_sec(event),
+				    (order_event_nsec(event) / 1000) + 3,
 				    &pkt,
 				    sizeof(pkt.mold) + sizeof(pkt.msg.cancel));
 }
 
 static int pcap_order_exec(struct itchygen_info *itchygen,
-			   struct order_event *event)
+			   struct order_rec *order, struct order_event *event,
+			   unsigned long long seq_num)
 {
 	struct itch_packet pkt = {
 		.mold = {
-			 .seq_num = htobe64(event->seq_num),
+			 .seq_num = htobe64(seq_num),
 			 .msg_cnt = htobe16(1),
 			 },
 		.msg.exec = {
 			     .msg_type = MSG_TYPE_ORDER_EXECUTED,
-			     .timestamp_ns = htobe32(event->t_nsec),
-			     .ref_num = htobe64(event->ref_num),
-			     .shares = htobe32(event->exec.shares),
+			     .timestamp_ns = htobe32(order_event_nsec(event)),
+			     .ref_num = htobe64(order->ref_num),
+			     .shares = htobe32(event->shares),
 			     .match_num = htobe64(event->exec.match_num),
 			     .printable = 'Y',
-			     .price = htobe32(event->exec.price),
+			     .price = htobe32(event->price),
 			     },
 	};
 
 	memcpy(&pkt.mold.session, "sessionabc", 10);
-	return pcap_file_add_record(event->t_sec,
-				    (event->t_nsec / 1000) + 3,
+	return pcap_file_add_record(order_event_sec(event),
+				    (order_event_nsec(event) / 1000) + 3,
 				    &pkt,
 				    sizeof(pkt.mold) + sizeof(pkt.msg.exec));
 }
 
 static int pcap_order_replace(struct itchygen_info *itchygen,
-			      struct order_event *event)
+			      struct order_rec *order,
+			      struct order_event *event,
+			      unsigned long long seq_num)
 {
 	struct itch_packet pkt = {
 		.mold = {
-			 .seq_num = htobe64(event->seq_num),
+			 .seq_num = htobe64(seq_num),
 			 .msg_cnt = htobe16(1),
 			 },
 		.msg.replace = {
 				.msg_type = MSG_TYPE_ORDER_REPLACE,
-				.timestamp_ns = htobe32(event->t_nsec),
-				.orig_ref_num =
-				htobe64(event->replace.orig_ref_num),
-				.new_ref_num = htobe64(event->ref_num),
-				.shares = htobe32(event->replace.shares),
-				.price = htobe32(event->replace.price),
+				.timestamp_ns = htobe32(order_event_nsec(event)),
+				.orig_ref_num = htobe64(order->ref_num),
+				.new_ref_num =
+				htobe64(event->replace.new_ref_num),
+				.shares = htobe32(event->shares),
+				.price = htobe32(event->price),
 				},
 	};
 
 	memcpy(&pkt.mold.session, "sessionabc", 10);
-	return pcap_file_add_record(event->t_sec,
-				    (event->t_nsec / 1000) + 3,
+	return pcap_file_add_record(order_event_sec(event),
+				    (order_event_nsec(event) / 1000) + 3,
 				    &pkt,
 				    sizeof(pkt.mold) + sizeof(pkt.msg.replace));
 }
 
 static int pcap_order_timestamp(struct itchygen_info *itchygen,
-				struct order_event *event)
+				struct order_event *event,
+				unsigned long long seq_num)
 {
 	struct itch_packet pkt = {
 		.mold = {
-			 .seq_num = htobe64(event->seq_num),
+			 .seq_num = htobe64(seq_num),
 			 .msg_cnt = htobe16(1),
 			 },
 		.msg.time = {
@@ -338,32 +845,34 @@ static int pcap_order_timestamp(struct itchygen_info *itchygen,
 	};
 
 	memcpy(&pkt.mold.session, "sessionabc", 10);
-	return pcap_file_add_record(event->t_sec,
-				    (event->t_nsec / 1000) + 3,
+	return pcap_file_add_record(order_event_sec(event),
+				    (order_event_nsec(event) / 1000) + 3,
 				    &pkt,
 				    sizeof(pkt.mold) + sizeof(pkt.msg.time));
 }
 
 static void order_event_pcap_msg(struct itchygen_info *itchygen,
-				 struct order_event *event)
+				 struct order_rec *order,
+				 struct order_event *event,
+				 unsigned long long seq_num)
 {
 	int err;
 
 	switch (event->type) {
 	case ORDER_ADD:
-		err = pcap_order_add(itchygen, event);
+		err = pcap_order_add(itchygen, order, event, seq_num);
 		break;
 	case ORDER_EXEC:
-		err = pcap_order_exec(itchygen, event);
+		err = pcap_order_exec(itchygen, order, event, seq_num);
 		break;
 	case ORDER_CANCEL:
-		err = pcap_order_cancel(itchygen, event);
+		err = pcap_order_cancel(itchygen, order, event, seq_num);
 		break;
 	case ORDER_REPLACE:
-		err = pcap_order_replace(itchygen, event);
+		err = pcap_order_replace(itchygen, order, event, seq_num);
 		break;
 	case ORDER_TIMESTAMP:
-		err = pcap_order_timestamp(itchygen, event);
+		err = pcap_order_timestamp(itchygen, event, seq_num);
 		break;
 	default:
 		assert(0);
@@ -377,150 +886,471 @@ static void order_event_pcap_msg(struct itchygen_info *itchygen,
 	}
 }
 
-void order_event_submit(struct itchygen_info *itchygen,
-			struct order_event *event)
+static inline struct order_rec *event_order(struct event_pool *pool,
+					    struct order_event *event)
 {
-	event->seq_num = itchygen->cur_seq_num++;
+	return event->order != EVENT_HANDLE_NONE ?
+	    ord_ptr(pool, event->order) : NULL;
+}
+
+/* seq.nums are assigned in submission order, which the writer follows:
+ * both sides count them, the event does not carry one */
+void order_event_submit(struct itchygen_info *itchygen, uint32_t h)
+{
+	struct event_pool *pool = &itchygen->ev_pool;
+	struct order_event *event = ev_ptr(pool, h);
 
 	if (unlikely(itchygen->verbose_mode))
-		order_event_print(event, ">>>", 1);
+		order_event_print(&itchygen->symbols, event_order(pool, event),
+				  event, ">>>", &itchygen->cur_seq_num);
+	itchygen->cur_seq_num++;
 
-	if (!event->remain_shares) {
+	if (event->last) {
 		int err = dhash_del(&itchygen->dhash,
-				    (uint32_t) event->ref_num);
+				    ord_ptr(pool, event->order)->ref_num);
 		assert(!err);
 	}
-	usync_queue_accum(&itchygen->ev_queue, &event->time_node);
+	event_batch_add(itchygen, h);
 }
 
-#define TUNIT_SEC_SHIFT  9
-#define TUNIT_NSEC_SHIFT (32 - TUNIT_SEC_SHIFT)
-#define TUNIT_NSEC_MASK  ((1L << TUNIT_NSEC_SHIFT) - 1)
+/*
+ * Time units are 2^shift nsec wide: unit id and time within the unit are
+ * plain shifts of the nsec timeline. The width is picked at startup so
+ * that a unit queues about TUNIT_TARGET_EVENTS events: enough to make the
+ * per-unit overhead negligible, few enough to keep the sorted inserts
+ * short.
+ */
+#define TUNIT_TARGET_EVENTS	16
+#define TUNIT_MIN_SHIFT		12	/* ~4 usec */
+#define TUNIT_MAX_SHIFT		30	/* ~1.07 sec */
+#define TUNIT_MIN_UNITS		(1U << 6)
+#define TUNIT_MAX_UNITS		(1U << 22)	/* bounds the per-slot arrays */
+#define TUNIT_WINDOW_MEANS	8	/* of the update time, the rest is parked */
+
+static inline unsigned long long time_unit_id(struct time_list *time_list,
+					      uint64_t time)
+{
+	return time >> time_list->shift;
+}
 
-static void time_list_init(struct itchygen_info *itchygen)
+static inline uint32_t time_unit_time(struct time_list *time_list,
+				      uint64_t time)
 {
-	struct time_list *time_list = &itchygen->time_list;
-	int i;
+	return (uint32_t)(time & ((1ULL << time_list->shift) - 1));
+}
+
+static inline unsigned int time_unit_slot(struct time_list *time_list,
+					  unsigned long long unit_id)
+{
+	return (unsigned int)(unit_id & (time_list->ring_units - 1));
+}
+
+static unsigned int time_unit_shift(struct itchygen_info *itchygen,
+				    double *expect_events)
+{
+	double p_replace, updates, rate;
+	unsigned int shift;
+
+	/* an order is updated until an exec or a cancel ends it, so the
+	 * number of its queued updates is geometric in the replace share */
+	p_replace = itchygen->order_type_prob_int[ORDER_REPLACE].pcts_total /
+	    100.0;
+	if (p_replace > 0.99)
+		p_replace = 0.99;
+	updates = 1.0 / (1.0 - p_replace);
+	rate = (double)itchygen->orders_rate * updates + 1.0;	/* + timestamps */
+
+	for (shift = TUNIT_MIN_SHIFT; shift < TUNIT_MAX_SHIFT; shift++) {
+		if ((double)(1ULL << (shift + 1)) * rate >
+		    TUNIT_TARGET_EVENTS * (double)NSEC_PER_SEC)
+			break;
+	}
+	/* updates come at least time2update_min after their order: keep
+	 * them out of the unit being drained when the new order arrives */
+	while (shift > TUNIT_MIN_SHIFT &&
+	       (1ULL << shift) > itchygen->time2update_min_ns)
+		shift--;
+
+	*expect_events = rate * (double)(1ULL << shift) / NSEC_PER_SEC;
+	return shift;
+}
 
-	time_list->time_units = ((itchygen->run_time + 100) << TUNIT_SEC_SHIFT);
-	time_list->first_unit = 0;
-	time_list->last_unit = 0;
+/* the ring spans most update times, and a second for the timestamps,
+ * but no more slots than about twice the events pending at a time: with
+ * long update times, most of them wait in the heap instead */
+static unsigned int time_unit_ring(struct itchygen_info *itchygen,
+				   unsigned int shift, double expect_events)
+{
+	double mean = (double)itchygen->time2update_min_ns / NSEC_PER_SEC +
+	    itchygen->time2update_exp_mean;
+	double pending = expect_events * (double)NSEC_PER_SEC /
+	    (double)(1ULL << shift) * mean;
+	uint64_t window = itchygen->time2update_min_ns +
+	    (uint64_t)(TUNIT_WINDOW_MEANS * itchygen->time2update_exp_mean *
+		       NSEC_PER_SEC);
+	unsigned int ring = TUNIT_MIN_UNITS;
+
+	if (window < NSEC_PER_SEC)
+		window = NSEC_PER_SEC;
+	while (ring < TUNIT_MAX_UNITS && ((uint64_t)ring << shift) < window &&
+	       ring < 2 * pending)
+		ring <<= 1;
+	return ring;
+}
 
-	time_list->head =
-	    malloc(sizeof(*time_list->head) * time_list->time_units);
-	assert(time_list->head);
+static void time_bitmap_init(struct time_bitmap *bm, unsigned int num_bits)
+{
+	unsigned int l = 0;
 
-	for (i = 0; i < time_list->time_units; i++)
-		ulist_head_init(&time_list->head[i]);
+	memset(bm, 0, sizeof(*bm));
+	do {
+		assert(l < TBITMAP_MAX_LEVELS);
+		num_bits = (num_bits + 63) / 64;
+		bm->num_words[l] = num_bits;
+		bm->level[l] = calloc(num_bits, sizeof(uint64_t));
+		assert(bm->level[l]);
+		l++;
+	} while (num_bits > 1);
+	bm->num_levels = l;
 }
 
-static void submit_entire_list(struct itchygen_info *itchygen,
-			       struct ulist_head *uhead)
+static void time_bitmap_cleanup(struct time_bitmap *bm)
 {
-	struct order_event *event, *next;
+	unsigned int l;
 
-	ulist_for_each_safe(uhead, event, next, time_node) {
-		ulist_del_from(uhead, &event->time_node);
-		if (unlikely(itchygen->debug_mode))
-			printf("timelist: delete %u.%09u\n",
-			       event->t_sec, event->t_nsec);
-		order_event_submit(itchygen, event);
+	for (l = 0; l < bm->num_levels; l++)
+		free(bm->level[l]);
+}
+
+static inline void time_bitmap_set(struct time_bitmap *bm, unsigned int bit)
+{
+	unsigned int l;
+	uint64_t was;
+
+	for (l = 0; l < bm->num_levels; l++, bit >>= 6) {
+		was = bm->level[l][bit >> 6];
+		bm->level[l][bit >> 6] = was | (1ULL << (bit & 63));
+		if (was)
+			break;	/* upper levels already mark this word */
 	}
-	usync_queue_push_accum(&itchygen->ev_queue);
 }
 
-static void submit_list_up_to_event(struct itchygen_info *itchygen,
-				    struct ulist_head *uhead,
-				    struct order_event *add_event)
+static inline void time_bitmap_clear(struct time_bitmap *bm, unsigned int bit)
 {
-	struct order_event *event, *next;
+	unsigned int l;
 
-	ulist_for_each_safe(uhead, event, next, time_node) {
-		if (event->unit_time > add_event->unit_time)
+	for (l = 0; l < bm->num_levels; l++, bit >>= 6) {
+		bm->level[l][bit >> 6] &= ~(1ULL << (bit & 63));
+		if (bm->level[l][bit >> 6])
 			break;
+	}
+}
 
-		ulist_del_from(uhead, &event->time_node);
-		if (unlikely(itchygen->debug_mode))
-			printf("timelist: delete %u.%09u\n",
-			       event->t_sec, event->t_nsec);
-		order_event_submit(itchygen, event);
+/* first set bit at or after bit, TBIT_NONE if none */
+static unsigned int time_bitmap_next(struct time_bitmap *bm, unsigned int bit)
+{
+	unsigned int l = 0, word;
+	uint64_t w;
+
+	/* climb while the rest of the word is empty */
+	for (;;) {
+		word = bit >> 6;
+		if (word >= bm->num_words[l])
+			return TBIT_NONE;
+		w = bm->level[l][word] & (~0ULL << (bit & 63));
+		if (w)
+			break;
+		if (++l == bm->num_levels)
+			return TBIT_NONE;
+		bit = word + 1;
 	}
-	if (unlikely(itchygen->debug_mode))
-		printf("timelist: direct submit %u.%09u\n",
-		       add_event->t_sec, add_event->t_nsec);
-	order_event_submit(itchygen, add_event);
-	usync_queue_push_accum(&itchygen->ev_queue);
+	bit = (word << 6) + __builtin_ctzll(w);
+	/* and descend along the lowest set bits */
+	while (l-- > 0)
+		bit = (bit << 6) + __builtin_ctzll(bm->level[l][bit]);
+	return bit;
+}
+
+static inline int time_far_before(const struct time_far *a,
+				  const struct time_far *b)
+{
+	if (a->time != b->time)
+		return a->time < b->time;
+	return (int32_t)(a->seq - b->seq) < 0;
+}
+
+static void time_far_push(struct time_list *time_list, uint64_t time,
+			  uint32_t h)
+{
+	struct time_far ent = { .time = time, .h = h,
+		.seq = time_list->far_seq++ };
+	unsigned int i, parent;
+
+	if (time_list->num_far == time_list->far_size) {
+		time_list->far_size = time_list->far_size ?
+		    2 * time_list->far_size : 1024;
+		time_list->far = realloc(time_list->far, time_list->far_size *
+					 sizeof(*time_list->far));
+		assert(time_list->far);
+	}
+	for (i = time_list->num_far++; i > 0; i = parent) {
+		parent = (i - 1) / 2;
+		if (!time_far_before(&ent, &time_list->far[parent]))
+			break;
+		time_list->far[i] = time_list->far[parent];
+	}
+	time_list->far[i] = ent;
+
+	time_list->far_events++;
+	if (time_list->num_far > time_list->max_far)
+		time_list->max_far = time_list->num_far;
+}
+
+static uint32_t time_far_pop(struct time_list *time_list)
+{
+	struct time_far *far = time_list->far, last;
+	unsigned int i = 0, child, num;
+	uint32_t h = far[0].h;
+
+	num = --time_list->num_far;
+	last = far[num];
+	for (;;) {
+		child = 2 * i + 1;
+		if (child >= num)
+			break;
+		if (child + 1 < num && time_far_before(&far[child + 1],
+						       &far[child]))
+			child++;
+		if (!time_far_before(&far[child], &last))
+			break;
+		far[i] = far[child];
+		i = child;
+	}
+	far[i] = last;
+	return h;
 }
 
-static void time_list_submit(struct itchygen_info *itchygen,
-			     struct order_event *add_event)
+/* unit of the earliest parked event, TUNIT_NONE if there are none */
+static inline unsigned long long time_far_first(struct time_list *time_list)
+{
+	if (!time_list->num_far)
+		return TUNIT_NONE;
+	return time_unit_id(time_list, time_list->far[0].time);
+}
+
+static void time_list_init(struct itchygen_info *itchygen)
 {
 	struct time_list *time_list = &itchygen->time_list;
-	unsigned int unit_id;
-	struct ulist_head *uhead;
-
-	if (add_event && add_event->unit_id > time_list->last_unit)
-		time_list->last_unit = add_event->unit_id;
-
-	for (unit_id = time_list->first_unit;
-	     unit_id <= time_list->last_unit; unit_id++) {
-		uhead = &time_list->head[unit_id];
-
-		if (!add_event || unit_id != add_event->unit_id)
-			submit_entire_list(itchygen, uhead);
-		else {
-			submit_list_up_to_event(itchygen, uhead, add_event);
-			time_list->first_unit = unit_id;
-			if (unit_id > time_list->last_unit)
-				time_list->last_unit = unit_id;
-			return;
+	size_t sz;
+
+	memset(time_list, 0, sizeof(*time_list));
+	time_list->shift = time_unit_shift(itchygen, &time_list->expect_events);
+	time_list->ring_units = time_unit_ring(itchygen, time_list->shift,
+					       time_list->expect_events);
+	time_list->drain_unit = TUNIT_NONE;
+
+	sz = sizeof(*time_list->head) * time_list->ring_units;
+	time_list->head = malloc(sz);
+	time_list->tail = malloc(sz);
+	assert(time_list->head && time_list->tail);
+
+	memset(time_list->head, 0xff, sz);	/* EVENT_HANDLE_NONE */
+	memset(time_list->tail, 0xff, sz);
+	time_bitmap_init(&time_list->busy, time_list->ring_units);
+}
+
+static void time_list_cleanup(struct itchygen_info *itchygen)
+{
+	free(itchygen->time_list.head);
+	free(itchygen->time_list.tail);
+	free(itchygen->time_list.far);
+	time_bitmap_cleanup(&itchygen->time_list.busy);
+}
+
+/* first busy unit at or after unit_id within the ring, TUNIT_NONE if none;
+ * the slots wrap around from first_unit's */
+static unsigned long long time_list_next_busy(struct time_list *time_list,
+					       unsigned long long unit_id)
+{
+	unsigned int first_slot = time_unit_slot(time_list,
+						 time_list->first_unit);
+	unsigned int slot, s;
+
+	if (unit_id - time_list->first_unit >= time_list->ring_units)
+		return TUNIT_NONE;
+	slot = time_unit_slot(time_list, unit_id);
+	s = time_bitmap_next(&time_list->busy, slot);
+	if (slot >= first_slot) {
+		/* up to the end of the ring, then from its start */
+		if (s == TBIT_NONE) {
+			s = time_bitmap_next(&time_list->busy, 0);
+			if (s >= first_slot)
+				return TUNIT_NONE;
+		}
+	} else if (s >= first_slot) {
+		return TUNIT_NONE;
+	}
+	return unit_id + time_unit_slot(time_list, s - slot);
+}
+
+/* occupancy stats; a unit may be drained in several steps, but the units
+ * are drained in time order */
+static void time_list_account_flush(struct time_list *time_list)
+{
+	unsigned int n = time_list->drain_events, b;
+
+	if (!n)
+		return;
+	b = 31 - __builtin_clz(n);
+	if (b >= TUNIT_HIST_BUCKETS)
+		b = TUNIT_HIST_BUCKETS - 1;
+	time_list->occupancy[b]++;
+	time_list->busy_units++;
+	time_list->listed_events += n;
+	if (n > time_list->max_events)
+		time_list->max_events = n;
+	time_list->drain_events = 0;
+}
+
+static inline void time_list_account(struct time_list *time_list,
+				     unsigned long long unit_id, unsigned int n)
+{
+	if (unit_id != time_list->drain_unit) {
+		time_list_account_flush(time_list);
+		time_list->drain_unit = unit_id;
+	}
+	time_list->drain_events += n;
+}
+
+static void submit_entire_list(struct itchygen_info *itchygen,
+			       unsigned long long unit_id)
+{
+	struct time_list *time_list = &itchygen->time_list;
+	struct event_pool *pool = &itchygen->ev_pool;
+	unsigned int slot = time_unit_slot(time_list, unit_id);
+	struct order_event *event;
+	unsigned int n = 0;
+	uint32_t h, next;
+
+	for (h = time_list->head[slot]; h != EVENT_HANDLE_NONE; h = next) {
+		next = ev_sched(pool, h)->next;
+		if (unlikely(itchygen->debug_mode)) {
+			event = ev_ptr(pool, h);
+			printf("timelist: delete %u.%09u\n",
+			       order_event_sec(event), order_event_nsec(event));
 		}
+		order_event_submit(itchygen, h);
+		n++;
 	}
-	time_list->first_unit = time_list->last_unit;
+	time_list_account(time_list, unit_id, n);
+	time_list->head[slot] = EVENT_HANDLE_NONE;
+	time_list->tail[slot] = EVENT_HANDLE_NONE;
+	time_bitmap_clear(&time_list->busy, slot);
 }
 
-static void time_list_insert(struct itchygen_info *itchygen,
-			     struct order_event *add_event)
+static void submit_list_up_to_event(struct itchygen_info *itchygen,
+				    unsigned long long unit_id, uint32_t add_h)
 {
 	struct time_list *time_list = &itchygen->time_list;
-	struct ulist_head *uhead = &time_list->head[add_event->unit_id];
-	struct order_event *event, *next;
+	struct event_pool *pool = &itchygen->ev_pool;
+	unsigned int slot = time_unit_slot(time_list, unit_id);
+	uint32_t unit_time = ev_sched(pool, add_h)->unit_time;
+	struct order_event *event;
+	unsigned int n = 0;
+	uint32_t h, next;
 
-	if (add_event->unit_id < time_list->first_unit)
-		time_list->first_unit = add_event->unit_id;
-	if (add_event->unit_id > time_list->last_unit)
-		time_list->last_unit = add_event->unit_id;
+	for (h = time_list->head[slot]; h != EVENT_HANDLE_NONE; h = next) {
+		if (ev_sched(pool, h)->unit_time > unit_time)
+			break;
 
-	event = ulist_top(uhead, struct order_event, time_node);
-	if (!event || add_event->unit_time < event->unit_time) {
+		next = ev_sched(pool, h)->next;
+		if (unlikely(itchygen->debug_mode)) {
+			event = ev_ptr(pool, h);
+			printf("timelist: delete %u.%09u\n",
+			       order_event_sec(event), order_event_nsec(event));
+		}
+		order_event_submit(itchygen, h);
+		n++;
+	}
+	time_list_account(time_list, unit_id, n);
+	time_list->head[slot] = h;
+	if (h == EVENT_HANDLE_NONE) {
+		time_list->tail[slot] = EVENT_HANDLE_NONE;
+		time_bitmap_clear(&time_list->busy, slot);
+	}
+
+	if (unlikely(itchygen->debug_mode)) {
+		event = ev_ptr(pool, add_h);
+		printf("timelist: direct submit %u.%09u\n",
+		       order_event_sec(event), order_event_nsec(event));
+	}
+	order_event_submit(itchygen, add_h);
+}
+
+/* links the event into its unit's list, the unit must be in the ring */
+static void time_list_link(struct itchygen_info *itchygen, uint32_t add_h)
+{
+	struct time_list *time_list = &itchygen->time_list;
+	struct event_pool *pool = &itchygen->ev_pool;
+	struct order_event *add_event = ev_ptr(pool, add_h);
+	struct event_sched *add = ev_sched(pool, add_h), *cur;
+	unsigned int slot = time_unit_slot(time_list,
+					   time_unit_id(time_list,
+							add_event->time));
+	struct order_event *event, *next_event;
+	uint32_t h, next;
+
+	add->unit_time = time_unit_time(time_list, add_event->time);
+
+	h = time_list->head[slot];
+	if (h == EVENT_HANDLE_NONE ||
+	    add->unit_time < ev_sched(pool, h)->unit_time) {
 		/* list empty or less than first - add as head */
-		ulist_add(uhead, &add_event->time_node);
+		add->next = h;
+		time_list->head[slot] = add_h;
+		if (h == EVENT_HANDLE_NONE)
+			time_list->tail[slot] = add_h;
+		time_bitmap_set(&time_list->busy, slot);
 		if (unlikely(itchygen->debug_mode))
 			printf("timelist: add head %u.%09u\n",
-			       add_event->t_sec, add_event->t_nsec);
+			       order_event_sec(add_event),
+			       order_event_nsec(add_event));
 		return;
 	}
-	event = ulist_tail(uhead, struct order_event, time_node);
-	if (add_event->unit_time >= event->unit_time) {
+	cur = ev_sched(pool, time_list->tail[slot]);
+	if (add->unit_time >= cur->unit_time) {
 		/* greater than last - add as tail */
-		ulist_add_tail(uhead, &add_event->time_node);
+		add->next = EVENT_HANDLE_NONE;
+		cur->next = add_h;
+		time_list->tail[slot] = add_h;
 		if (unlikely(itchygen->debug_mode))
 			printf("timelist: add tail %u.%09u\n",
-			       add_event->t_sec, add_event->t_nsec);
+			       order_event_sec(add_event),
+			       order_event_nsec(add_event));
 		return;
 	}
 
-	ulist_for_each_safe(uhead, event, next, time_node) {
-		if (add_event->unit_time < next->unit_time) {
+	for (; h != EVENT_HANDLE_NONE; h = next) {
+		cur = ev_sched(pool, h);
+		next = cur->next;
+		if (next == EVENT_HANDLE_NONE)
+			break;
+		if (add->unit_time < ev_sched(pool, next)->unit_time) {
 			/* place found - add after the current node */
-			ulist_insert(uhead, &add_event->time_node,
-				     &event->time_node);
-			if (unlikely(itchygen->debug_mode))
+			add->next = next;
+			cur->next = add_h;
+			if (unlikely(itchygen->debug_mode)) {
+				event = ev_ptr(pool, h);
+				next_event = ev_ptr(pool, next);
 				printf
 				    ("timelist: insert %u.%09u between %u.%09u - %u.%09u\n",
-				     add_event->t_sec, add_event->t_nsec,
-				     event->t_sec, event->t_nsec,
-				     next->t_sec, next->t_nsec);
+				     order_event_sec(add_event),
+				     order_event_nsec(add_event),
+				     order_event_sec(event),
+				     order_event_nsec(event),
+				     order_event_sec(next_event),
+				     order_event_nsec(next_event));
+			}
 			return;
 		}
 	}
@@ -528,149 +1358,199 @@ static void time_list_insert(struct itchygen_info *itchygen,
 	assert(0);
 }
 
-static double time_list_last(struct itchygen_info *itchygen)
+/* moves the ring up to start at unit_id, which must not skip busy units,
+ * and brings in the parked events it now covers */
+static void time_list_advance(struct itchygen_info *itchygen,
+			      unsigned long long unit_id)
 {
 	struct time_list *time_list = &itchygen->time_list;
-	struct ulist_head *uhead = &time_list->head[time_list->last_unit];
-	struct order_event *event;
 
-	event = ulist_tail(uhead, struct order_event, time_node);
-	return event ? event->time : -1.0;
+	time_list->first_unit = unit_id;
+	while (time_far_first(time_list) - unit_id < time_list->ring_units)
+		time_list_link(itchygen, time_far_pop(time_list));
+}
+
+/* submits all events scheduled up to add_h, then add_h itself;
+ * the entire list when add_h is EVENT_HANDLE_NONE. Only busy units are
+ * visited, and nothing is pushed to the writer if nothing was due. */
+static void time_list_submit(struct itchygen_info *itchygen, uint32_t add_h)
+{
+	struct time_list *time_list = &itchygen->time_list;
+	unsigned long long unit_id, end_unit = TUNIT_NONE;
+	uint64_t add_time;
+
+	if (add_h != EVENT_HANDLE_NONE) {
+		add_time = ev_ptr(&itchygen->ev_pool, add_h)->time;
+		end_unit = time_unit_id(time_list, add_time);
+		ev_sched(&itchygen->ev_pool, add_h)->unit_time =
+		    time_unit_time(time_list, add_time);
+	}
+
+	for (;;) {
+		for (unit_id = time_list_next_busy(time_list,
+						   time_list->first_unit);
+		     unit_id < end_unit;
+		     unit_id = time_list_next_busy(time_list, unit_id + 1))
+			submit_entire_list(itchygen, unit_id);
+		/* past the ring: the ring is empty up to end_unit */
+		unit_id = time_far_first(time_list);
+		if (unit_id >= end_unit)
+			break;
+		time_list_advance(itchygen, unit_id);
+	}
+
+	if (add_h != EVENT_HANDLE_NONE) {
+		time_list_advance(itchygen, end_unit);
+		submit_list_up_to_event(itchygen, end_unit, add_h);
+	} else {
+		time_list_account_flush(time_list);
+	}
+	event_batch_push(itchygen);
 }
 
-static inline void set_event_time(struct order_event *event, double dt)
+static void time_list_insert(struct itchygen_info *itchygen, uint32_t add_h)
 {
-	event->time = dt;
-	event->t_sec = dtime_to_sec(dt);
-	event->t_nsec = dtime_to_nsec(dt);
-	event->unit_id = (event->t_sec << TUNIT_SEC_SHIFT) |
-	    (event->t_nsec >> TUNIT_NSEC_SHIFT);
-	event->unit_time = (event->t_nsec & TUNIT_NSEC_MASK);
+	struct time_list *time_list = &itchygen->time_list;
+	struct order_event *add_event = ev_ptr(&itchygen->ev_pool, add_h);
+	unsigned long long unit_id = time_unit_id(time_list, add_event->time);
+
+	assert(unit_id >= time_list->first_unit);
+	if (add_event->time > time_list->last_time)
+		time_list->last_time = add_event->time;
+
+	if (unit_id - time_list->first_unit < time_list->ring_units) {
+		time_list_link(itchygen, add_h);
+		return;
+	}
+	time_far_push(time_list, add_event->time, add_h);
+	if (unlikely(itchygen->debug_mode))
+		printf("timelist: park %u.%09u\n",
+		       order_event_sec(add_event), order_event_nsec(add_event));
 }
 
-static struct order_event *generate_new_order(struct itchygen_info *itchygen,
-					      double order_time)
+/* returns the add event, *order_h gets the order record;
+ * the parameters are those of order i in the batch */
+static uint32_t generate_new_order(struct itchygen_info *itchygen,
+				   uint64_t order_time, unsigned int i,
+				   uint32_t *order_h)
 {
-	struct order_event *order;
-	struct symbols_file *sym_file;
-	int symbol_index;
+	struct order_batch *ob = &itchygen->order_batch;
+	struct order_event *event;
+	struct order_rec *order;
+	uint32_t h;
 
-	order = malloc(sizeof(*order));
-	if (unlikely(!order))
-		return NULL;
+	h = event_alloc(itchygen, &event);
+	*order_h = order_rec_alloc(itchygen, &order);
+	order_rec_get(order);
 
-	order->type = ORDER_ADD;
-	order->prev_event = NULL;
+	event->type = ORDER_ADD;
+	event->last = 0;
+	event->order = *order_h;
 
-	if (itchygen->list_sym.fname &&
-	    rand_index(itchygen->subscribed_prob_int, 2) == 0) {
-		sym_file = &itchygen->list_sym;
-		itchygen->stat.subscr_orders ++;
-		order->subscribed = 1;
-	} else {
-		sym_file = &itchygen->all_sym;
-		order->subscribed = 0;
-	}
-	symbol_index = rand_int_range(0, sym_file->num_symbols - 1);
-	order->symbol = &sym_file->symbol[symbol_index];
+	order->subscribed = !ob->subscr[i];
+	if (order->subscribed)
+		itchygen->stat.subscr_orders++;
+	order->locate = ob->locate[i];
 
-	set_event_time(order, order_time);
-	assert(order->unit_id < itchygen->time_list.time_units);
+	event->time = order_time;
 	order->ref_num = generate_ref_num(itchygen);
-	order->add.buy = rand_int_range(0, 1);
-	order->add.shares = 10 * rand_int_range(1, 250);
-	order->add.price = rand_int_range(order->symbol->min_price,
-					  order->symbol->max_price);
+	event->add.buy = ob->buy[i];
+	event->shares = 10 * ob->shares[i];
+	event->price = ob->price[i];
 
-	order->remain_shares = order->add.shares;
-	order->cur_price = order->add.price;
+	order->remain_shares = event->shares;
+	order->price = event->price;
 
 	itchygen->stat.orders++;
-	return order;
+	return h;
 }
 
-static struct order_event *generate_modify_event(struct itchygen_info *itchygen,
-						 struct order_event *order,	/* original order */
-						 struct order_event
-						 *prev_event)
+/* *order_h is the order record, replaced by the new one on a replace;
+ * *time is the order's time on entry and the new event's on return */
+static uint32_t generate_modify_event(struct itchygen_info *itchygen,
+				      uint32_t *order_h, uint64_t *time)
 {
+	struct event_pool *pool = &itchygen->ev_pool;
+	struct order_rec *order = ord_ptr(pool, *order_h), *new_order;
 	struct order_event *event;
+	uint32_t h, new_h;
 
-	event = malloc(sizeof(*event));
-	if (unlikely(!event))
-		return NULL;
+	h = event_alloc(itchygen, &event);
+	order_rec_get(order);
 
 	event->type = rand_index(itchygen->order_type_prob_int,
 				 MODIFY_ORDER_NUM_TYPES);
-	event->prev_event = prev_event;
-	event->symbol = order->symbol;
-	set_event_time(event, order->time + gen_time_to_update(itchygen));
-	assert(event->unit_id < itchygen->time_list.time_units);
-	event->ref_num = order->ref_num;
+	event->last = 0;
+	event->order = *order_h;
+	*time += gen_time_to_update(itchygen);
+	event->time = *time;
 	switch (event->type) {
 	case ORDER_EXEC:
-		event->exec.order = order;
-		event->exec.shares = order->remain_shares;	/* ToDo: random partial shares */
-		event->exec.price = order->cur_price - rand_int_range(0, 9);
+		event->shares = order->remain_shares;	/* ToDo: random partial shares */
+		event->price = order->price - rand_int_range(0, 9);
 		event->exec.match_num = ++itchygen->cur_match_num;
 
-		event->remain_shares =
-		    order->remain_shares - event->exec.shares;
+		order->remain_shares -= event->shares;
+		event->last = !order->remain_shares;
 
 		itchygen->stat.execs++;
 		if (order->subscribed)
 			itchygen->stat.subscr_execs++;
 		break;
 	case ORDER_CANCEL:
-		event->cancel.order = order;
-		event->cancel.shares = order->remain_shares;	/* ToDo: random partial shares */
+		event->shares = order->remain_shares;	/* ToDo: random partial shares */
 
-		event->remain_shares =
-		    order->remain_shares - event->cancel.shares;
+		order->remain_shares -= event->shares;
+		event->last = !order->remain_shares;
 
 		itchygen->stat.cancels++;
 		if (order->subscribed)
 			itchygen->stat.subscr_cancels++;
 		break;
 	case ORDER_REPLACE:
-		event->replace.order = order;
-		event->replace.shares = 10 * rand_int_range(1, 250);
-		event->replace.price =
-		    rand_int_range(order->symbol->min_price,
-				   order->symbol->max_price);
-		event->replace.orig_ref_num = order->ref_num;
-		event->ref_num = generate_ref_num(itchygen);
-
-		event->remain_shares = event->replace.shares;
-		event->cur_price = event->replace.price;
+		event->shares = 10 * rand_int_range(1, 250);
+		event->price =
+		    rand_int_range(itchygen->symbols.min_price[order->locate],
+				   itchygen->symbols.max_price[order->locate]);
+
+		new_h = order_rec_alloc(itchygen, &new_order);
+		new_order->ref_num = generate_ref_num(itchygen);
+		new_order->locate = order->locate;
+		new_order->subscribed = order->subscribed;
+		new_order->remain_shares = event->shares;
+		new_order->price = event->price;
+		event->replace.new_ref_num = new_order->ref_num;
 
 		itchygen->stat.replaces++;
 		if (order->subscribed)
 			itchygen->stat.subscr_replaces++;
+
+		order_rec_put(itchygen, *order_h);
+		*order_h = new_h;
 		break;
 	default:
 		assert(event->type < MODIFY_ORDER_NUM_TYPES);
 		break;
 	}
-	return event;
+	return h;
 }
 
 static void generate_single_timestamp(struct itchygen_info *itchygen,
 				      unsigned int time_sec)
 {
 	struct order_event *event;
+	uint32_t h;
 
-	event = malloc(sizeof(*event));
-	assert(event);
+	h = event_alloc(itchygen, &event);
 
 	memset(event, 0, sizeof(*event));
 	event->type = ORDER_TIMESTAMP;
-	set_event_time(event, (double)time_sec);
-	event->remain_shares = 1; /* fake value to suppress dhash del */
+	event->order = EVENT_HANDLE_NONE;
+	event->time = time_sec * NSEC_PER_SEC;
 	event->timestamp.seconds = time_sec;
 
 	itchygen->stat.timestamps++;
-	time_list_insert(itchygen, event);
+	time_list_insert(itchygen, h);
 }
 
 static void generate_timestamps(struct itchygen_info *itchygen)
@@ -685,59 +1565,72 @@ static void generate_timestamps(struct itchygen_info *itchygen)
 static void *event_generator_thrd(void *arg)
 {
 	struct itchygen_info *itchygen = arg;
-	struct order_event *order, *event, *prev_event;
-	int n_order;
-	double time_last;
-	unsigned int time_last_sec, time_sec;
+	struct event_pool *pool = &itchygen->ev_pool;
+	struct order_batch *ob = &itchygen->order_batch;
+	struct order_event *event;
+	uint32_t order_h, event_h;
+	unsigned long n_order, left;
+	uint64_t order_time, event_time;
+	unsigned int time_last_sec, time_sec, i;
 
-	itchygen->cur_time = 0.0;
+	itchygen->cur_time = 0;
 	generate_timestamps(itchygen);
 
 	for (n_order = 0; n_order < itchygen->num_orders; n_order++) {
-		itchygen->cur_time += gen_inter_order_time(itchygen);
-
-		if (unlikely(itchygen->cur_time >= itchygen->run_time)) {
-			generate_single_timestamp(itchygen, itchygen->cur_time);
-			itchygen->run_time = itchygen->cur_time + 1;
+		if (ob->next == ob->num) {
+			left = itchygen->num_orders - n_order;
+			order_batch_fill(itchygen, left < ob->size ?
+					 (unsigned int)left : ob->size);
+		}
+		i = ob->next++;
+		itchygen->cur_time += gen_inter_order_time(itchygen, i);
+
+		if (unlikely(itchygen->cur_time >=
+			     itchygen->run_time * NSEC_PER_SEC)) {
+			time_sec = itchygen->cur_time / NSEC_PER_SEC;
+			generate_single_timestamp(itchygen, time_sec);
+			itchygen->run_time = time_sec + 1;
 		}
 
-		order = generate_new_order(itchygen, itchygen->cur_time);
-		assert(order != NULL);
+		order_time = itchygen->cur_time;
+		event_h = generate_new_order(itchygen, order_time, i, &order_h);
 		if (unlikely(itchygen->debug_mode))
-			order_event_print(order, "+++", 0);
+			order_event_print(&itchygen->symbols,
+					  ord_ptr(pool, order_h),
+					  ev_ptr(pool, event_h), "+++", NULL);
 
 		/* insert order and submit all events scheduled until now */
-		time_list_submit(itchygen, order);
+		time_list_submit(itchygen, event_h);
 
-		prev_event = order;
 		do {
-			event =
-			    generate_modify_event(itchygen, order, prev_event);
-			assert(event != NULL);
+			event_time = order_time;
+			event_h = generate_modify_event(itchygen, &order_h,
+							&event_time);
+			event = ev_ptr(pool, event_h);
 
 			if (event->type == ORDER_REPLACE)
-				order = event;
+				order_time = event_time;
 			if (unlikely(itchygen->debug_mode))
-				order_event_print(event, "+++", 0);
+				order_event_print(&itchygen->symbols,
+						  ord_ptr(pool, event->order),
+						  event, "+++", NULL);
 
-			time_list_insert(itchygen, event);
-			prev_event = event;
+			time_list_insert(itchygen, event_h);
 		}
-		while (event->remain_shares);
+		while (!event->last);
+		order_rec_put(itchygen, order_h);
 	}
 
-	time_last = time_list_last(itchygen);
-	if (time_last >= 0.0) {
-		time_last_sec = dtime_to_sec(time_last);
-		if (time_last_sec >= itchygen->run_time) {
-			for (time_sec = itchygen->run_time;
-			     time_sec <= time_last_sec; time_sec++) {
-				generate_single_timestamp(itchygen, time_sec);
-			}
+	time_last_sec = itchygen->time_list.last_time / NSEC_PER_SEC;
+	if (time_last_sec >= itchygen->run_time) {
+		for (time_sec = itchygen->run_time;
+		     time_sec <= time_last_sec; time_sec++) {
+			generate_single_timestamp(itchygen, time_sec);
 		}
 	}
+	refn_pool_drain(itchygen);
 	/* submit entire list */
-	time_list_submit(itchygen, NULL);
+	time_list_submit(itchygen, EVENT_HANDLE_NONE);
 	if (itchygen->debug_mode)
 		printf("waiting until ev list empty\n");
 	usync_queue_shutdown(&itchygen->ev_queue);
@@ -747,24 +1640,40 @@ static void *event_generator_thrd(void *arg)
 	pthread_exit(NULL);
 }
 
+/* every event is released right after it is written, the order record
+ * once its last pending event is */
 static void *pcap_writer_thrd(void *arg)
 {
 	struct itchygen_info *itchygen = arg;
-	struct ulist_head wr_ev_list = ULIST_HEAD_INIT(wr_ev_list);
-	struct order_event *event, *next;
+	struct event_pool *pool = &itchygen->ev_pool;
+	struct ulist_head wr_batch_list = ULIST_HEAD_INIT(wr_batch_list);
+	struct event_batch *batch, *next;
+	struct order_event *event;
+	unsigned long long seq_num = itchygen->first_seq_num;
+	uint32_t h;
 	int err;
 
 	while (1) {
-		err = usync_queue_pull_list(&itchygen->ev_queue, &wr_ev_list);
+		err = usync_queue_pull_list(&itchygen->ev_queue, &wr_batch_list);
 		if (unlikely(err)) {
 			assert(err == -1);
 			break;
 		}
-		ulist_for_each_safe(&wr_ev_list, event, next, time_node) {
-			ulist_del_from(&wr_ev_list, &event->time_node);
-			order_event_pcap_msg(itchygen, event);
-			if (!event->remain_shares)
-				order_event_free_back(event);
+		ulist_for_each_safe(&wr_batch_list, batch, next, node) {
+			ulist_del_from(&wr_batch_list, &batch->node);
+			for (h = batch->first; h != EVENT_HANDLE_NONE;
+			     h = ev_sched(pool, h)->next) {
+				event = ev_ptr(pool, h);
+				order_event_pcap_msg(itchygen,
+						     event_order(pool, event),
+						     event, seq_num++);
+				if (event->order != EVENT_HANDLE_NONE)
+					order_rec_put_batch(pool, batch,
+							    event->order);
+			}
+			__atomic_sub_fetch(&pool->num_live, batch->num,
+					   __ATOMIC_RELAXED);
+			usync_queue_push_node(&pool->done_queue, &batch->node);
 		}
 	}
 	if (itchygen->debug_mode)
@@ -772,28 +1681,63 @@ static void *pcap_writer_thrd(void *arg)
 	pthread_exit(NULL);
 }
 
-static int str_to_mac(char *str, uint8_t * mac)
+static void print_time_list_stats(struct time_list *time_list)
 {
-	int i, err;
-	char ch = 0;
-
-	if (strlen(str) != 17)
-		return EINVAL;
-
-	for (i = 0; i < 6; i++) {
-		if (i < 5) {
-			ch = str[3 * i + 2];
-			if (ch != ':' && ch != '-' && ch != '.')
-				return EINVAL;
-			str[3 * i + 2] = 0;
-		}
-		err = str_to_int_range(&str[3 * i], mac[i], 0, 255, 16);
-		if (i < 5)
-			str[3 * i + 2] = ch;
-		if (err)
-			return err;
+	unsigned int b;
+
+	printf("\tunit: 2^%u nsec (%.3f ms), expected events/unit: %.1f\n",
+	       time_list->shift, (double)(1ULL << time_list->shift) / 1.0e6,
+	       time_list->expect_events);
+	printf("\tring: %u units (%.3f sec), parked events: %llu, max: %u\n",
+	       time_list->ring_units,
+	       (double)((uint64_t)time_list->ring_units << time_list->shift) /
+	       NSEC_PER_SEC, time_list->far_events, time_list->max_far);
+	printf("\tbusy units: %llu, listed events: %llu, avg: %.1f, max: %u\n",
+	       time_list->busy_units, time_list->listed_events,
+	       time_list->busy_units ?
+	       (double)time_list->listed_events / time_list->busy_units : 0.0,
+	       time_list->max_events);
+	printf("\tevents/unit ");
+	for (b = 0; b < TUNIT_HIST_BUCKETS; b++) {
+		if (!time_list->occupancy[b])
+			continue;
+		if (!b)
+			printf("1:%llu ", time_list->occupancy[b]);
+		else if (b < TUNIT_HIST_BUCKETS - 1)
+			printf("%u-%u:%llu ", 1U << b, (2U << b) - 1,
+			       time_list->occupancy[b]);
+		else
+			printf("%u+:%llu ", 1U << b, time_list->occupancy[b]);
 	}
-	return 0;
+	printf("\n\n");
+}
+
+static void print_mem_stats(struct itchygen_info *itchygen)
+{
+	struct event_pool *pool = &itchygen->ev_pool;
+	size_t ev_size = sizeof(struct event_sched) + sizeof(struct order_event);
+	size_t ord_size = sizeof(struct order_rec);
+
+	printf("\tevents: %zu bytes each (sched: %zu, payload: %zu), "
+	       "max live: %lu (%.1f MB)\n",
+	       ev_size, sizeof(struct event_sched), sizeof(struct order_event),
+	       pool->max_live, (double)(pool->max_live * ev_size) / (1 << 20));
+	printf("\torders: %zu bytes each, max live: %lu (%.1f MB)\n",
+	       ord_size, pool->max_orders_live,
+	       (double)(pool->max_orders_live * ord_size) / (1 << 20));
+	printf("\tpools: %u event chunks (%.1f MB), %u order chunks (%.1f MB), "
+	       "batches: %u\n",
+	       pool->num_chunks,
+	       (double)pool->num_chunks * sizeof(struct event_chunk) / (1 << 20),
+	       pool->num_ord_chunks,
+	       (double)pool->num_ord_chunks * sizeof(struct order_chunk) /
+	       (1 << 20), pool->num_batches);
+	printf("\ttime list: %u units (%.1f MB), max parked: %u (%.1f MB)\n\n",
+	       itchygen->time_list.ring_units,
+	       (double)itchygen->time_list.ring_units * 2 * sizeof(uint32_t) /
+	       (1 << 20), itchygen->time_list.max_far,
+	       (double)itchygen->time_list.max_far * sizeof(struct time_far) /
+	       (1 << 20));
 }
 
 void usage(int status, char *msg)
@@ -811,7 +1755,8 @@ void usage(int status, char *msg)
 	       "-n, --orders-num    total orders [n]umber, [kKmM] supported)\n"
 	       "* * * missing -t/-r/-n inferred by: t * r = n\n\n"
 	       "-L, --list-file     file with list of subscription symbols\n"
-	       "-l, --list-ratio    ratio of subscribed symbols\n\n"
+	       "-l, --list-ratio    ratio of subscribed symbols\n"
+	       "    --cache-dir     keep parsed symbol files cached in this dir\n\n"
 	       "-u, --time2update   mean time to order's [u]pdate (msec)\n"
 	       "    --min-time2upd  minimal time to update, default: %d msec\n"
 	       "-E, --prob-exec     probability of execution (0%%-100%%)\n"
@@ -829,13 +1774,15 @@ void usage(int status, char *msg)
 	       "-Q, --seq           sequential ref.nums, default: random\n"
 	       "    --first-ref     first ref.num, only in sequential mode\n"
 	       "    --first-seq     first seq.num\n"
+	       "    --gen-batch     new orders drawn at a time, default: %d\n"
 	       "-S, --rand-seed     set the seed before starting work\n"
 	       "    --no-hash-del   refnums not deleted from hash on expiration\n"
 	       "-d, --debug         produce debug information\n"
 	       "-v, --verbose       produce verbose output\n"
 	       "-V, --version       print version and exit\n"
 	       "-h, --help          display this help and exit\n",
-	       ITCHYGEN_VER_STR, program_name, DEFAULT_MIN_TIME2UPD);
+	       ITCHYGEN_VER_STR, program_name, DEFAULT_MIN_TIME2UPD,
+	       DEFAULT_GEN_BATCH);
 	exit(0);
 }
 
@@ -862,6 +1809,8 @@ static struct option const long_options[] = {
 	{"no-hash-del", no_argument, 0, '0'}, /* short arg hidden */
 	{"first-ref", required_argument, 0, '1'}, /* short arg hidden */
 	{"first-seq", required_argument, 0, '2'}, /* short arg hidden */
+	{"gen-batch", required_argument, 0, '3'}, /* short arg hidden */
+	{"cache-dir", required_argument, 0, '4'}, /* short arg hidden */
 	{"seq", no_argument, 0, 'Q'},
 	{"debug", no_argument, 0, 'd'},
 	{"verbose", no_argument, 0, 'v'},
@@ -870,12 +1819,14 @@ static struct option const long_options[] = {
 	{0, 0, 0, 0},
 };
 
-static char *short_options = "s:t:r:n:L:l:u:E:C:R:S:m:M:p:i:P:I:f:1:2:Q0dvVh";
+static char *short_options = "s:t:r:n:L:l:u:E:C:R:S:m:M:p:i:P:I:f:1:2:3:4:Q0dvVh";
 
 int main(int argc, char **argv)
 {
 	struct itchygen_info itchygen;
-	int ch, longindex, err;
+	int ch, longindex = 0, err;
+	struct symbols_file *sym_files[2];
+	int num_sym_files = 0;
 	const char *optname;
 	unsigned int run_time = 0;
 	unsigned long orders_rate = 0;
@@ -899,6 +1850,7 @@ int main(int argc, char **argv)
 	memset(&itchygen, 0, sizeof(itchygen));
 	itchygen.num_poly = get_default_poly(itchygen.poly, MAX_POLY);
 	itchygen.time2update_min = DEFAULT_MIN_TIME2UPD;
+	itchygen.gen_batch = DEFAULT_GEN_BATCH;
 
 	opterr = 0;		/* global getopt variable */
 	for (;;) {
@@ -1066,6 +2018,16 @@ int main(int argc, char **argv)
 			if (err)
 				usage(bad_optarg(err, optname, optarg), NULL);
 			break;
+		case '3':
+			err = str_to_int_range(optarg, itchygen.gen_batch, 1,
+					       MAX_GEN_BATCH, 10);
+			if (err)
+				usage(bad_optarg(err, optname, optarg), NULL);
+			break;
+		case '4':
+			itchygen.all_sym.cache_dir = optarg;
+			itchygen.list_sym.cache_dir = optarg;
+			break;
 		case '0':
 			itchygen.no_hash_del = 1;
 			break;
@@ -1183,7 +2145,11 @@ int main(int argc, char **argv)
 		itchygen.cur_ref_num = itchygen.first_ref_num;
 	}
 
-	itchygen.time2update_min_f = 0.001 * (double)itchygen.time2update_min;
+	itchygen.time2update_min_ns =
+	    (uint64_t)itchygen.time2update_min * (NSEC_PER_SEC / 1000);
+	if (itchygen.time2update > itchygen.time2update_min)
+		itchygen.time2update_exp_mean = 0.001 *
+		    (double)(itchygen.time2update - itchygen.time2update_min);
 
 	rand_util_init(use_seed, &itchygen.rand_seed);
 
@@ -1216,6 +2182,7 @@ int main(int argc, char **argv)
 	rand_interval_init(itchygen.order_type_prob_int,
 			   MODIFY_ORDER_NUM_TYPES);
 
+	event_pool_init(&itchygen.ev_pool);
 	time_list_init(&itchygen);
 	usync_queue_init(&itchygen.ev_queue);
 
@@ -1241,6 +2208,15 @@ int main(int argc, char **argv)
 		exclude_symbol_file(&itchygen.all_sym, &itchygen.list_sym, 1);
 		exclude_symbol_file(&itchygen.list_sym, &itchygen.all_sym, 1);
 	}
+	sym_files[num_sym_files++] = &itchygen.all_sym;
+	if (itchygen.list_sym.fname)
+		sym_files[num_sym_files++] = &itchygen.list_sym;
+	err = symbol_table_init(&itchygen.symbols, sym_files, num_sym_files);
+	if (err) {
+		printf("failed to build symbol table\n");
+		exit(err);
+	}
+	order_batch_init(&itchygen, itchygen.gen_batch);
 
 	err = pthread_create(&thread1, NULL, event_generator_thrd, &itchygen);
 	if (err) {
@@ -1259,7 +2235,15 @@ int main(int argc, char **argv)
 
 	printf("statistics:\n");
 	print_stats(&itchygen.stat, &itchygen.dhash);
+	printf("time list:\n");
+	print_time_list_stats(&itchygen.time_list);
+	printf("memory:\n");
+	print_mem_stats(&itchygen);
 	dhash_cleanup(&itchygen.dhash);
+	time_list_cleanup(&itchygen);
+	order_batch_cleanup(&itchygen.order_batch);
+	event_pool_cleanup(&itchygen.ev_pool);
+	symbol_table_cleanup(&itchygen.symbols);
 
 	if (itchygen.out_fname)
 		free(itchygen.out_fname);
@@ -7,8 +7,12 @@
 #ifndef __ITCHYGEN_H_
 #define	__ITCHYGEN_H_
 
+#include <string.h>
+#include <endian.h>
+
 #include "ulist.h"
 #include "double_hash.h"
+#include "phash.h"
 
 #ifdef	__cplusplus
 extern "C" {
@@ -27,7 +31,7 @@ void usage(int status, char *msg);
  */
 
 struct trade_symbol {
-	char name[ITCH_SYMBOL_LEN];
+	char name[ITCH_SYMBOL_LEN + 1];	/* nul-terminated */
 	unsigned int min_price;
 	unsigned int max_price;
 	int auto_gen;
@@ -58,58 +62,85 @@ struct itchygen_stat {
 	unsigned int bucket_overflows;
 };
 
+/*
+ * Per-order state, one record per ref.num (a replace starts a new one).
+ * Events of the order refer to it by a 32-bit handle and hold a reference
+ * each, so an event can be released as soon as it is written, while the
+ * record lives as long as any of its events is pending.
+ */
+
+#define EVENT_HANDLE_NONE	0xffffffffu
+
+struct order_rec {
+	uint32_t ref_num;
+	union {
+		uint32_t refcnt;	/* pending events + the generator */
+		uint32_t next;		/* free list link */
+	};
+	uint32_t remain_shares;	/* generator side state */
+	uint32_t price;
+	uint16_t locate;	/* symbol table index */
+	uint8_t subscribed;
+};
+
+/*
+ * Event payload: what the writer needs to encode the message, besides
+ * the order record. Events live in a pool and are referred to by 32-bit
+ * handles; the scheduling links are kept apart, see struct event_sched.
+ */
+
 struct order_event {
-	struct ulist_node time_node;
-	enum order_event_type type;
-	struct order_event *prev_event;
-	struct trade_symbol *symbol;
-	int subscribed;
-	double time;
-	unsigned int t_sec;
-	unsigned int t_nsec;
-	unsigned int unit_id;
-	unsigned int unit_time;
-	unsigned long long seq_num;
-	unsigned long long ref_num;
-	unsigned int remain_shares;
-	unsigned int cur_price;
+	uint64_t time;		/* nsec since the start of the stream */
+	uint8_t type;		/* enum order_event_type */
+	uint8_t last;		/* the final event of the order */
+	uint32_t order;		/* record handle, none for timestamps */
+	uint32_t shares;	/* added, executed, canceled, new quantity */
+	uint32_t price;		/* added, executed at, new price */
 	union {
 		struct {
-			unsigned int shares;
-			unsigned int price;
-			int buy;	/* 1 - buy, 0 - sell */
+			uint32_t buy;	/* 1 - buy, 0 - sell */
 		} add;
 		struct {
-			struct order_event *order;
-			unsigned int shares;	/* executed */
-			unsigned int price;	/* at price */
-			unsigned long long match_num;
+			uint64_t match_num;
 		} exec;
 		struct {
-			struct order_event *order;
-			unsigned int shares;	/* canceled */
-		} cancel;
-		struct {
-			struct order_event *order;
-			unsigned int shares;	/* new quantity */
-			unsigned int price;	/* new price */
-			unsigned long long orig_ref_num;
+			uint32_t new_ref_num;
 		} replace;
 		struct {
-			unsigned int seconds;
+			uint32_t seconds;
 		} timestamp;
 	};
 };
 
+#define NSEC_PER_SEC	1000000000ULL
+
+static inline unsigned int order_event_sec(const struct order_event *event)
+{
+	return (unsigned int)(event->time / NSEC_PER_SEC);
+}
+
+static inline unsigned int order_event_nsec(const struct order_event *event)
+{
+	return (unsigned int)(event->time % NSEC_PER_SEC);
+}
+
 const char *trade_outcome_str(enum order_event_type type);
 
-void print_order_add(struct order_event *order);
-void print_order_exec(struct order_event *event);
-void print_order_cancel(struct order_event *event);
-void print_order_replace(struct order_event *event);
+struct symbol_table;
+
+void print_order_add(struct symbol_table *tbl, struct order_rec *order,
+		struct order_event *event);
+void print_order_exec(struct symbol_table *tbl, struct order_rec *order,
+		struct order_event *event);
+void print_order_cancel(struct symbol_table *tbl, struct order_rec *order,
+		struct order_event *event);
+void print_order_replace(struct symbol_table *tbl, struct order_rec *order,
+		struct order_event *event);
 void print_order_timestamp(struct order_event *event);
-void order_event_print(struct order_event *event,
-		char *prefix, int print_seq_num);
+/* order is NULL for timestamps, seq_num is printed when not NULL */
+void order_event_print(struct symbol_table *tbl, struct order_rec *order,
+		struct order_event *event, char *prefix,
+		const unsigned long long *seq_num);
 
 void print_stats(struct itchygen_stat *s, struct dhash_table *dhash);
 
@@ -131,15 +162,32 @@ void symbol_name_generate(struct trade_symbol *symbol);
 
 struct symbols_file {
 	char *fname;
-	FILE *fh;
+	const char *cache_dir;	/* of the binary cache, NULL if not kept */
+	int cached;		/* loaded from the binary cache */
 	unsigned int num_lines;
 	unsigned int num_symbols;
 	struct trade_symbol *symbol;
-	struct dhash_table dhash;
+	uint16_t *locate;	/* of each symbol, see symbol_table_init() */
+	struct phash phash;
 };
 
-uint32_t name4_to_u32(char *name);
-uint32_t symbol_name_to_u32(struct trade_symbol *symbol);
+/* all 8 bytes of a stock field as a key, trailing spaces read as nul;
+ * branch-free: pad bytes are found with the zero-byte bit trick */
+static inline uint64_t name8_to_u64(const char *name)
+{
+	const uint64_t lo7 = 0x7f7f7f7f7f7f7f7fULL;
+	uint64_t v, t_nul, t_spc, real;
+
+	memcpy(&v, name, sizeof(v));
+	v = le64toh(v);		/* name[7] in the top byte */
+	t_nul = ((v & lo7) + lo7) | v;	/* msb set for non-nul bytes */
+	t_spc = (((v ^ 0x2020202020202020ULL) & lo7) + lo7) |
+	    (v ^ 0x2020202020202020ULL);
+	real = t_nul & t_spc & ~lo7;
+	return real ? v & (~0ULL >> __builtin_clzll(real)) : 0;
+}
+
+uint64_t symbol_name_to_u64(struct trade_symbol *symbol);
 
 int read_symbol_file(struct symbols_file * sym, int print_warn);
 void init_symbol_file_hash(struct symbols_file * sym);
@@ -150,6 +198,37 @@ void exclude_symbol_file(struct symbols_file * from_sym,
 	struct symbols_file * exclude_sym,
 	int print_warn);
 
+/*
+ * Symbol table: every distinct name of the loaded files is interned
+ * into a dense 16-bit locate, per-symbol data is kept in arrays
+ * indexed by it (names are nul-terminated)
+ */
+
+#define SYMBOL_LOCATE_NONE	0xffff
+
+struct symbol_table {
+	unsigned int num_symbols;
+	struct phash phash;	/* name key -> locate */
+	char (*name)[ITCH_SYMBOL_LEN + 1];
+	unsigned int *min_price;
+	unsigned int *max_price;
+};
+
+/* fills sym[]->locate as well; names listed by several files share
+ * one locate, with the price band of the first of them */
+int symbol_table_init(struct symbol_table *tbl,
+		      struct symbols_file **sym, int num_files);
+void symbol_table_cleanup(struct symbol_table *tbl);
+
+/* locate of an 8-byte stock field, SYMBOL_LOCATE_NONE if unknown */
+static inline unsigned int symbol_locate(const struct symbol_table *tbl,
+					 const char *stock)
+{
+	int slot = phash_find(&tbl->phash, name8_to_u64(stock));
+
+	return slot < 0 ? SYMBOL_LOCATE_NONE : (unsigned int)slot;
+}
+
 #ifdef	__cplusplus
 }
 #endif
@@ -0,0 +1,387 @@
+/*
+ * File: itchymerge.c
+ * Summary: merges ITCH PCAP files, generated by itchygen stream generator,
+ *          into one by the record timestamps
+ *
+ * Copyright (c) 2014, Alexander Nezhinsky (nezhinsky@gmail.com)
+ * All rights reserved.
+ *
+ * Licensed under BSD-MIT :
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <endian.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "itch_proto.h"
+#include "itchygen.h"
+#include "pcap.h"
+#include "str_args.h"
+
+static char program_name[] = "itchymerge";
+
+struct merge_input {
+	char *fname;
+	struct pcap_reader rd;
+	struct pcap_rec rec;	/* the next one, in rd.buf */
+	int done;
+	unsigned long long recs;
+};
+
+struct itchymerge_info {
+	struct merge_input *in;
+	unsigned int num_inputs;
+	unsigned int *tree;	/* losers, tree[0] is the winner */
+	char *out_fname;
+	struct pcap_out out;
+	size_t buf_size;	/* per input */
+	int renumber;
+	uint64_t first_seq;
+	char session[10];
+	int session_set;
+	int verbose_mode;
+};
+
+void usage(int status, char *msg)
+{
+	if (msg)
+		fprintf(stderr, "%s\n", msg);
+	if (status)
+		exit(status);
+
+	printf("ITCH PCAP files merge, version %s\n\n"
+	       "Usage: %s [OPTION]\n"
+	       "-f, --file          PCAP file name, one per input file\n"
+	       "-o, --out-file      merged PCAP file name\n"
+	       "-1, --first-seq     renumber into one sequence, start with first,\n"
+	       "                    default: seq.nums kept as in each input\n"
+	       "-S, --session       with -1, MoldUDP64 session of the sequence,\n"
+	       "                    default: that of the first record\n"
+	       "-B, --buf-size      read buffer per input file in MB, default: %d\n"
+	       "-v, --verbose       produce verbose output\n"
+	       "-V, --version       print version and exit\n"
+	       "-h, --help          display this help and exit\n",
+	       ITCHYGEN_VER_STR, program_name, PCAP_READ_BUF_SIZE >> 20);
+	exit(0);
+}
+
+static struct option const long_options[] = {
+	{"file", required_argument, 0, 'f'},
+	{"out-file", required_argument, 0, 'o'},
+	{"first-seq", required_argument, 0, '1'},
+	{"session", required_argument, 0, 'S'},
+	{"buf-size", required_argument, 0, 'B'},
+	{"verbose", no_argument, 0, 'v'},
+	{"version", no_argument, 0, 'V'},
+	{"help", no_argument, 0, 'h'},
+	{0, 0, 0, 0},
+};
+
+static char *short_options = "f:o:1:S:B:vVh";
+
+/* the next record of the input, refilling its buffer when it runs out */
+static int input_next(struct merge_input *in)
+{
+	int err;
+
+	for (;;) {
+		err = pcap_reader_next(&in->rd, &in->rec);
+		if (likely(!err))
+			return 0;
+		if (err != EAGAIN)
+			break;
+		err = pcap_reader_fill(&in->rd);
+		if (err)
+			break;
+	}
+	if (err != ENOENT) {
+		errno = err;
+		printf("%s: stopped at offset %zu, %m\n", in->fname,
+		       in->rd.off + in->rd.pos);
+	}
+	in->done = 1;
+	return err;
+}
+
+/* whether input a goes out before input b: by timestamp, then by the
+ * input order; num_inputs stands for one before all, a done one is last */
+static inline int merge_before(struct itchymerge_info *merge,
+			       unsigned int a, unsigned int b)
+{
+	const struct pcap_record_hdr *ha, *hb;
+
+	if (a == merge->num_inputs)
+		return 1;
+	if (b == merge->num_inputs)
+		return 0;
+	if (merge->in[a].done != merge->in[b].done)
+		return merge->in[b].done;
+	if (merge->in[a].done)
+		return a < b;
+	ha = merge->in[a].rec.hdr;
+	hb = merge->in[b].rec.hdr;
+	if (ha->ts_sec != hb->ts_sec)
+		return ha->ts_sec < hb->ts_sec;
+	if (ha->ts_usec != hb->ts_usec)
+		return ha->ts_usec < hb->ts_usec;
+	return a < b;
+}
+
+/* input i replayed from its leaf up: the loser stays at each node, the
+ * winner goes on and ends up in tree[0] */
+static void merge_adjust(struct itchymerge_info *merge, unsigned int i)
+{
+	unsigned int t, tmp;
+
+	for (t = (i + merge->num_inputs) / 2; t > 0; t /= 2) {
+		if (merge_before(merge, merge->tree[t], i)) {
+			tmp = merge->tree[t];
+			merge->tree[t] = i;
+			i = tmp;
+		}
+	}
+	merge->tree[0] = i;
+}
+
+static int merge_tree_init(struct itchymerge_info *merge)
+{
+	unsigned int i;
+
+	merge->tree = malloc(merge->num_inputs * sizeof(*merge->tree));
+	if (!merge->tree)
+		return ENOMEM;
+	for (i = 0; i < merge->num_inputs; i++)
+		merge->tree[i] = merge->num_inputs;
+	for (i = merge->num_inputs; i-- > 0;)
+		merge_adjust(merge, i);
+	return 0;
+}
+
+/* one sequence of one session, both at even offsets of the datagram */
+static void merge_renumber(struct itchymerge_info *merge, struct pcap_rec *rec)
+{
+	struct itch_packet *pkt = rec->data;
+	uint16_t check = rec->udp->udp.check;
+	uint64_t old_seq, new_seq;
+
+	if (rec->len < sizeof(pkt->mold))
+		return;
+	if (!merge->session_set) {
+		memcpy(merge->session, pkt->mold.session, sizeof(merge->session));
+		merge->session_set = 1;
+	}
+	check = ip_checksum_adjust(check, pkt->mold.session, merge->session,
+				   sizeof(merge->session));
+	memcpy(pkt->mold.session, merge->session, sizeof(merge->session));
+	old_seq = pkt->mold.seq_num;
+	new_seq = htobe64(merge->first_seq + merge->out.recs - 1);
+	check = ip_checksum_adjust(check, &old_seq, &new_seq, sizeof(new_seq));
+	pkt->mold.seq_num = new_seq;
+	rec->udp->udp.check = check;
+}
+
+/* records are copied out, so an input buffer may be refilled any time;
+ * memory is bounded by the input buffers and the output one */
+static int merge_inputs(struct itchymerge_info *merge)
+{
+	struct merge_input *in;
+	struct pcap_rec copy;
+	unsigned int i;
+	int err;
+
+	for (i = 0; i < merge->num_inputs; i++)
+		input_next(&merge->in[i]);
+	err = merge_tree_init(merge);
+	if (err)
+		return err;
+
+	for (;;) {
+		i = merge->tree[0];
+		in = &merge->in[i];
+		if (in->done)
+			break;
+		err = pcap_out_add_copy(&merge->out, &in->rec, &copy);
+		if (unlikely(err))
+			return err;
+		if (merge->renumber)
+			merge_renumber(merge, &copy);
+		in->recs++;
+		input_next(in);
+		merge_adjust(merge, i);
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct itchymerge_info merge;
+	struct merge_input *in;
+	struct timespec t_start, t_end;
+	unsigned long long bytes = 0;
+	double elapsed;
+	unsigned int i;
+	int mbytes;
+	int ch, longindex = 0, err;
+	const char *optname;
+
+	if (argc < 2)
+		usage(0, NULL);
+
+	memset(&merge, 0, sizeof(merge));
+	merge.buf_size = PCAP_READ_BUF_SIZE;
+	merge.in = calloc(argc, sizeof(*merge.in));
+	if (!merge.in) {
+		printf("failed to alloc mem for input files\n");
+		exit(ENOMEM);
+	}
+
+	opterr = 0;		/* global getopt variable */
+	for (;;) {
+		ch = getopt_long(argc, argv, short_options,
+				 long_options, &longindex);
+		if (ch < 0)
+			break;
+
+		optname = long_options[longindex].name;
+
+		switch (ch) {
+		case 'f':
+			in = &merge.in[merge.num_inputs++];
+			in->fname = strdup(optarg);
+			if (!in->fname) {
+				printf("failed to alloc mem for pcap file name\n");
+				exit(ENOMEM);
+			}
+			break;
+		case 'o':
+			merge.out_fname = strdup(optarg);
+			if (!merge.out_fname) {
+				printf("failed to alloc mem for out file name\n");
+				exit(ENOMEM);
+			}
+			break;
+		case '1':
+			err = str_to_int_ge(optarg, merge.first_seq, 0);
+			if (err)
+				usage(bad_optarg(err, optname, optarg), NULL);
+			merge.renumber = 1;
+			break;
+		case 'S':
+			if (!*optarg || strlen(optarg) > sizeof(merge.session))
+				usage(bad_optarg(EINVAL, optname, optarg), NULL);
+			/* padded with spaces, as MoldUDP64 alphanumerics are */
+			memset(merge.session, ' ', sizeof(merge.session));
+			memcpy(merge.session, optarg, strlen(optarg));
+			merge.session_set = 1;
+			break;
+		case 'B':
+			err = str_to_int_range(optarg, mbytes, 1, 1024, 10);
+			if (err)
+				usage(bad_optarg(err, optname, optarg), NULL);
+			merge.buf_size = (size_t)mbytes << 20;
+			break;
+		case 'v':
+			merge.verbose_mode = 1;
+			break;
+		case 'V':
+			version();
+			break;
+		case 'h':
+			usage(0, NULL);
+			break;
+		default:
+			if (optind == 1)
+				optind++;
+			printf("don't understand: %s\n", argv[optind - 1]);
+			usage(EINVAL, "error: unsupported arguments");
+			break;
+		}
+	}
+	if (!merge.num_inputs)
+		usage(EINVAL, "pcap file name not supplied");
+	if (!merge.out_fname)
+		usage(EINVAL, "out pcap file name not supplied");
+	if (merge.session_set && !merge.renumber)
+		usage(EINVAL, "session set only with --first-seq");
+
+	for (i = 0; i < merge.num_inputs; i++) {
+		in = &merge.in[i];
+		err = pcap_reader_open(&in->rd, in->fname, merge.buf_size);
+		if (err) {
+			errno = err;
+			printf("failed to open pcap file %s, %m\n", in->fname);
+			return err;
+		}
+	}
+	err = pcap_out_open(&merge.out, merge.out_fname);
+	if (err) {
+		errno = err;
+		printf("failed to create out pcap file, %m\n");
+		return err;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t_start);
+	err = merge_inputs(&merge);
+	if (!err)
+		err = pcap_out_flush(&merge.out);
+	clock_gettime(CLOCK_MONOTONIC, &t_end);
+	if (err) {
+		errno = err;
+		printf("failed to write out pcap file, %m\n");
+		return err;
+	}
+	err = pcap_out_close(&merge.out);
+	if (err) {
+		errno = err;
+		printf("failed to write out pcap file, %m\n");
+		return err;
+	}
+	elapsed = (t_end.tv_sec - t_start.tv_sec) +
+		  (t_end.tv_nsec - t_start.tv_nsec) / 1e9;
+
+	printf("statistics:\n");
+	for (i = 0; i < merge.num_inputs; i++) {
+		in = &merge.in[i];
+		bytes += in->rd.off + in->rd.pos;
+		if (merge.verbose_mode || merge.num_inputs <= 16)
+			printf("\t%s: records: %llu\n", in->fname, in->recs);
+		pcap_reader_close(&in->rd);
+		free(in->fname);
+	}
+	printf("\tmerged records: %llu", merge.out.recs);
+	if (merge.renumber && merge.out.recs)
+		printf(", seq.nums: %llu - %llu",
+		       (unsigned long long)merge.first_seq,
+		       (unsigned long long)(merge.first_seq + merge.out.recs - 1));
+	printf("\n\ttime: %.3f sec, %.2f MB/sec read\n", elapsed,
+	       elapsed > 0 ? bytes / elapsed / (1 << 20) : 0.);
+
+	free(merge.tree);
+	free(merge.in);
+	free(merge.out_fname);
+	return 0;
+}
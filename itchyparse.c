@@ -41,31 +41,113 @@
 #include <endian.h>
 #include <getopt.h>
 #include <time.h>
+#include <pthread.h>
 
 #include "itch_proto.h"
 #include "itchygen.h"
 #include "pcap.h"
 #include "double_hash.h"
+#include "order_book.h"
+#include "itch_index.h"
 #include "str_args.h"
 
+/* per-order state, kept as the refn_dhash map value */
+struct order_state {
+	uint32_t shares;	/* remaining shares */
+	uint32_t price;
+	uint32_t add_sec;	/* add time */
+	uint32_t add_nsec;
+	uint16_t locate;	/* SYMBOL_LOCATE_NONE if not subscribed */
+	char buy_sell;
+};
+
+/* an exec, cancel or replace of a standing order */
+struct order_update {
+	char msg_type;
+	uint32_t refn;
+	uint32_t shares;
+	uint32_t price;		/* replace only */
+	uint32_t new_refn;	/* replace only */
+};
+
+/* what is rewritten in an edited record */
+struct rec_edit {
+	int seq_nums;
+	uint64_t seq_delta;	/* added to the seq.num */
+	const struct endpoint_addr *dst, *src;
+	int retarget;
+};
+
+/* per subscribed symbol counters, indexed by locate */
+struct symbol_stat {
+	unsigned long long orders;
+	unsigned long long execs;
+	unsigned long long cancels;
+	unsigned long long replaces;
+};
+
 struct itchyparse_info {
 	char *pcap_fname;
 	struct symbols_file subscription;
+	struct symbol_table symbols;	/* subscribed ones */
+	struct symbol_stat *symbol_stat;
 	int no_hash_del;
 	int debug_mode;
 	int verbose_mode;
+	unsigned int num_threads;
 	unsigned int num_poly;
 	uint32_t poly[MAX_POLY];
 	struct dhash_table refn_dhash;
-	struct dhash_table subscr_name_dhash;
-	struct dhash_table subscr_refn_dhash;
 	struct itchygen_stat stat;
+	unsigned int time_sec;	/* from the last timestamp msg */
 	unsigned long long unsubscr_orders;
+	unsigned long long unknown_refns;
+	unsigned long long dup_refns;	/* added again while still live */
 	unsigned long long expect_first_seq;
 	unsigned long long edit_first_seq;
 	unsigned long long edit_start_sec;
+	int edit_recs;
+	struct endpoint_addr edit_dst;	/* fields to retarget to, if set */
+	struct endpoint_addr edit_src;
+	char *out_fname;	/* edited copy, the input is kept */
+	int filter;		/* copy only the subscription feed */
+	struct itch_index *index;	/* built along the parse */
+	struct pcap_out *filter_out;
+	struct rec_edit *filter_edit;
+	int book_mode;
+	struct order_book *book;	/* per subscribed symbol */
+	unsigned long long *book_snap;	/* top changes at the last print */
+
+	/* parsing state */
+	int first;
+	unsigned long long cur_seq_num;
+	unsigned long long rec_seq_num;
+	unsigned long long first_seq_num;
+	unsigned long long seq_errors;
+	unsigned int illegal_types;
+	struct endpoint_addr first_dst_ep;
+	struct endpoint_addr first_src_ep;
+	FILE *out;		/* per record messages */
+
+	/* parsing a chunk of the file, see parse_chunks() */
+	int seq_resync;		/* take the next seq.num as the expected one */
+	long resync_out_pos;	/* output offset when it was taken */
+	int defer_unknown;	/* keep updates of unknown refns for the merge */
+	struct order_update *deferred;
+	size_t num_deferred;
+	size_t deferred_size;
 };
 
+/* order add time before the chunk's first timestamp msg */
+#define TIME_SEC_UNKNOWN	UINT32_MAX
+
+/* records walked ahead, their ref.nums looked up in one batch */
+#define PARSE_BATCH	16
+
+/* parallel parsing: threads, and the least chunk worth one */
+#define PARSE_MAX_THREADS	64
+#define PARSE_MIN_CHUNK		(1 << 20)
+
 static char program_name[] = "itchyparse";
 
 void usage(int status, char *msg)
@@ -79,10 +161,27 @@ void usage(int status, char *msg)
 	       "Usage: %s [OPTION]\n"
 	       "-f, --file          PCAP file name\n"
 	       "-L, --list-file     file with list of subscription symbols\n"
+	       "    --cache-dir     keep the parsed list file cached in this dir\n"
 	       "-x, --expect        first sequence num to expect\n"
 	       "-1, --edit-first    re-write seq. numbers, start with first\n"
 	       "-t, --edit-time     re-write time stamps, start with this\n"
+	       "-m, --dst-mac       re-write destination MAC address\n"
+	       "-M, --src-mac       re-write source MAC address\n"
+	       "-i, --dst-ip        re-write destination IP address\n"
+	       "-I, --src-ip        re-write source IP address\n"
+	       "-p, --dst-port      re-write destination UDP port\n"
+	       "-P, --src-port      re-write source UDP port\n"
+	       "-o, --out-file      write the edited records to a new file\n"
+	       "-F, --filter        with -o, write only timestamps and the msgs\n"
+	       "                    of the subscribed symbols, renumbered with -1\n"
+	       "-X, --index         write an index of the file, FILE.idx\n"
+	       "-T, --from-sec      parse from this second on, by the index\n"
+	       "-E, --to-sec        parse up to this second, included\n"
+	       "-N, --from-seq      parse from this seq.num on\n"
+	       "-y, --from-symbol   parse from the first order of this symbol\n"
 	       "-Q, --seq           sequential ref.nums, default: random\n"
+	       "-j, --threads       parse in chunks on that many threads, default: 1\n"
+	       "-b, --book          build order books of the subscribed symbols\n"
 	       "    --no-hash-del   refnums not deleted from hash on expiration\n"
 	       "-d, --debug         produce debug information\n"
 	       "-v, --verbose       produce verbose output\n"
@@ -95,10 +194,26 @@ void usage(int status, char *msg)
 static struct option const long_options[] = {
 	{"file", required_argument, 0, 'f'},
 	{"list-file", required_argument, 0, 'L'},
+	{"cache-dir", required_argument, 0, '4'},
 	{"expect", required_argument, 0, 'x'},
 	{"edit-first", required_argument, 0, '1'},
 	{"time", required_argument, 0, 't'},
+	{"dst-mac", required_argument, 0, 'm'},
+	{"src-mac", required_argument, 0, 'M'},
+	{"dst-ip", required_argument, 0, 'i'},
+	{"src-ip", required_argument, 0, 'I'},
+	{"dst-port", required_argument, 0, 'p'},
+	{"src-port", required_argument, 0, 'P'},
+	{"out-file", required_argument, 0, 'o'},
+	{"filter", no_argument, 0, 'F'},
+	{"index", no_argument, 0, 'X'},
+	{"from-sec", required_argument, 0, 'T'},
+	{"to-sec", required_argument, 0, 'E'},
+	{"from-seq", required_argument, 0, 'N'},
+	{"from-symbol", required_argument, 0, 'y'},
 	{"no-hash-del", no_argument, 0, '0'},
+	{"threads", required_argument, 0, 'j'},
+	{"book", no_argument, 0, 'b'},
 	{"debug", no_argument, 0, 'd'},
 	{"verbose", no_argument, 0, 'v'},
 	{"version", no_argument, 0, 'V'},
@@ -106,59 +221,870 @@ static struct option const long_options[] = {
 	{0, 0, 0, 0},
 };
 
-static char *short_options = "f:L:x:1:t:0dvVh";
+static char *short_options = "f:L:4:x:1:t:m:M:i:I:p:P:o:FXT:E:N:y:0j:bdvVh";
 
-static void ep_printf(struct endpoint_addr *ep)
+static void ep_printf(FILE *out, struct endpoint_addr *ep)
 {
 	char ip_str[32];
-	printf("[%02x:%02x:%02x:%02x:%02x:%02x] %s:%d",
+	fprintf(out, "[%02x:%02x:%02x:%02x:%02x:%02x] %s:%d",
 		ep->mac[0], ep->mac[1], ep->mac[2],
 		ep->mac[3], ep->mac[4], ep->mac[5],
 		inet_ntop(AF_INET, &ep->ip_addr, ip_str, 32),
 		(uint32_t) ep->port);
 }
 
-static int refn_complete(struct itchyparse_info *itchyparse, uint32_t refn32)
+/* the fields set in new_ep replace those of ep */
+static void ep_retarget(struct endpoint_addr *ep,
+			const struct endpoint_addr *new_ep)
+{
+	if (new_ep->mask & EP_ADDR_MAC_SET)
+		memcpy(ep->mac, new_ep->mac, sizeof(ep->mac));
+	if (new_ep->mask & EP_ADDR_IP_SET)
+		ep->ip_addr = new_ep->ip_addr;
+	if (new_ep->mask & EP_ADDR_PORT_SET)
+		ep->port = new_ep->port;
+}
+
+/* returns 0 if the order is kept, ENOMEM when its bucket overflows;
+ * a refn added again (e.g. merged streams) replaces the older order */
+static int refn_add(struct itchyparse_info *itchyparse, uint32_t refn32,
+		    struct order_state *order)
 {
-	int is_subscribed = 0;
 	int err;
 
-	if (!itchyparse->no_hash_del) {
-		err = dhash_del(&itchyparse->refn_dhash, refn32);
-		assert(!err);
+	err = dhash_map_add(&itchyparse->refn_dhash, refn32, order);
+	if (likely(!err))
+		return 0;
+
+	if (err == EEXIST) {
+		if (!itchyparse->no_hash_del)
+			itchyparse->dup_refns++;
+		memcpy(dhash_map_find(&itchyparse->refn_dhash, refn32),
+		       order, sizeof(*order));
+		return 0;
+	} else if (err == ENOMEM) {
+		itchyparse->stat.bucket_overflows++;
+		return ENOMEM;
+	} else {
+		assert(err == ENOSPC);
+		printf("refn hash table full\n");
+		exit(1);
 	}
-	err = dhash_find(&itchyparse->subscr_refn_dhash, refn32);
-	if (!err) {
-		/* ToDo: check if the order is exhausted */
-		err = dhash_del(&itchyparse->subscr_refn_dhash, refn32);
+}
+
+/* returns the order state, NULL if the refn is unknown; the state before
+ * the update is copied to order, when shares drop to 0 the refn is removed */
+static struct order_state *refn_update(struct itchyparse_info *itchyparse,
+				       uint32_t refn32, uint32_t shares,
+				       struct order_state *order)
+{
+	struct order_state *state;
+	int err;
+
+	state = dhash_map_find(&itchyparse->refn_dhash, refn32);
+	if (unlikely(!state))
+		return NULL;
+
+	memcpy(order, state, sizeof(*order));
+	state->shares = (shares < state->shares) ? state->shares - shares : 0;
+
+	if (!state->shares && !itchyparse->no_hash_del) {
+		err = dhash_map_del(&itchyparse->refn_dhash, refn32, NULL);
 		assert(!err);
-		is_subscribed = 1;
-	} else
-		assert(err == ENOENT);
+	}
+	return order;
+}
+
+static inline int book_side(const struct order_state *order)
+{
+	return order->buy_sell == ITCH_ORDER_BUY ? BOOK_BID : BOOK_ASK;
+}
+
+static void book_add(struct itchyparse_info *itchyparse,
+		     const struct order_state *order)
+{
+	if (order_book_add(&itchyparse->book[order->locate], book_side(order),
+			   order->price, order->shares)) {
+		printf("failed to alloc order book levels\n");
+		exit(ENOMEM);
+	}
+}
+
+static void order_update_defer(struct itchyparse_info *itchyparse,
+			       const struct order_update *upd)
+{
+	size_t size;
+
+	if (itchyparse->num_deferred == itchyparse->deferred_size) {
+		size = itchyparse->deferred_size ? 2 * itchyparse->deferred_size :
+		    1024;
+		itchyparse->deferred = realloc(itchyparse->deferred,
+					       size * sizeof(*upd));
+		if (!itchyparse->deferred) {
+			printf("failed to alloc deferred updates\n");
+			exit(ENOMEM);
+		}
+		itchyparse->deferred_size = size;
+	}
+	itchyparse->deferred[itchyparse->num_deferred++] = *upd;
+}
+
+/* an unknown refn is counted, or kept for the merge when the order
+ * may have been added in an earlier chunk */
+/* returns the order's locate, SYMBOL_LOCATE_NONE if not subscribed or
+ * unknown */
+static unsigned int order_update_apply(struct itchyparse_info *itchyparse,
+				       const struct order_update *upd)
+{
+	struct order_state order;
+	uint32_t shares;
+	int replace = upd->msg_type == MSG_TYPE_ORDER_REPLACE;
+
+	/* the replaced order is gone, new refn takes over */
+	if (!refn_update(itchyparse, upd->refn,
+			 replace ? UINT32_MAX : upd->shares, &order)) {
+		if (itchyparse->defer_unknown)
+			order_update_defer(itchyparse, upd);
+		else
+			itchyparse->unknown_refns++;
+		return SYMBOL_LOCATE_NONE;
+	}
+
+	if (itchyparse->book && order.locate != SYMBOL_LOCATE_NONE &&
+	    order.shares) {
+		shares = replace ? order.shares : upd->shares;
+		order_book_reduce(&itchyparse->book[order.locate],
+				  book_side(&order), order.price,
+				  shares < order.shares ? shares : order.shares,
+				  shares >= order.shares);
+	}
+	if (order.locate != SYMBOL_LOCATE_NONE) {
+		switch (upd->msg_type) {
+		case MSG_TYPE_ORDER_EXECUTED:
+			itchyparse->stat.subscr_execs ++;
+			itchyparse->symbol_stat[order.locate].execs ++;
+			break;
+		case MSG_TYPE_ORDER_CANCEL:
+			itchyparse->stat.subscr_cancels ++;
+			itchyparse->symbol_stat[order.locate].cancels ++;
+			break;
+		case MSG_TYPE_ORDER_REPLACE:
+			itchyparse->stat.subscr_replaces ++;
+			itchyparse->symbol_stat[order.locate].replaces ++;
+			break;
+		}
+	}
+	if (replace) {
+		order.shares = upd->shares;
+		order.price = upd->price;
+		if (!refn_add(itchyparse, upd->new_refn, &order) &&
+		    itchyparse->book && order.locate != SYMBOL_LOCATE_NONE)
+			book_add(itchyparse, &order);
+	}
+	return order.locate;
+}
+
+static void book_level_printf(FILE *out, const struct order_book *book,
+			      int side)
+{
+	const struct book_level *best = order_book_best(book, side);
+
+	if (best)
+		fprintf(out, "%llu@%u", best->shares, best->price);
+	else
+		fprintf(out, "-");
+	fprintf(out, " levels: %u", book->side[side].num);
+}
+
+/* best bid and ask of the books changed since the last timestamp msg */
+static void print_book_tops(struct itchyparse_info *itchyparse)
+{
+	struct order_book *book;
+	FILE *out = itchyparse->out;
+	unsigned int loc;
+
+	for (loc = 0; loc < itchyparse->symbols.num_symbols; loc++) {
+		book = &itchyparse->book[loc];
+		if (book->top_changes == itchyparse->book_snap[loc])
+			continue;
+		itchyparse->book_snap[loc] = book->top_changes;
+
+		fprintf(out, "sec %u %-8s bid: ", itchyparse->time_sec,
+			itchyparse->symbols.name[loc]);
+		book_level_printf(out, book, BOOK_BID);
+		fprintf(out, " ask: ");
+		book_level_printf(out, book, BOOK_ASK);
+		fprintf(out, "\n");
+	}
+}
+
+static void print_books(struct itchyparse_info *itchyparse, double elapsed)
+{
+	struct itchygen_stat *s = &itchyparse->stat;
+	unsigned long long msgs = s->orders + s->execs + s->cancels +
+	    s->replaces + s->timestamps + itchyparse->illegal_types;
+	struct order_book *book;
+	unsigned int loc;
+
+	printf("order books: %llu msgs in %.3f sec, %.2f M msgs/sec\n",
+	       msgs, elapsed, elapsed > 0.0 ? msgs / elapsed / 1e6 : 0.0);
+	for (loc = 0; loc < itchyparse->symbols.num_symbols; loc++) {
+		book = &itchyparse->book[loc];
+		printf("\t%-8s bid: ", itchyparse->symbols.name[loc]);
+		book_level_printf(stdout, book, BOOK_BID);
+		printf(" (max %u) ask: ", book->side[BOOK_BID].max_num);
+		book_level_printf(stdout, book, BOOK_ASK);
+		printf(" (max %u)\n\t\ttop changes: %llu crossed: %llu "
+		       "errors: %llu\n", book->side[BOOK_ASK].max_num,
+		       book->top_changes, book->crossed, book->errors);
+	}
+	printf("\n");
+}
+
+/* returns 1 if the record is one of the subscription feed: a timestamp or
+ * a msg of a subscribed symbol's order */
+static int parse_record(struct itchyparse_info *itchyparse,
+			struct itch_packet *pkt,
+			struct endpoint_addr *dst_ep,
+			struct endpoint_addr *src_ep)
+{
+	unsigned int locate = SYMBOL_LOCATE_NONE;
+	unsigned long long rec_seq_num;
+	struct order_state order;
+	struct order_update upd;
+	FILE *out = itchyparse->out;
+	uint32_t refn32;
+	int src_changed, dst_changed;
+
+	rec_seq_num = itchyparse->rec_seq_num = be64toh(pkt->mold.seq_num);
+	if (unlikely(itchyparse->first)) {
+		itchyparse->first = 0;
+
+		memcpy(&itchyparse->first_src_ep, src_ep, sizeof(*src_ep));
+		fprintf(out, "first packet adresses:\n\t");
+		ep_printf(out, &itchyparse->first_src_ep);
+		fprintf(out, " -> ");
+		memcpy(&itchyparse->first_dst_ep, dst_ep, sizeof(*dst_ep));
+		ep_printf(out, &itchyparse->first_dst_ep);
+		fprintf(out, "\n");
+
+		itchyparse->first_seq_num = rec_seq_num;
+		itchyparse->cur_seq_num = itchyparse->expect_first_seq;
+		if (itchyparse->edit_first_seq == rec_seq_num)
+			itchyparse->edit_recs = 0;	/* no need to edit */
+	}
+
+	src_changed = 0;
+	dst_changed = 0;
+	if (memcmp(&itchyparse->first_src_ep, src_ep, sizeof(*src_ep))) {
+		fprintf(out, "new src: ");
+		ep_printf(out, src_ep);
+		src_changed = 1;
+	}
+	if (memcmp(&itchyparse->first_dst_ep, dst_ep, sizeof(*dst_ep))) {
+		fprintf(out, "%snew dst: ", src_changed ? " -> " : "");
+		ep_printf(out, dst_ep);
+		dst_changed = 1;
+	}
+	if (dst_changed || src_changed)
+		fprintf(out, "\n");
+
+	if (unlikely(itchyparse->seq_resync)) {
+		/* a chunk's expected seq.num is known once the chunk before
+		 * it is parsed, the merge checks it and puts its error here */
+		itchyparse->seq_resync = 0;
+		itchyparse->first_seq_num = rec_seq_num;
+		itchyparse->cur_seq_num = rec_seq_num;
+		itchyparse->resync_out_pos = ftell(out);
+	}
+	if (rec_seq_num != itchyparse->cur_seq_num) {
+		fprintf(out, "seq.err. expected:%llu recvd:%llu\n",
+			itchyparse->cur_seq_num, rec_seq_num);
+		itchyparse->cur_seq_num = rec_seq_num; /* update expected */
+		itchyparse->seq_errors ++;
+	}
+	itchyparse->cur_seq_num ++;
+
+	refn32 = (uint32_t)be64toh(pkt->msg.common.ref_num);
+
+	switch (pkt->msg.common.msg_type) {
+	case MSG_TYPE_ADD_ORDER_NO_MPID:
+		itchyparse->stat.orders ++;
+
+		order.shares = be32toh(pkt->msg.order.shares);
+		order.price = be32toh(pkt->msg.order.price);
+		order.add_sec = itchyparse->time_sec;
+		order.add_nsec = be32toh(pkt->msg.order.timestamp_ns);
+		order.buy_sell = pkt->msg.order.buy_sell;
+		order.locate = symbol_locate(&itchyparse->symbols,
+					     pkt->msg.order.stock);
+
+		if (order.locate != SYMBOL_LOCATE_NONE) {
+			/* this order is for a subscribed symbol */
+			itchyparse->stat.subscr_orders ++;
+			itchyparse->symbol_stat[order.locate].orders ++;
+			if (itchyparse->debug_mode) {
+				fprintf(out, "%.8s refn:%u\n",
+				       pkt->msg.order.stock,
+				       refn32);
+			}
+		} else
+			itchyparse->unsubscr_orders ++;
+		if (!refn_add(itchyparse, refn32, &order) &&
+		    itchyparse->book && order.locate != SYMBOL_LOCATE_NONE)
+			book_add(itchyparse, &order);
+		locate = order.locate;
+		break;
+	case MSG_TYPE_ORDER_EXECUTED:
+		itchyparse->stat.execs ++;
+		upd.msg_type = MSG_TYPE_ORDER_EXECUTED;
+		upd.refn = refn32;
+		upd.shares = be32toh(pkt->msg.exec.shares);
+		locate = order_update_apply(itchyparse, &upd);
+		break;
+	case MSG_TYPE_ORDER_CANCEL:
+		itchyparse->stat.cancels ++;
+		upd.msg_type = MSG_TYPE_ORDER_CANCEL;
+		upd.refn = refn32;
+		upd.shares = be32toh(pkt->msg.cancel.shares);
+		locate = order_update_apply(itchyparse, &upd);
+		break;
+	case MSG_TYPE_ORDER_REPLACE:
+		itchyparse->stat.replaces ++;
+		upd.msg_type = MSG_TYPE_ORDER_REPLACE;
+		upd.refn = refn32;
+		upd.shares = be32toh(pkt->msg.replace.shares);
+		upd.price = be32toh(pkt->msg.replace.price);
+		upd.new_refn = (uint32_t)be64toh(pkt->msg.replace.new_ref_num);
+		locate = order_update_apply(itchyparse, &upd);
+		break;
+	case MSG_TYPE_TIMESTAMP:
+		itchyparse->stat.timestamps ++;
+		itchyparse->time_sec = be32toh(pkt->msg.time.second);
+		if (itchyparse->book && itchyparse->verbose_mode)
+			print_book_tops(itchyparse);
+		return 1;
+	default:
+		itchyparse->illegal_types ++;
+		break;
+	}
+	return locate != SYMBOL_LOCATE_NONE;
+}
+
+static void rec_edit_apply(const struct rec_edit *edit, struct pcap_rec *rec)
+{
+	struct itch_packet *pkt = rec->data;
+	uint64_t old_seq, new_seq;
+
+	if (edit->retarget)
+		pcap_rec_retarget(rec, edit->dst, edit->src);
+	if (!edit->seq_nums || rec->len < sizeof(pkt->mold))
+		return;
+	old_seq = pkt->mold.seq_num;
+	new_seq = htobe64(be64toh(old_seq) + edit->seq_delta);
+	pkt->mold.seq_num = new_seq;
+	/* seq_num is at an even offset of the UDP datagram */
+	rec->udp->udp.check = ip_checksum_adjust(rec->udp->udp.check,
+						 &old_seq, &new_seq,
+						 sizeof(new_seq));
+}
+
+/* a record of the subscription feed is written out, edited in a copy */
+static void filter_rec(struct itchyparse_info *itchyparse,
+		       struct pcap_rec *rec)
+{
+	struct pcap_out *out = itchyparse->filter_out;
+	struct rec_edit *edit = itchyparse->filter_edit;
+	struct pcap_rec copy;
+	int err;
+
+	if (!edit->seq_nums && !edit->retarget) {
+		err = pcap_out_add(out, rec);
+	} else {
+		/* renumbered in sequence, the filtered out leave no gaps */
+		edit->seq_delta = itchyparse->edit_first_seq + out->recs -
+				  itchyparse->rec_seq_num;
+		err = pcap_out_add_copy(out, rec, &copy);
+		if (!err)
+			rec_edit_apply(edit, &copy);
+	}
+	if (unlikely(err)) {
+		errno = err;
+		printf("failed to write out pcap file, %m\n");
+		exit(err);
+	}
+}
+
+/* returns 0 past the last record, EINVAL when stopped at a truncated one */
+static int parse_recs(struct itchyparse_info *itchyparse,
+		      struct pcap_iter *iter)
+{
+	int err;
+
+	for (;;) {
+		struct pcap_rec rec[PARSE_BATCH];
+		uint32_t refn[PARSE_BATCH];
+		struct endpoint_addr dst_ep, src_ep;
+		struct itch_packet *pkt;
+		int i, n;
+
+		for (n = 0; n < PARSE_BATCH; n++) {
+			err = pcap_iter_next(iter, &rec[n]);
+			if (unlikely(err)) {
+				if (err != ENOENT)
+					fprintf(itchyparse->out,
+						"truncated record at offset %zu, "
+						"stopped there\n", iter->pos);
+				break;
+			}
+			pkt = rec[n].data;
+			refn[n] = (uint32_t)be64toh(pkt->msg.common.ref_num);
+		}
+		dhash_prefetch_batch(&itchyparse->refn_dhash, refn, n);
+
+		for (i = 0; i < n; i++) {
+			pkt = rec[i].data;
+			memset(&dst_ep, 0, sizeof(dst_ep));
+			memset(&src_ep, 0, sizeof(src_ep));
+			pcap_rec_dst_ep(&rec[i], &dst_ep);
+			pcap_rec_src_ep(&rec[i], &src_ep);
+			if (parse_record(itchyparse, pkt, &dst_ep, &src_ep) &&
+			    itchyparse->filter_out)
+				filter_rec(itchyparse, &rec[i]);
+			if (itchyparse->index &&
+			    itch_index_add(itchyparse->index, &rec[i])) {
+				printf("failed to alloc index entries\n");
+				exit(ENOMEM);
+			}
+		}
+		if (n < PARSE_BATCH)
+			break;
+	}
+	return err == ENOENT ? 0 : err;
+}
+
+/*
+ * Parallel parsing: the file is cut into byte ranges, each moved forward
+ * to a record boundary, and every range is parsed on its own thread with
+ * a private refn table, counters and output buffer. The first chunk starts
+ * as the serial parser does; the others take their first seq.num as the
+ * expected one and keep updates of refns they do not know, as these may
+ * belong to orders added before the chunk.
+ *
+ * The merge then goes over the chunks in file order, which makes the
+ * results those of the serial parser: the chunk's first seq.num is checked
+ * against the one expected after the chunk before, its deferred updates are
+ * applied to the orders standing so far, then its own standing orders join
+ * them. Only the hash table internals (probes, bucket fill) may differ.
+ */
+struct parse_chunk {
+	struct itchyparse_info ctx;
+	struct pcap_iter iter;
+	char *out_buf;
+	size_t out_size;
+	int err;
+	pthread_t thread;
+};
+
+static int parse_chunk_init(struct itchyparse_info *itchyparse,
+			    struct parse_chunk *chunk, struct pcap_map *map,
+			    size_t from, size_t to, int first_chunk)
+{
+	struct itchyparse_info *ctx = &chunk->ctx;
+	int err;
+
+	memcpy(ctx, itchyparse, sizeof(*ctx));
+	pcap_iter_init_range(&chunk->iter, map, from, to);
+	chunk->out_buf = NULL;
+	chunk->out_size = 0;
+	chunk->err = 0;
+	ctx->out = open_memstream(&chunk->out_buf, &chunk->out_size);
+	if (!ctx->out)
+		return errno;
+	/* the first chunk goes on with the main refn table and counters */
+	if (first_chunk)
+		return 0;
+
+	memset(&ctx->stat, 0, sizeof(ctx->stat));
+	ctx->unsubscr_orders = 0;
+	ctx->unknown_refns = 0;
+	ctx->dup_refns = 0;
+	ctx->seq_errors = 0;
+	ctx->illegal_types = 0;
+	ctx->first = 0;
+	ctx->seq_resync = 1;
+	ctx->defer_unknown = 1;
+	ctx->time_sec = TIME_SEC_UNKNOWN;
+	ctx->deferred = NULL;
+	ctx->num_deferred = ctx->deferred_size = 0;
+
+	ctx->symbol_stat = NULL;
+	if (ctx->symbols.num_symbols) {
+		ctx->symbol_stat = calloc(ctx->symbols.num_symbols,
+					  sizeof(*ctx->symbol_stat));
+		if (!ctx->symbol_stat) {
+			fclose(ctx->out);
+			free(chunk->out_buf);
+			return ENOMEM;
+		}
+	}
+	err = dhash_map_init(&ctx->refn_dhash, CRC_WIDTH, ctx->poly,
+			     ctx->num_poly, sizeof(struct order_state));
+	if (err) {
+		free(ctx->symbol_stat);
+		fclose(ctx->out);
+		free(chunk->out_buf);
+	}
+	return err;
+}
+
+static void parse_chunk_cleanup(struct parse_chunk *chunk, int first_chunk)
+{
+	free(chunk->out_buf);
+	if (first_chunk)
+		return;
+	dhash_cleanup(&chunk->ctx.refn_dhash);
+	free(chunk->ctx.symbol_stat);
+	free(chunk->ctx.deferred);
+}
+
+static void *parse_chunk_thrd(void *arg)
+{
+	struct parse_chunk *chunk = arg;
+
+	chunk->err = parse_recs(&chunk->ctx, &chunk->iter);
+	fclose(chunk->ctx.out);
+	return NULL;
+}
+
+/* a standing order of a chunk joins those of the chunks before */
+static void parse_chunk_merge_order(uint32_t refn32, void *val, void *arg)
+{
+	struct itchyparse_info *itchyparse = arg;
+	struct order_state *order = val;
+
+	if (order->add_sec == TIME_SEC_UNKNOWN)
+		order->add_sec = itchyparse->time_sec;
+	refn_add(itchyparse, refn32, order);
+}
+
+static void parse_chunk_merge(struct itchyparse_info *itchyparse,
+			      struct parse_chunk *chunk)
+{
+	struct itchyparse_info *ctx = &chunk->ctx;
+	struct itchygen_stat *s = &itchyparse->stat;
+	size_t i, pos;
+	unsigned int loc;
+
+	for (i = 0; i < ctx->num_deferred; i++)
+		order_update_apply(itchyparse, &ctx->deferred[i]);
+	dhash_map_walk(&ctx->refn_dhash, parse_chunk_merge_order, itchyparse);
+	if (ctx->time_sec != TIME_SEC_UNKNOWN)
+		itchyparse->time_sec = ctx->time_sec;
+
+	s->orders += ctx->stat.orders;
+	s->execs += ctx->stat.execs;
+	s->cancels += ctx->stat.cancels;
+	s->replaces += ctx->stat.replaces;
+	s->timestamps += ctx->stat.timestamps;
+	s->subscr_orders += ctx->stat.subscr_orders;
+	s->subscr_execs += ctx->stat.subscr_execs;
+	s->subscr_cancels += ctx->stat.subscr_cancels;
+	s->subscr_replaces += ctx->stat.subscr_replaces;
+	s->bucket_overflows += ctx->stat.bucket_overflows;
+	itchyparse->unsubscr_orders += ctx->unsubscr_orders;
+	itchyparse->dup_refns += ctx->dup_refns;
+	itchyparse->seq_errors += ctx->seq_errors;
+	itchyparse->illegal_types += ctx->illegal_types;
+	for (loc = 0; loc < itchyparse->symbols.num_symbols; loc++) {
+		itchyparse->symbol_stat[loc].orders += ctx->symbol_stat[loc].orders;
+		itchyparse->symbol_stat[loc].execs += ctx->symbol_stat[loc].execs;
+		itchyparse->symbol_stat[loc].cancels +=
+		    ctx->symbol_stat[loc].cancels;
+		itchyparse->symbol_stat[loc].replaces +=
+		    ctx->symbol_stat[loc].replaces;
+	}
+
+	pos = 0;
+	if (!ctx->seq_resync) {	/* had records */
+		if (ctx->first_seq_num != itchyparse->cur_seq_num) {
+			pos = ctx->resync_out_pos;
+			fwrite(chunk->out_buf, 1, pos, stdout);
+			printf("seq.err. expected:%llu recvd:%llu\n",
+			       itchyparse->cur_seq_num, ctx->first_seq_num);
+			itchyparse->seq_errors++;
+		}
+		itchyparse->cur_seq_num = ctx->cur_seq_num;
+		itchyparse->rec_seq_num = ctx->rec_seq_num;
+	}
+	fwrite(chunk->out_buf + pos, 1, chunk->out_size - pos, stdout);
+}
+
+/* as many as threads, unless that makes them too small */
+static unsigned int num_chunks(size_t from, size_t to, unsigned int num_threads)
+{
+	size_t data_size = to > from ? to - from : 0;
+
+	if (num_threads > data_size / PARSE_MIN_CHUNK)
+		return data_size / PARSE_MIN_CHUNK;
+	return num_threads;
+}
+
+/* bound[i] is where chunk i of from - to starts, bound[n] is to */
+static void chunk_bounds(struct pcap_map *map, size_t from, size_t to,
+			 unsigned int n, size_t *bound)
+{
+	size_t data_size = to - from;
+	unsigned int i;
+
+	bound[0] = from;
+	for (i = 1; i < n; i++) {
+		bound[i] = pcap_map_resync(map, from + data_size / n * i);
+		if (bound[i] < bound[i - 1])
+			bound[i] = bound[i - 1];
+		if (bound[i] > to)
+			bound[i] = to;
+	}
+	bound[n] = to;
+}
+
+/* records from - to; returns EAGAIN when better parsed serially */
+static int parse_chunks(struct itchyparse_info *itchyparse,
+			struct pcap_map *map, size_t from, size_t to)
+{
+	struct parse_chunk *chunk;
+	struct pcap_iter iter;
+	struct pcap_rec rec;
+	size_t *bound;
+	unsigned int n, i, num_init;
+	int err;
+
+	n = num_chunks(from, to, itchyparse->num_threads);
+	if (n < 2)
+		return EAGAIN;
+
+	/* the other chunks compare their endpoints to the first ones */
+	pcap_iter_init_range(&iter, map, from, to);
+	if (pcap_iter_next(&iter, &rec))
+		return EAGAIN;
+	pcap_rec_dst_ep(&rec, &itchyparse->first_dst_ep);
+	pcap_rec_src_ep(&rec, &itchyparse->first_src_ep);
+
+	chunk = calloc(n, sizeof(*chunk));
+	bound = calloc(n + 1, sizeof(*bound));
+	if (!chunk || !bound) {
+		free(chunk);
+		free(bound);
+		return ENOMEM;
+	}
+	chunk_bounds(map, from, to, n, bound);
+	for (num_init = 0; num_init < n; num_init++) {
+		err = parse_chunk_init(itchyparse, &chunk[num_init], map,
+				       bound[num_init], bound[num_init + 1],
+				       num_init == 0);
+		if (err) {
+			for (i = 0; i < num_init; i++)
+				fclose(chunk[i].ctx.out);
+			goto cleanup;
+		}
+	}
+
+	for (i = 1; i < n; i++) {
+		err = pthread_create(&chunk[i].thread, NULL, parse_chunk_thrd,
+				     &chunk[i]);
+		if (err) {
+			printf("failed to create parser thread, %s\n",
+			       strerror(err));
+			exit(err);
+		}
+	}
+	parse_chunk_thrd(&chunk[0]);
+	for (i = 1; i < n; i++)
+		pthread_join(chunk[i].thread, NULL);
+
+	/* every chunk but the last ends right where the next starts */
+	for (i = 0; i + 1 < n; i++) {
+		if (chunk[i].err || chunk[i].iter.pos != chunk[i].iter.end) {
+			printf("chunk at offset %zu lost record sync, "
+			       "parsing serially\n", chunk[i].iter.end);
+			dhash_reset(&itchyparse->refn_dhash);
+			if (itchyparse->symbol_stat)
+				memset(itchyparse->symbol_stat, 0,
+				       itchyparse->symbols.num_symbols *
+				       sizeof(*itchyparse->symbol_stat));
+			err = EAGAIN;
+			goto cleanup;
+		}
+	}
+
+	memcpy(itchyparse, &chunk[0].ctx, sizeof(*itchyparse));
+	itchyparse->out = stdout;
+	fwrite(chunk[0].out_buf, 1, chunk[0].out_size, stdout);
+	for (i = 1; i < n; i++)
+		parse_chunk_merge(itchyparse, &chunk[i]);
+	err = 0;
+
+cleanup:
+	for (i = 0; i < num_init; i++)
+		parse_chunk_cleanup(&chunk[i], i == 0);
+	free(chunk);
+	free(bound);
+	return err;
+}
+
+/*
+ * Editing: the records keep their order, so the new seq.nums are the old
+ * ones shifted by the same delta, that of the first record, and new
+ * endpoints are the same for all. Every record is patched in place, in the
+ * input or in its copy, and its checksums adjusted for the changed words
+ * alone, chunks of the file on separate threads. A chunk is walked once
+ * before any thread writes, to make sure it ends where the next one starts.
+ */
+struct edit_chunk {
+	pthread_t thread;
+	struct pcap_map *map;		/* records edited there */
+	struct pcap_map *copy_from;	/* copied first, NULL if in place */
+	size_t from, to;
+	int last;
+	const struct rec_edit *edit;
+	pthread_barrier_t *barrier;
+	int *lost_sync;
+	unsigned long long recs;
+};
+
+static void edit_chunk_recs(struct edit_chunk *chunk)
+{
+	struct pcap_iter iter;
+	struct pcap_rec rec;
 
-	return is_subscribed;
+	if (chunk->copy_from)
+		memcpy(chunk->map->base + chunk->from,
+		       chunk->copy_from->base + chunk->from,
+		       chunk->to - chunk->from);
+
+	pcap_iter_init_range(&iter, chunk->map, chunk->from, chunk->to);
+	while (!pcap_iter_next(&iter, &rec)) {
+		chunk->recs++;
+		rec_edit_apply(chunk->edit, &rec);
+	}
+}
+
+static void *edit_chunk_thrd(void *arg)
+{
+	struct edit_chunk *chunk = arg;
+	struct pcap_iter iter;
+	struct pcap_rec rec;
+	int err;
+
+	pcap_iter_init_range(&iter, chunk->copy_from ? : chunk->map,
+			     chunk->from, chunk->to);
+	while (!(err = pcap_iter_next(&iter, &rec)))
+		;
+	/* the last chunk may stop at a truncated record */
+	if (iter.pos != iter.end && !(chunk->last && err == EINVAL))
+		__atomic_store_n(chunk->lost_sync, 1, __ATOMIC_RELAXED);
+	pthread_barrier_wait(chunk->barrier);
+
+	if (!__atomic_load_n(chunk->lost_sync, __ATOMIC_RELAXED))
+		edit_chunk_recs(chunk);
+	return NULL;
+}
+
+/* map is edited, or a copy of it into out_map when that is not NULL;
+ * returns the number of records edited */
+static unsigned long long edit_recs(struct itchyparse_info *itchyparse,
+				    struct pcap_map *map,
+				    struct pcap_map *out_map,
+				    const struct rec_edit *edit)
+{
+	struct edit_chunk *chunk;
+	pthread_barrier_t barrier;
+	unsigned long long recs = 0;
+	unsigned int n, i;
+	size_t *bound;
+	int lost_sync = 0, err;
+
+	n = num_chunks(sizeof(struct pcap_global_hdr), map->size,
+		       itchyparse->num_threads);
+	if (n < 1)
+		n = 1;
+	chunk = calloc(n, sizeof(*chunk));
+	bound = calloc(n + 1, sizeof(*bound));
+	if (!chunk || !bound) {
+		printf("failed to alloc edit chunks\n");
+		exit(ENOMEM);
+	}
+	chunk_bounds(map, sizeof(struct pcap_global_hdr), map->size, n, bound);
+	pthread_barrier_init(&barrier, NULL, n);
+	for (i = 0; i < n; i++) {
+		chunk[i].map = out_map ? : map;
+		chunk[i].copy_from = out_map ? map : NULL;
+		chunk[i].from = bound[i];
+		chunk[i].to = bound[i + 1];
+		chunk[i].last = i + 1 == n;
+		chunk[i].edit = edit;
+		chunk[i].barrier = &barrier;
+		chunk[i].lost_sync = &lost_sync;
+	}
+	for (i = 1; i < n; i++) {
+		err = pthread_create(&chunk[i].thread, NULL, edit_chunk_thrd,
+				     &chunk[i]);
+		if (err) {
+			printf("failed to create edit thread, %s\n",
+			       strerror(err));
+			exit(err);
+		}
+	}
+	edit_chunk_thrd(&chunk[0]);
+	for (i = 1; i < n; i++)
+		pthread_join(chunk[i].thread, NULL);
+	pthread_barrier_destroy(&barrier);
+
+	if (lost_sync) {
+		/* nothing written yet, patch the whole file on this thread */
+		printf("edit chunks lost record sync, editing serially\n");
+		chunk[0].to = map->size;
+		chunk[0].recs = 0;
+		edit_chunk_recs(&chunk[0]);
+		n = 1;
+	}
+	for (i = 0; i < n; i++)
+		recs += chunk[i].recs;
+	free(chunk);
+	free(bound);
+	return recs;
 }
 
 int main(int argc, char **argv)
 {
 	struct itchyparse_info itchyparse;
-	unsigned long long cur_seq_num = 0;
-	unsigned long long seq_errors = 0;
-	unsigned long long rec_seq_num = 0;
-	unsigned long long first_seq_num = 0;
-	unsigned long long last_seq_num = 0;
-	unsigned long long new_seq_num = 0;
-	unsigned int illegal_types = 0;
-	int first = 1, edit_recs = 0;
-	struct endpoint_addr dst_ep, src_ep;
-	struct endpoint_addr first_dst_ep, first_src_ep;
-	int ch, longindex, err;
+	struct pcap_map map, out_map;
+	struct pcap_out filter_out;
+	struct itch_index index;
+	size_t from, to, off;
+	unsigned int from_sec = 0, to_sec = 0;
+	unsigned long long from_seq = 0;
+	char from_stock[8];
+	int seek_sec = 0, seek_to_sec = 0, seek_seq = 0, seek_sym = 0;
+	int build_index = 0, expect_set = 0, seeking;
+	struct pcap_iter iter;
+	struct rec_edit edit;
+	unsigned long long edited = 0;
+	in_addr_t ip_addr;
+	uint8_t mac[8];
+	int port;
+	struct timespec t_start, t_end;
+	int ch, longindex = 0, err;
+	struct symbols_file *sym_file;
 	const char *optname;
 
 	if (argc < 2)
 		usage(0, NULL);
 
 	memset(&itchyparse, 0, sizeof(itchyparse));
+	itchyparse.first = 1;
+	itchyparse.num_threads = 1;
+	itchyparse.out = stdout;
 	itchyparse.num_poly = get_default_poly(itchyparse.poly, MAX_POLY);
 
 	opterr = 0;		/* global getopt variable */
@@ -189,21 +1115,108 @@ int main(int argc, char **argv)
 			err = str_to_int_ge(optarg, itchyparse.expect_first_seq, 0);
 			if (err)
 				usage(bad_optarg(err, optname, optarg), NULL);
+			expect_set = 1;
 			break;
 		case '1':
 			err = str_to_int_ge(optarg, itchyparse.edit_first_seq, 0);
 			if (err)
 				usage(bad_optarg(err, optname, optarg), NULL);
-			edit_recs = 1;
+			itchyparse.edit_recs = 1;
 			break;
 		case 't':
 			err = str_to_int_ge(optarg, itchyparse.edit_start_sec, 0);
 			if (err)
 				usage(bad_optarg(err, optname, optarg), NULL);
 			break;
+		case 'm':
+			err = str_to_mac(optarg, mac);
+			if (err)
+				usage(bad_optarg(err, optname, optarg), NULL);
+			ep_addr_set_mac(&itchyparse.edit_dst, mac);
+			break;
+		case 'M':
+			err = str_to_mac(optarg, mac);
+			if (err)
+				usage(bad_optarg(err, optname, optarg), NULL);
+			ep_addr_set_mac(&itchyparse.edit_src, mac);
+			break;
+		case 'i':	/* dst ip addr */
+			ip_addr = inet_addr(optarg);
+			if (ip_addr == INADDR_NONE)
+				usage(bad_optarg(EINVAL, optname, optarg), NULL);
+			ep_addr_set_ip(&itchyparse.edit_dst, ip_addr);
+			break;
+		case 'I':	/* src ip addr */
+			ip_addr = inet_addr(optarg);
+			if (ip_addr == INADDR_NONE)
+				usage(bad_optarg(EINVAL, optname, optarg), NULL);
+			ep_addr_set_ip(&itchyparse.edit_src, ip_addr);
+			break;
+		case 'p':	/* dst port */
+			err = str_to_int_range(optarg, port, 1024, 65535, 10);
+			if (err)
+				usage(bad_optarg(err, optname, optarg), NULL);
+			ep_addr_set_port(&itchyparse.edit_dst, port);
+			break;
+		case 'P':	/* src port */
+			err = str_to_int_range(optarg, port, 1024, 65535, 10);
+			if (err)
+				usage(bad_optarg(err, optname, optarg), NULL);
+			ep_addr_set_port(&itchyparse.edit_src, port);
+			break;
+		case 'o':
+			itchyparse.out_fname = strdup(optarg);
+			if (!itchyparse.out_fname) {
+				printf("failed to alloc mem for out file name\n");
+				exit(ENOMEM);
+			}
+			break;
+		case 'F':
+			itchyparse.filter = 1;
+			break;
+		case 'X':
+			build_index = 1;
+			break;
+		case 'T':
+			err = str_to_int_ge(optarg, from_sec, 0);
+			if (err)
+				usage(bad_optarg(err, optname, optarg), NULL);
+			seek_sec = 1;
+			break;
+		case 'E':
+			err = str_to_int_ge(optarg, to_sec, 0);
+			if (err)
+				usage(bad_optarg(err, optname, optarg), NULL);
+			seek_to_sec = 1;
+			break;
+		case 'N':
+			err = str_to_int_ge(optarg, from_seq, 0);
+			if (err)
+				usage(bad_optarg(err, optname, optarg), NULL);
+			seek_seq = 1;
+			break;
+		case 'y':	/* stock field, padded with spaces */
+			if (!*optarg || strlen(optarg) > sizeof(from_stock))
+				usage(bad_optarg(EINVAL, optname, optarg), NULL);
+			memset(from_stock, ' ', sizeof(from_stock));
+			memcpy(from_stock, optarg, strlen(optarg));
+			seek_sym = 1;
+			break;
+		case '4':
+			itchyparse.subscription.cache_dir = optarg;
+			break;
 		case '0':
 			itchyparse.no_hash_del = 1;
 			break;
+		case 'b':
+			itchyparse.book_mode = 1;
+			break;
+		case 'j':
+			err = str_to_int_range(optarg, itchyparse.num_threads,
+					       1, PARSE_MAX_THREADS, 10);
+			if (err)
+				usage(bad_optarg(err, optname, optarg), NULL);
+			break;
 		case 'd':
 			itchyparse.debug_mode = 1;
 			itchyparse.verbose_mode = 1;
@@ -228,13 +1241,45 @@ int main(int argc, char **argv)
 
 	if (!itchyparse.pcap_fname)
 		usage(EINVAL, "error: pcap file name not supplied");
+	if (itchyparse.book_mode && !itchyparse.subscription.fname)
+		usage(EINVAL, "error: order books need a subscription list file");
+
+	memset(&edit, 0, sizeof(edit));
+	edit.dst = &itchyparse.edit_dst;
+	edit.src = &itchyparse.edit_src;
+	edit.retarget = itchyparse.edit_dst.mask || itchyparse.edit_src.mask;
+	if (itchyparse.filter && (!itchyparse.out_fname ||
+				  !itchyparse.subscription.fname))
+		usage(EINVAL, "error: filter needs an out file and "
+		      "a subscription list file");
+	if (itchyparse.out_fname && !itchyparse.filter &&
+	    !itchyparse.edit_recs && !edit.retarget)
+		usage(EINVAL, "error: out file needs records to edit");
+	seeking = seek_sec || seek_to_sec || seek_seq || seek_sym;
+	if (build_index && seeking)
+		usage(EINVAL, "error: the index is built of the whole file");
+	if ((build_index || seeking) && !itchyparse.filter &&
+	    (itchyparse.edit_recs || edit.retarget))
+		usage(EINVAL, "error: edits of the whole file do not go with "
+		      "the index");
 
 	printf("\nitchyparse ver %s, arguments:\n", ITCHYGEN_VER_STR);
 	printf("\tinput pcap file: %s\n", itchyparse.pcap_fname);
+	if (itchyparse.out_fname)
+		printf("\toutput pcap file: %s\n", itchyparse.out_fname);
+	if (itchyparse.num_threads > 1 &&
+	    (itchyparse.book_mode || itchyparse.filter || build_index)) {
+		/* the books, the feed and the index follow the records in
+		 * file order */
+		printf("\t%s on a single thread\n", itchyparse.book_mode ?
+		       "order books built" : itchyparse.filter ?
+		       "records filtered" : "index built");
+		itchyparse.num_threads = 1;
+	}
+	if (itchyparse.num_threads > 1)
+		printf("\tparser threads: %u\n", itchyparse.num_threads);
 
 	if (itchyparse.subscription.fname) {
-		int i;
-
 		err = read_symbol_file(&itchyparse.subscription, 1);
 		if (err) {
 			printf("failed to read symbols file\n");
@@ -244,205 +1289,233 @@ int main(int argc, char **argv)
 			itchyparse.subscription.fname,
 			itchyparse.subscription.num_symbols);
 
-		err = dhash_init(&itchyparse.subscr_name_dhash, CRC_WIDTH,
-				 itchyparse.poly, 1);
-		assert(!err);
-
-		err = dhash_init(&itchyparse.subscr_refn_dhash, CRC_WIDTH,
-				 itchyparse.poly, itchyparse.num_poly);
-		assert(!err);
+		sym_file = &itchyparse.subscription;
+		err = symbol_table_init(&itchyparse.symbols, &sym_file, 1);
+		if (err) {
+			printf("failed to build symbol table\n");
+			exit(err);
+		}
+		itchyparse.symbol_stat = calloc(itchyparse.symbols.num_symbols,
+						sizeof(*itchyparse.symbol_stat));
+		if (!itchyparse.symbol_stat) {
+			printf("failed to alloc per symbol stats\n");
+			exit(ENOMEM);
+		}
+	}
+	if (itchyparse.book_mode) {
+		unsigned int loc;
 
-		for (i = 0; i < itchyparse.subscription.num_symbols; i++) {
-			err = dhash_add(&itchyparse.subscr_name_dhash,
-				symbol_name_to_u32(&itchyparse.subscription.symbol[i]));
-			assert(!err); // || err == EEXIST);
+		itchyparse.book = calloc(itchyparse.symbols.num_symbols,
+					 sizeof(*itchyparse.book));
+		itchyparse.book_snap = calloc(itchyparse.symbols.num_symbols,
+					      sizeof(*itchyparse.book_snap));
+		if (!itchyparse.book || !itchyparse.book_snap) {
+			printf("failed to alloc order books\n");
+			exit(ENOMEM);
 		}
+		for (loc = 0; loc < itchyparse.symbols.num_symbols; loc++)
+			order_book_init(&itchyparse.book[loc]);
 	}
 
-	err = dhash_init(&itchyparse.refn_dhash, CRC_WIDTH,
-			 itchyparse.poly, itchyparse.num_poly);
+	err = dhash_map_init(&itchyparse.refn_dhash, CRC_WIDTH,
+			     itchyparse.poly, itchyparse.num_poly,
+			     sizeof(struct order_state));
 	if (err) {
 		errno = err;
 		printf("failed to init hash table, %m\n");
 		return err;
 	}
 
-	err = pcap_file_open_rd(itchyparse.pcap_fname);
+	/* edited records are rewritten in place, unless copied */
+	err = pcap_map_open(&map, itchyparse.pcap_fname, !itchyparse.out_fname &&
+			    (itchyparse.edit_recs || edit.retarget));
 	if (err) {
 		errno = err;
 		printf("failed to open pcap file for read, %m\n");
 		return errno;
 	}
-
-	for (;;) {
-		struct itch_packet itch_pkt;
-		size_t pkt_len;
-		uint32_t refn32, name32;
-		int src_changed, dst_changed;
-		int err, is_subscribed;
-
-		err = pcap_file_read_record(&itch_pkt, sizeof(itch_pkt),
-					    &pkt_len, &dst_ep, &src_ep);
-		if (unlikely(err)) {
-			if (err != ENOENT) {
-				printf("failed to read from pcap file, %m\n");
-				exit(err);
-			}
-			break;
+	from = sizeof(struct pcap_global_hdr);
+	to = map.size;
+	if (seeking) {
+		err = itch_index_read(&index, itchyparse.pcap_fname);
+		if (err) {
+			errno = err;
+			printf("failed to read index of %s, %m%s\n",
+			       itchyparse.pcap_fname, err == ENOENT ||
+			       err == ESTALE ? ", build it with -X" : "");
+			return err;
 		}
+		if (seek_sec && (off = itch_index_seek_sec(&index, from_sec,
+							    map.size)) > from)
+			from = off;
+		if (seek_seq && (off = itch_index_seek_seq(&index, &map,
+							    from_seq)) > from)
+			from = off;
+		if (seek_sym) {
+			const struct itch_index_sym *sym;
 
-		rec_seq_num = be64toh(itch_pkt.mold.seq_num);
-		if (unlikely(first)) {
-			first = 0;
-
-			memcpy(&first_src_ep, &src_ep, sizeof(src_ep));
-			printf("first packet adresses:\n\t");
-			ep_printf(&first_src_ep);
-			printf(" -> ");
-			memcpy(&first_dst_ep, &dst_ep, sizeof(dst_ep));
-			ep_printf(&first_dst_ep);
-			printf("\n");
-
-			first_seq_num = rec_seq_num;
-			cur_seq_num = itchyparse.expect_first_seq;
-			if (edit_recs) {
-				if (itchyparse.edit_first_seq != first_seq_num)
-					new_seq_num = itchyparse.edit_first_seq;
-				else /* no need to edit */
-					edit_recs = 0;
-				pcap_file_set_wr_endpoints(&dst_ep, &src_ep);
+			sym = itch_index_find_sym(&index, from_stock);
+			if (!sym) {
+				printf("symbol not in index\n");
+				itch_index_cleanup(&index);
+				pcap_map_close(&map);
+				return EINVAL;
 			}
+			if (sym->off > from)
+				from = sym->off;
 		}
+		if (seek_to_sec)
+			to = itch_index_seek_sec(&index, to_sec + 1, map.size);
+		if (to < from)
+			to = from;
+		itchyparse.time_sec = itch_index_sec_of(&index, from);
+		printf("\tseek: offsets %zu - %zu, from second %u\n",
+		       from, to, itchyparse.time_sec);
+		itch_index_cleanup(&index);
+
+		/* the window starts where its first seq.num is */
+		pcap_iter_init_range(&iter, &map, from, to);
+		if (!expect_set) {
+			struct pcap_rec rec;
 
-		src_changed = 0;
-		dst_changed = 0;
-		if (memcmp(&first_src_ep, &src_ep, sizeof(src_ep))) {
-			printf("new src: ");
-			ep_printf(&src_ep);
-			src_changed = 1;
+			if (!pcap_iter_next(&iter, &rec) &&
+			    rec.len >= sizeof(struct mold_udp64))
+				itchyparse.expect_first_seq = be64toh(
+				    ((struct itch_packet *)rec.data)->mold.seq_num);
 		}
-		if (memcmp(&first_dst_ep, &dst_ep, sizeof(dst_ep))) {
-			printf("%snew dst: ", src_changed ? " -> " : "");
-			ep_printf(&dst_ep);
-			dst_changed = 1;
+	}
+	if (build_index) {
+		itch_index_init(&index);
+		itchyparse.index = &index;
+	}
+	if (itchyparse.filter) {
+		err = pcap_out_open(&filter_out, itchyparse.out_fname);
+		if (err) {
+			errno = err;
+			printf("failed to create out pcap file, %m\n");
+			return err;
 		}
-		if (dst_changed || src_changed)
-			printf("\n");
-
-		if (rec_seq_num != cur_seq_num) {
-			printf("seq.err. expected:%llu recvd:%llu\n",
-				cur_seq_num, rec_seq_num);
-			if (edit_recs) {
-				new_seq_num = itchyparse.edit_first_seq;
-				if (rec_seq_num > first_seq_num)
-					new_seq_num += (rec_seq_num - first_seq_num);
-				else
-					new_seq_num -= (first_seq_num - rec_seq_num);
-			}
-			cur_seq_num = rec_seq_num; /* update expected */
-			seq_errors ++;
+		/* renumbered even if the first seq.num is the same */
+		edit.seq_nums = itchyparse.edit_recs;
+		itchyparse.filter_out = &filter_out;
+		itchyparse.filter_edit = &edit;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t_start);
+	err = EAGAIN;
+	if (itchyparse.num_threads > 1)
+		err = parse_chunks(&itchyparse, &map, from, to);
+	if (err == EAGAIN) {
+		pcap_iter_init_range(&iter, &map, from, to);
+		parse_recs(&itchyparse, &iter);
+	} else if (err) {
+		errno = err;
+		printf("failed to parse in chunks, %m\n");
+		return err;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t_end);
+	if (build_index) {
+		err = itch_index_write(&index, itchyparse.pcap_fname);
+		if (err) {
+			errno = err;
+			printf("failed to write index, %m\n");
+			return err;
 		}
-		cur_seq_num ++;
-
-		refn32 = (uint32_t)be64toh(itch_pkt.msg.common.ref_num);
-
-		switch (itch_pkt.msg.common.msg_type) {
-		case MSG_TYPE_ADD_ORDER_NO_MPID:
-			itchyparse.stat.orders ++;
-
-			err = dhash_add(&itchyparse.refn_dhash, refn32);
-			if (unlikely(err)) {
-				if (err == EEXIST)
-					assert(itchyparse.no_hash_del);
-				else if (err == ENOMEM)
-					itchyparse.stat.bucket_overflows++;
-				else {
-					assert(err == ENOSPC);
-					printf("refn hash table full\n");
-					exit(1);
-				}
-			}
-
-			if (!itchyparse.subscription.fname) {
-				itchyparse.unsubscr_orders ++;
-				break;
-			}
-
-			name32 = name4_to_u32(itch_pkt.msg.order.stock);
-			err = dhash_find(&itchyparse.subscr_name_dhash, name32);
-			if (!err) {/* this order is for a subscribed symbol */
-				itchyparse.stat.subscr_orders ++;
-				if (itchyparse.debug_mode) {
-					printf("%s refn:%u\n",
-					       itch_pkt.msg.order.stock,
-					       refn32);
-				}
-				/* store this order's ref num */
-				err = dhash_add(&itchyparse.subscr_refn_dhash,
-						refn32);
-				assert(!err || err == EEXIST);
-			} else {
-				assert(err == ENOENT);
-				itchyparse.unsubscr_orders ++;
-			}
-			break;
-		case MSG_TYPE_ORDER_EXECUTED:
-			itchyparse.stat.execs ++;
-			is_subscribed = refn_complete(&itchyparse, refn32);
-			if (is_subscribed)
-				itchyparse.stat.subscr_execs ++;
-			break;
-		case MSG_TYPE_ORDER_CANCEL:
-			itchyparse.stat.cancels ++;
-			is_subscribed = refn_complete(&itchyparse, refn32);
-			if (is_subscribed)
-				itchyparse.stat.subscr_cancels ++;
-			break;
-		case MSG_TYPE_ORDER_REPLACE:
-			itchyparse.stat.replaces ++;
-			is_subscribed = refn_complete(&itchyparse, refn32);
-			if (is_subscribed)
-				itchyparse.stat.subscr_replaces ++;
-			break;
-		case MSG_TYPE_TIMESTAMP:
-			itchyparse.stat.timestamps ++;
-			break;
-		default:
-			illegal_types ++;
-			break;
+		printf("\tindex: %s%s, seconds: %u, symbols: %u\n",
+		       itchyparse.pcap_fname, ITCH_INDEX_SUFFIX,
+		       index.hdr.num_secs, index.hdr.num_syms);
+		itch_index_cleanup(&index);
+	}
+	if (itchyparse.filter) {
+		err = pcap_out_close(&filter_out);
+		if (err) {
+			errno = err;
+			printf("failed to write out pcap file, %m\n");
+			return err;
 		}
-
-		if (edit_recs) {
-			itch_pkt.mold.seq_num = htobe64(new_seq_num);
-			new_seq_num ++; /* if recs are consequtive this value is used */
-			err = pcap_file_replace_last_record(&itch_pkt, pkt_len);
-			if (unlikely(err)) {
-				printf("failed to re-write pcap file, %m\n");
-				exit(err);
-			}
+		edited = filter_out.recs;
+	} else if (itchyparse.out_fname) {
+		edit.seq_nums = itchyparse.edit_recs;
+		edit.seq_delta = itchyparse.edit_first_seq -
+				 itchyparse.first_seq_num;
+		err = pcap_map_create(&out_map, itchyparse.out_fname, &map);
+		if (err) {
+			errno = err;
+			printf("failed to create out pcap file, %m\n");
+			return err;
 		}
+		edited = edit_recs(&itchyparse, &map, &out_map, &edit);
+		pcap_map_close(&out_map);
+	} else if (itchyparse.edit_recs || edit.retarget) {
+		edit.seq_nums = itchyparse.edit_recs;
+		edit.seq_delta = itchyparse.edit_first_seq -
+				 itchyparse.first_seq_num;
+		edited = edit_recs(&itchyparse, &map, NULL, &edit);
 	}
-	last_seq_num = rec_seq_num;
-
-	pcap_file_close();
+	pcap_map_close(&map);
 
 	printf("statistics:\n");
 	printf("\tseq.nums: %llu - %llu, seq.errors: %llu, "
-		"illegal msg.types: %u\n",
-		first_seq_num, last_seq_num, seq_errors, illegal_types);
-	if (edit_recs)
+		"illegal msg.types: %u, unknown ref.nums: %llu, "
+		"dup. ref.nums: %llu\n",
+		itchyparse.first_seq_num, itchyparse.rec_seq_num,
+		itchyparse.seq_errors, itchyparse.illegal_types,
+		itchyparse.unknown_refns, itchyparse.dup_refns);
+	if (itchyparse.filter && edit.seq_nums && edited)
 		printf("\tedited seq.nums: %llu - %llu\n",
-			itchyparse.edit_first_seq, new_seq_num - 1);
+			itchyparse.edit_first_seq,
+			itchyparse.edit_first_seq + edited - 1);
+	else if (itchyparse.edit_recs && !itchyparse.filter)
+		printf("\tedited seq.nums: %llu - %llu\n",
+			itchyparse.edit_first_seq, itchyparse.rec_seq_num +
+			(itchyparse.edit_first_seq - itchyparse.first_seq_num));
+	if (edit.retarget) {
+		ep_retarget(&itchyparse.first_src_ep, &itchyparse.edit_src);
+		ep_retarget(&itchyparse.first_dst_ep, &itchyparse.edit_dst);
+		printf("\tretargeted, first packet adresses:\n\t\t");
+		ep_printf(stdout, &itchyparse.first_src_ep);
+		printf(" -> ");
+		ep_printf(stdout, &itchyparse.first_dst_ep);
+		printf("\n");
+	}
+	if (itchyparse.filter)
+		printf("\tfiltered records: %llu\n", edited);
+	else if (edited)
+		printf("\tedited records: %llu\n", edited);
 
 	print_stats(&itchyparse.stat, &itchyparse.refn_dhash);
+	if (itchyparse.verbose_mode && itchyparse.symbols.num_symbols) {
+		unsigned int loc;
+
+		printf("subscribed symbols:\n");
+		for (loc = 0; loc < itchyparse.symbols.num_symbols; loc++)
+			printf("\t%-8s orders: %llu exec: %llu cancel: %llu "
+			       "replace: %llu\n", itchyparse.symbols.name[loc],
+			       itchyparse.symbol_stat[loc].orders,
+			       itchyparse.symbol_stat[loc].execs,
+			       itchyparse.symbol_stat[loc].cancels,
+			       itchyparse.symbol_stat[loc].replaces);
+		printf("\n");
+	}
+	if (itchyparse.book) {
+		unsigned int loc;
+
+		print_books(&itchyparse, (t_end.tv_sec - t_start.tv_sec) +
+			    (t_end.tv_nsec - t_start.tv_nsec) / 1e9);
+		for (loc = 0; loc < itchyparse.symbols.num_symbols; loc++)
+			order_book_cleanup(&itchyparse.book[loc]);
+		free(itchyparse.book);
+		free(itchyparse.book_snap);
+	}
 
 	dhash_cleanup(&itchyparse.refn_dhash);
 	if (itchyparse.pcap_fname)
 		free(itchyparse.pcap_fname);
+	if (itchyparse.out_fname)
+		free(itchyparse.out_fname);
 	if (itchyparse.subscription.fname) {
 		free(itchyparse.subscription.fname);
-		dhash_cleanup(&itchyparse.subscr_refn_dhash);
-		dhash_cleanup(&itchyparse.subscr_name_dhash);
+		symbol_table_cleanup(&itchyparse.symbols);
+		free(itchyparse.symbol_stat);
 	}
 
 	return 0;
@@ -29,6 +29,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <assert.h>
 #include <endian.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -39,12 +40,84 @@
 
 #include "itch_proto.h"
 #include "itchygen.h"
+#include "double_hash.h"
 #include "str_args.h"
 
 static char *prog_name;
 
 static unsigned int time_sec;
 
+/* with a subscription list only the listed symbols' orders are shown,
+ * their ref.nums are tracked along with the remaining shares */
+static struct symbols_file subscription;
+static struct symbol_table symbols;
+static struct dhash_table subscr_refn_dhash;
+static unsigned long long bucket_overflows;
+
+/* an order not kept is reported, its updates would be filtered out */
+static void subscr_refn_add(uint32_t refn32, uint32_t shares)
+{
+	int err;
+
+	err = dhash_map_add(&subscr_refn_dhash, refn32, &shares);
+	if (likely(!err))
+		return;
+
+	if (err == EEXIST) {
+		memcpy(dhash_map_find(&subscr_refn_dhash, refn32), &shares,
+		       sizeof(shares));
+	} else if (err == ENOMEM) {
+		bucket_overflows++;
+		printf("error: ref: %u not tracked, hash bucket overflows: %llu\n",
+		       refn32, bucket_overflows);
+	} else {
+		assert(err == ENOSPC);
+		printf("refn hash table full\n");
+		exit(1);
+	}
+}
+
+static int subscr_filter(struct itch_packet *pkt)
+{
+	uint32_t refn32, shares, *remain;
+
+	switch (pkt->msg.common.msg_type) {
+	case MSG_TYPE_ADD_ORDER_NO_MPID:
+		if (symbol_locate(&symbols, pkt->msg.order.stock) ==
+		    SYMBOL_LOCATE_NONE)
+			return 0;
+		refn32 = (uint32_t)be64toh(pkt->msg.order.ref_num);
+		shares = be32toh(pkt->msg.order.shares);
+		subscr_refn_add(refn32, shares);
+		return 1;
+	case MSG_TYPE_ORDER_EXECUTED:
+	case MSG_TYPE_ORDER_CANCEL:
+		refn32 = (uint32_t)be64toh(pkt->msg.common.ref_num);
+		remain = dhash_map_find(&subscr_refn_dhash, refn32);
+		if (!remain)
+			return 0;
+		if (pkt->msg.common.msg_type == MSG_TYPE_ORDER_EXECUTED)
+			shares = be32toh(pkt->msg.exec.shares);
+		else
+			shares = be32toh(pkt->msg.cancel.shares);
+		if (shares < *remain)
+			*remain -= shares;
+		else
+			dhash_map_del(&subscr_refn_dhash, refn32, NULL);
+		return 1;
+	case MSG_TYPE_ORDER_REPLACE:
+		refn32 = (uint32_t)be64toh(pkt->msg.replace.orig_ref_num);
+		if (dhash_map_del(&subscr_refn_dhash, refn32, NULL))
+			return 0;
+		refn32 = (uint32_t)be64toh(pkt->msg.replace.new_ref_num);
+		shares = be32toh(pkt->msg.replace.shares);
+		subscr_refn_add(refn32, shares);
+		return 1;
+	default:
+		return 1;
+	}
+}
+
 static void print_event_time(struct itch_msg_timestamp *evt)
 {
 	time_sec = be32toh(evt->second);
@@ -54,7 +127,7 @@ static void print_event_time(struct itch_msg_timestamp *evt)
 static void print_event_add(struct itch_msg_add_order_no_mpid *evt)
 {
 	printf("time: %d.%09d ADD ref: %" PRIu64
-	       " %s shares: %d %s price: %d\n", time_sec,
+	       " %.8s shares: %d %s price: %d\n", time_sec,
 	       be32toh(evt->timestamp_ns), be64toh(evt->ref_num), evt->stock,
 	       be32toh(evt->shares), str_buy_sell(evt->buy_sell),
 	       be32toh(evt->price));
@@ -83,13 +156,7 @@ static void print_event_replace(struct itch_msg_order_replace *evt)
 	       be32toh(evt->shares), be32toh(evt->price));
 }
 
-static char program_name[] = "itchyparse";
-
-void version(void)
-{
-	printf("%s\n", ITCHYGEN_VER_STR);
-	exit(0);
-}
+static char program_name[] = "itchyserv";
 
 void usage(int status, char *msg)
 {
@@ -102,6 +169,8 @@ void usage(int status, char *msg)
 	       "Usage: %s [OPTION]\n"
 	       "-a, --addr          listening ip addr (default: ANY)\n"
 	       "-p, --port          listening port (1024..65535)\n"
+	       "-L, --list-file     only show orders of the listed symbols\n"
+	       "    --cache-dir     keep the parsed list file cached in this dir\n"
 	       "-s, --strict        strict mode, exit on seq.num mismatch\n"
 	       "-q, --quiet         quiet mode, only print error msgs\n"
 	       "-d, --debug         produce debug information\n"
@@ -115,6 +184,8 @@ void usage(int status, char *msg)
 static struct option const long_options[] = {
 	{"addr", required_argument, 0, 'a'},
 	{"port", required_argument, 0, 'p'},
+	{"list-file", required_argument, 0, 'L'},
+	{"cache-dir", required_argument, 0, '4'},
 	{"strict", no_argument, 0, 's'},
 	{"quiet", no_argument, 0, 'q'},
 	{"debug", no_argument, 0, 'd'},
@@ -124,12 +195,12 @@ static struct option const long_options[] = {
 	{0, 0, 0, 0},
 };
 
-static char *short_options = "a:p:sqdvVh";
+static char *short_options = "a:p:L:4:sqdvVh";
 
 
 int main(int argc, char **argv)
 {
-	int ch, longindex, err;
+	int ch, longindex = 0, err;
 	const char *optname;
 	int sockfd, n;
 	struct sockaddr_in servaddr, cliaddr;
@@ -168,6 +239,14 @@ int main(int argc, char **argv)
 			if (err)
 				usage(bad_optarg(err, optname, optarg), NULL);
 			break;
+		case 'L':	/* subscription list file */
+			subscription.fname = strdup(optarg);
+			if (!subscription.fname)
+				exit(ENOMEM);
+			break;
+		case '4':
+			subscription.cache_dir = optarg;
+			break;
 		case 's':
 			strict_mode = 1;
 			break;
@@ -206,6 +285,34 @@ int main(int argc, char **argv)
 		debug_mode ? "yes" : "no",
 		verbose_mode ? "yes" : "no");
 
+	if (subscription.fname) {
+		struct symbols_file *sym_file = &subscription;
+		uint32_t poly[MAX_POLY];
+		int num_poly;
+
+		err = read_symbol_file(&subscription, 1);
+		if (err) {
+			printf("failed to read subscription list file\n");
+			exit(err);
+		}
+		printf("subscription file: %s, symbols: %u\n",
+		       subscription.fname, subscription.num_symbols);
+		err = symbol_table_init(&symbols, &sym_file, 1);
+		if (err) {
+			printf("failed to build symbol table\n");
+			exit(err);
+		}
+
+		num_poly = get_default_poly(poly, MAX_POLY);
+		err = dhash_map_init(&subscr_refn_dhash, CRC_WIDTH, poly,
+				     num_poly, sizeof(uint32_t));
+		if (err) {
+			errno = err;
+			printf("failed to init hash table, %m\n");
+			exit(err);
+		}
+	}
+
 	sockfd = socket(AF_INET, SOCK_DGRAM, 0);
 	if (socket < 0) {
 		printf("failed to open socket, %m\n");
@@ -239,8 +346,6 @@ int main(int argc, char **argv)
 			else
 				exit(EIO);
 		}
-		if (!quiet_mode)
-			printf("[%" PRIu64 "] ", seq_num);
 		seq_num++;
 
 		if (be16toh(pkt->mold.msg_cnt) != 1) {
@@ -265,6 +370,10 @@ int main(int argc, char **argv)
 			continue;
 		}
 
+		if (subscription.fname && !subscr_filter(pkt))
+			continue;
+		printf("[%" PRIu64 "] ", rec_seq_num);
+
 		switch (pkt->msg.common.msg_type) {
 		case MSG_TYPE_ADD_ORDER_NO_MPID:
 			print_event_add(&pkt->msg.order);
@@ -0,0 +1,632 @@
+/*
+ * File: itchysplit.c
+ * Summary: splits an ITCH PCAP file, generated by itchygen stream generator,
+ *          into per-channel files by the symbols of the msgs
+ *
+ * Copyright (c) 2014, Alexander Nezhinsky (nezhinsky@gmail.com)
+ * All rights reserved.
+ *
+ * Licensed under BSD-MIT :
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <assert.h>
+#include <endian.h>
+#include <getopt.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "itch_proto.h"
+#include "itchygen.h"
+#include "pcap.h"
+#include "double_hash.h"
+#include "str_args.h"
+
+static char program_name[] = "itchysplit";
+
+#define SPLIT_MAX_CHANNELS	64
+#define SPLIT_CHAN_ALL		0xff	/* timestamps, system events and
+					 * untracked msgs go to every channel */
+#define SPLIT_SESSION_NAME	"channel"
+
+/* the channel of an order, kept as the refn_dhash map value */
+struct split_order {
+	uint32_t shares;
+	uint8_t chan;
+};
+
+struct split_channel {
+	struct itchysplit_info *split;
+	unsigned int chan;
+	pthread_t thread;
+	char *fname;
+	struct pcap_out out;
+	struct endpoint_addr dst;	/* the fields set replace the record's */
+	char session[10];
+	unsigned long long msgs;	/* of its own symbols */
+	int err;
+};
+
+struct itchysplit_info {
+	char *pcap_fname;
+	char *out_fname;
+	struct pcap_map map;
+	unsigned int num_channels;
+	char (*bound)[ITCH_SYMBOL_LEN];	/* first symbol of channel n + 1 */
+	uint8_t *rec_chan;	/* per record, by the classifying pass */
+	size_t num_recs;
+	struct split_channel *channel;
+
+	uint32_t poly[MAX_POLY];
+	size_t num_poly;
+	struct dhash_table refn_dhash;
+
+	in_addr_t dst_ip;	/* of channel 0, the next ones follow */
+	int dst_port;
+	char session_name[9];
+	uint64_t first_seq;
+
+	unsigned long long timestamps;
+	unsigned long long other_types;	/* sent to all channels */
+	unsigned long long unknown_refns;
+	unsigned long long bucket_overflows;
+	int verbose_mode;
+};
+
+void usage(int status, char *msg)
+{
+	if (msg)
+		fprintf(stderr, "%s\n", msg);
+	if (status)
+		exit(status);
+
+	printf("ITCH PCAP file splitter, version %s\n\n"
+	       "Usage: %s [OPTION]\n"
+	       "-f, --file          PCAP file name\n"
+	       "-o, --out-file      per-channel PCAP file names, N-th is FILE.N.pcap\n"
+	       "-K, --channels      split into that many channels by symbol hash\n"
+	       "-R, --ranges        split by symbol ranges, first symbols of channels\n"
+	       "                    1, 2 ..., comma delimited and ascending\n"
+	       "-i, --dst-ip        destination IP address of channel 0, the next\n"
+	       "                    ones follow it; default: kept\n"
+	       "-p, --dst-port      destination port of channel 0, the next ones\n"
+	       "                    follow it; default: kept\n"
+	       "-S, --session       MoldUDP64 session name, up to 8 characters,\n"
+	       "                    channel number appended; default: %s\n"
+	       "-1, --first-seq     first seq.num of every channel, default: 1\n"
+	       "-v, --verbose       produce verbose output\n"
+	       "-V, --version       print version and exit\n"
+	       "-h, --help          display this help and exit\n",
+	       ITCHYGEN_VER_STR, program_name, SPLIT_SESSION_NAME);
+	exit(0);
+}
+
+static struct option const long_options[] = {
+	{"file", required_argument, 0, 'f'},
+	{"out-file", required_argument, 0, 'o'},
+	{"channels", required_argument, 0, 'K'},
+	{"ranges", required_argument, 0, 'R'},
+	{"dst-ip", required_argument, 0, 'i'},
+	{"dst-port", required_argument, 0, 'p'},
+	{"session", required_argument, 0, 'S'},
+	{"first-seq", required_argument, 0, '1'},
+	{"verbose", no_argument, 0, 'v'},
+	{"version", no_argument, 0, 'V'},
+	{"help", no_argument, 0, 'h'},
+	{0, 0, 0, 0},
+};
+
+static char *short_options = "f:o:K:R:i:p:S:1:vVh";
+
+/* stock fields are padded with spaces or with nuls, compared as the latter */
+static inline void stock_name(char *name, const char *stock)
+{
+	int i;
+
+	memcpy(name, stock, ITCH_SYMBOL_LEN);
+	for (i = ITCH_SYMBOL_LEN - 1; i >= 0 && (name[i] == ' ' || !name[i]); i--)
+		name[i] = 0;
+}
+
+static unsigned int stock_chan(struct itchysplit_info *split, const char *stock)
+{
+	unsigned int lo = 0, hi, mid;
+	char name[ITCH_SYMBOL_LEN];
+	uint64_t key;
+
+	stock_name(name, stock);
+	if (!split->bound) {
+		memcpy(&key, name, sizeof(key));
+		return (key * 0x9e3779b97f4a7c15ULL >> 32) % split->num_channels;
+	}
+	/* the number of bounds at or below the name */
+	hi = split->num_channels - 1;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (memcmp(split->bound[mid], name, ITCH_SYMBOL_LEN) <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void refn_add(struct itchysplit_info *split, uint32_t refn32,
+		     uint32_t shares, unsigned int chan)
+{
+	struct split_order order = {.shares = shares, .chan = chan};
+	int err;
+
+	err = dhash_map_add(&split->refn_dhash, refn32, &order);
+	if (likely(!err))
+		return;
+
+	if (err == EEXIST) {
+		memcpy(dhash_map_find(&split->refn_dhash, refn32), &order,
+		       sizeof(order));
+	} else if (err == ENOMEM) {
+		split->bucket_overflows++;
+	} else {
+		assert(err == ENOSPC);
+		printf("refn hash table full\n");
+		exit(1);
+	}
+}
+
+/* the channel of the order, 0 for an unknown one; when shares drop to 0
+ * or the order is gone the refn is removed */
+static unsigned int refn_update(struct itchysplit_info *split, uint32_t refn32,
+				uint32_t shares, int gone)
+{
+	struct split_order *order;
+	unsigned int chan;
+	int err;
+
+	order = dhash_map_find(&split->refn_dhash, refn32);
+	if (unlikely(!order)) {
+		split->unknown_refns++;
+		return 0;
+	}
+	chan = order->chan;
+	order->shares = shares < order->shares ? order->shares - shares : 0;
+	if (!order->shares || gone) {
+		err = dhash_map_del(&split->refn_dhash, refn32, NULL);
+		assert(!err);
+	}
+	return chan;
+}
+
+static unsigned int msg_chan(struct itchysplit_info *split,
+			     const struct pcap_rec *rec)
+{
+	struct itch_packet *pkt = rec->data;
+	unsigned int chan;
+
+	if (unlikely(rec->len <= sizeof(pkt->mold)))
+		return SPLIT_CHAN_ALL;
+
+	switch (pkt->msg.common.msg_type) {
+	case MSG_TYPE_TIMESTAMP:
+		split->timestamps++;
+		return SPLIT_CHAN_ALL;
+	case MSG_TYPE_SYSTEM_EVENT:
+		return SPLIT_CHAN_ALL;
+	case MSG_TYPE_STOCK_DIRECTORY:
+		return stock_chan(split, pkt->msg.dir.stock);
+	case MSG_TYPE_TRADING_ACTION:
+		return stock_chan(split, pkt->msg.trade.stock);
+	case MSG_TYPE_ADD_ORDER_NO_MPID:
+	case MSG_TYPE_ADD_ORDER_WITH_MPID:
+		chan = stock_chan(split, pkt->msg.order.stock);
+		refn_add(split, (uint32_t)be64toh(pkt->msg.order.ref_num),
+			 be32toh(pkt->msg.order.shares), chan);
+		return chan;
+	case MSG_TYPE_ORDER_EXECUTED:
+		return refn_update(split, (uint32_t)be64toh(pkt->msg.exec.ref_num),
+				   be32toh(pkt->msg.exec.shares), 0);
+	case MSG_TYPE_ORDER_CANCEL:
+		return refn_update(split,
+				   (uint32_t)be64toh(pkt->msg.cancel.ref_num),
+				   be32toh(pkt->msg.cancel.shares), 0);
+	case MSG_TYPE_ORDER_DELETE:
+		return refn_update(split, (uint32_t)be64toh(pkt->msg.del.ref_num),
+				   0, 1);
+	case MSG_TYPE_ORDER_REPLACE:
+		chan = refn_update(split,
+				   (uint32_t)be64toh(pkt->msg.replace.orig_ref_num),
+				   0, 1);
+		refn_add(split, (uint32_t)be64toh(pkt->msg.replace.new_ref_num),
+			 be32toh(pkt->msg.replace.shares), chan);
+		return chan;
+	default:
+		/* not tracked here, every channel keeps it */
+		split->other_types++;
+		return SPLIT_CHAN_ALL;
+	}
+}
+
+/* the channel of every record, in one pass: updates follow their orders */
+static int classify_recs(struct itchysplit_info *split)
+{
+	struct pcap_iter iter;
+	struct pcap_rec rec;
+	int err;
+
+	split->rec_chan = malloc(split->map.size / sizeof(struct pcap_headers) + 1);
+	if (!split->rec_chan)
+		return ENOMEM;
+	pcap_iter_init(&iter, &split->map);
+	while (!(err = pcap_iter_next(&iter, &rec)))
+		split->rec_chan[split->num_recs++] = msg_chan(split, &rec);
+	if (err != ENOENT)
+		printf("truncated record at offset %zu, stopped there\n",
+		       iter.pos);
+	return 0;
+}
+
+/* the record's destination, with the fields of the channel's set */
+static void channel_dst(const struct split_channel *ch, struct pcap_rec *rec,
+			struct endpoint_addr *dst)
+{
+	memset(dst, 0, sizeof(*dst));
+	pcap_rec_dst_ep(rec, dst);
+	if (ch->dst.mask & EP_ADDR_MAC_SET)
+		memcpy(dst->mac, ch->dst.mac, sizeof(dst->mac));
+	if (ch->dst.mask & EP_ADDR_IP_SET)
+		dst->ip_addr = ch->dst.ip_addr;
+	if (ch->dst.mask & EP_ADDR_PORT_SET)
+		dst->port = ch->dst.port;
+}
+
+/* each channel walks the whole file for the records that are its own,
+ * renumbered and sent to the channel's endpoint */
+static void *split_channel_run(void *arg)
+{
+	struct split_channel *ch = arg;
+	struct itchysplit_info *split = ch->split;
+	struct endpoint_addr dst, src;
+	struct pcap_iter iter;
+	struct pcap_rec rec, copy;
+	struct itch_packet *pkt;
+	uint64_t seq_num = split->first_seq;
+	size_t i;
+
+	pcap_iter_init(&iter, &split->map);
+	for (i = 0; i < split->num_recs && !pcap_iter_next(&iter, &rec); i++) {
+		if (split->rec_chan[i] != ch->chan &&
+		    split->rec_chan[i] != SPLIT_CHAN_ALL)
+			continue;
+		ch->err = pcap_out_add_copy(&ch->out, &rec, &copy);
+		if (unlikely(ch->err))
+			break;
+		if (split->rec_chan[i] == ch->chan)
+			ch->msgs++;
+
+		pkt = copy.data;
+		if (copy.len >= sizeof(pkt->mold)) {
+			memcpy(pkt->mold.session, ch->session,
+			       sizeof(pkt->mold.session));
+			pkt->mold.seq_num = htobe64(seq_num++);
+		}
+		channel_dst(ch, &copy, &dst);
+		memset(&src, 0, sizeof(src));
+		pcap_rec_src_ep(&copy, &src);
+		pcap_build_udp_hdrs(copy.udp, &dst, &src, copy.data, copy.len);
+	}
+	if (!ch->err)
+		ch->err = pcap_out_flush(&ch->out);
+	return NULL;
+}
+
+static int parse_ranges(struct itchysplit_info *split, const char *str)
+{
+	char *ranges, *sym, *saveptr;
+	unsigned int n = 0;
+
+	ranges = strdup(str);
+	split->bound = calloc(SPLIT_MAX_CHANNELS - 1, sizeof(*split->bound));
+	if (!ranges || !split->bound) {
+		free(ranges);
+		return ENOMEM;
+	}
+	for (sym = strtok_r(ranges, ",", &saveptr); sym;
+	     sym = strtok_r(NULL, ",", &saveptr)) {
+		if (strlen(sym) > ITCH_SYMBOL_LEN || n == SPLIT_MAX_CHANNELS - 1)
+			goto inval;
+		strncpy(split->bound[n], sym, ITCH_SYMBOL_LEN);
+		if (n && memcmp(split->bound[n - 1], split->bound[n],
+				ITCH_SYMBOL_LEN) >= 0)
+			goto inval;
+		n++;
+	}
+	if (!n)
+		goto inval;
+	free(ranges);
+	split->num_channels = n + 1;
+	return 0;
+inval:
+	free(ranges);
+	return EINVAL;
+}
+
+/* FILE.pcap or FILE makes FILE.N.pcap */
+static char *channel_fname(const char *out_fname, unsigned int chan)
+{
+	size_t len = strlen(out_fname);
+	char *fname;
+
+	if (len > 5 && !strcmp(out_fname + len - 5, ".pcap"))
+		len -= 5;
+	fname = malloc(len + 16);
+	if (fname)
+		sprintf(fname, "%.*s.%u.pcap", (int)len, out_fname, chan);
+	return fname;
+}
+
+static int channel_init(struct itchysplit_info *split, unsigned int chan)
+{
+	struct split_channel *ch = &split->channel[chan];
+	char session[sizeof(ch->session) + 1];
+	in_addr_t ip;
+	uint8_t mac[8] = {0x01, 0x00, 0x5e};
+
+	ch->split = split;
+	ch->chan = chan;
+	ch->fname = channel_fname(split->out_fname, chan);
+	if (!ch->fname)
+		return ENOMEM;
+
+	if (split->dst_ip != INADDR_NONE) {
+		ip = ntohl(split->dst_ip) + chan;
+		ep_addr_set_ip(&ch->dst, htonl(ip));
+		/* a multicast group goes with its own MAC address */
+		if (IN_MULTICAST(ip)) {
+			mac[3] = (ip >> 16) & 0x7f;
+			mac[4] = ip >> 8;
+			mac[5] = ip;
+			ep_addr_set_mac(&ch->dst, mac);
+		}
+	}
+	if (split->dst_port) {
+		if (split->dst_port + chan > 65535)
+			return ERANGE;
+		ep_addr_set_port(&ch->dst, split->dst_port + chan);
+	}
+	/* padded with spaces, as MoldUDP64 alphanumerics are */
+	snprintf(session, sizeof(session), "%s%02u", split->session_name, chan);
+	memset(ch->session, ' ', sizeof(ch->session));
+	memcpy(ch->session, session, strlen(session));
+
+	return pcap_out_open(&ch->out, ch->fname);
+}
+
+static void ep_printf(FILE *out, struct endpoint_addr *ep)
+{
+	char ip_str[32];
+	fprintf(out, "[%02x:%02x:%02x:%02x:%02x:%02x] %s:%d",
+		ep->mac[0], ep->mac[1], ep->mac[2],
+		ep->mac[3], ep->mac[4], ep->mac[5],
+		inet_ntop(AF_INET, &ep->ip_addr, ip_str, 32),
+		(uint32_t) ep->port);
+}
+
+int main(int argc, char **argv)
+{
+	struct itchysplit_info split;
+	struct split_channel *ch;
+	struct pcap_iter iter;
+	struct pcap_rec rec;
+	struct endpoint_addr dst;
+	struct timespec t_start, t_split, t_end;
+	unsigned int chan;
+	int ch_opt, longindex = 0, err;
+	const char *optname;
+
+	if (argc < 2)
+		usage(0, NULL);
+
+	memset(&split, 0, sizeof(split));
+	split.dst_ip = INADDR_NONE;
+	split.first_seq = 1;
+	strcpy(split.session_name, SPLIT_SESSION_NAME);
+	split.num_poly = get_default_poly(split.poly, MAX_POLY);
+
+	opterr = 0;		/* global getopt variable */
+	for (;;) {
+		ch_opt = getopt_long(argc, argv, short_options,
+				     long_options, &longindex);
+		if (ch_opt < 0)
+			break;
+
+		optname = long_options[longindex].name;
+
+		switch (ch_opt) {
+		case 'f':
+			split.pcap_fname = strdup(optarg);
+			if (!split.pcap_fname) {
+				printf("failed to alloc mem for pcap file name\n");
+				exit(ENOMEM);
+			}
+			break;
+		case 'o':
+			split.out_fname = strdup(optarg);
+			if (!split.out_fname) {
+				printf("failed to alloc mem for out file name\n");
+				exit(ENOMEM);
+			}
+			break;
+		case 'K':
+			if (split.bound)
+				usage(EINVAL, "either --channels or --ranges");
+			err = str_to_int_range(optarg, split.num_channels, 1,
+					       SPLIT_MAX_CHANNELS, 10);
+			if (err)
+				usage(bad_optarg(err, optname, optarg), NULL);
+			break;
+		case 'R':
+			if (split.num_channels)
+				usage(EINVAL, "either --channels or --ranges");
+			err = parse_ranges(&split, optarg);
+			if (err)
+				usage(bad_optarg(err, optname, optarg), NULL);
+			break;
+		case 'i':	/* dst ip addr */
+			split.dst_ip = inet_addr(optarg);
+			if (split.dst_ip == INADDR_NONE)
+				usage(bad_optarg(EINVAL, optname, optarg), NULL);
+			break;
+		case 'p':	/* dst port */
+			err = str_to_int_range(optarg, split.dst_port,
+					       1024, 65535, 10);
+			if (err)
+				usage(bad_optarg(err, optname, optarg), NULL);
+			break;
+		case 'S':
+			if (!*optarg || strlen(optarg) > 8)
+				usage(bad_optarg(EINVAL, optname, optarg), NULL);
+			strcpy(split.session_name, optarg);
+			break;
+		case '1':
+			err = str_to_int_ge(optarg, split.first_seq, 0);
+			if (err)
+				usage(bad_optarg(err, optname, optarg), NULL);
+			break;
+		case 'v':
+			split.verbose_mode = 1;
+			break;
+		case 'V':
+			version();
+			break;
+		case 'h':
+			usage(0, NULL);
+			break;
+		default:
+			if (optind == 1)
+				optind++;
+			printf("don't understand: %s\n", argv[optind - 1]);
+			usage(EINVAL, "error: unsupported arguments");
+			break;
+		}
+	}
+	if (!split.pcap_fname)
+		usage(EINVAL, "pcap file name not supplied");
+	if (!split.out_fname)
+		usage(EINVAL, "out pcap file name not supplied");
+	if (!split.num_channels)
+		usage(EINVAL, "either --channels or --ranges required");
+
+	err = dhash_map_init(&split.refn_dhash, CRC_WIDTH,
+			     split.poly, split.num_poly,
+			     sizeof(struct split_order));
+	if (err) {
+		errno = err;
+		printf("failed to init hash table, %m\n");
+		return err;
+	}
+	err = pcap_map_open(&split.map, split.pcap_fname, 0);
+	if (err) {
+		errno = err;
+		printf("failed to open pcap file, %m\n");
+		return err;
+	}
+	split.channel = calloc(split.num_channels, sizeof(*split.channel));
+	if (!split.channel) {
+		printf("failed to alloc channels\n");
+		return ENOMEM;
+	}
+	for (chan = 0; chan < split.num_channels; chan++) {
+		err = channel_init(&split, chan);
+		if (err) {
+			errno = err;
+			printf("failed to create channel %u pcap file, %m\n",
+			       chan);
+			return err;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t_start);
+	err = classify_recs(&split);
+	if (err) {
+		errno = err;
+		printf("failed to split records, %m\n");
+		return err;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t_split);
+	for (chan = 0; chan < split.num_channels; chan++) {
+		ch = &split.channel[chan];
+		err = pthread_create(&ch->thread, NULL, split_channel_run, ch);
+		if (err) {
+			errno = err;
+			printf("failed to create channel thread, %m\n");
+			return err;
+		}
+	}
+	for (chan = 0; chan < split.num_channels; chan++)
+		pthread_join(split.channel[chan].thread, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &t_end);
+
+	printf("statistics:\n");
+	printf("\trecords: %zu, timestamps: %llu, other msg.types: %llu, "
+	       "unknown ref.nums: %llu, bucket overflows: %llu\n",
+	       split.num_recs, split.timestamps, split.other_types,
+	       split.unknown_refns, split.bucket_overflows);
+	printf("\ttime: split %.3f sec, write %.3f sec\n",
+	       (t_split.tv_sec - t_start.tv_sec) +
+	       (t_split.tv_nsec - t_start.tv_nsec) / 1e9,
+	       (t_end.tv_sec - t_split.tv_sec) +
+	       (t_end.tv_nsec - t_split.tv_nsec) / 1e9);
+	for (chan = 0; chan < split.num_channels; chan++) {
+		ch = &split.channel[chan];
+		err = ch->err;
+		if (!err)
+			err = pcap_out_close(&ch->out);
+		if (err) {
+			errno = err;
+			printf("failed to write out %s, %m\n", ch->fname);
+			return err;
+		}
+		printf("\t%s: session: %.10s, records: %llu, msgs: %llu\n",
+		       ch->fname, ch->session, ch->out.recs, ch->msgs);
+		/* that of the first record, as written */
+		pcap_iter_init(&iter, &split.map);
+		if (split.verbose_mode && !pcap_iter_next(&iter, &rec)) {
+			channel_dst(ch, &rec, &dst);
+			printf("\t\tdestination: ");
+			ep_printf(stdout, &dst);
+			printf("\n");
+		}
+		free(ch->fname);
+	}
+
+	pcap_map_close(&split.map);
+	dhash_cleanup(&split.refn_dhash);
+	free(split.rec_chan);
+	free(split.channel);
+	free(split.bound);
+	free(split.pcap_fname);
+	free(split.out_fname);
+	return 0;
+}
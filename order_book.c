@@ -0,0 +1,150 @@
+/*
+ * File:   order_book.c
+ * Summary: per-symbol limit order book
+ *
+ * A side is a sorted array of price levels. Bids ascend and asks descend,
+ * so either way the best level is at the end: a level is found by binary
+ * search, and adding or removing one only moves the levels better than it.
+ *
+ * Author: Alexander Nezhinsky (nezhinsky@gmail.com)
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "order_book.h"
+
+#define BOOK_SIDE_MIN_LEVELS	64
+
+/* a level ordering key ascending on both sides, worst first */
+static inline uint32_t level_key(int side, uint32_t price)
+{
+	return side == BOOK_BID ? price : ~price;
+}
+
+/* index of the level with price, or where it would be inserted */
+static unsigned int book_side_find(struct book_side *s, int side,
+				   uint32_t price, int *found)
+{
+	uint32_t key = level_key(side, price), k;
+	unsigned int lo = 0, hi = s->num, mid;
+
+	/* the top is the likely spot */
+	if (hi && s->level[hi - 1].price == price) {
+		*found = 1;
+		return hi - 1;
+	}
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		k = level_key(side, s->level[mid].price);
+		if (k < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	*found = lo < s->num && s->level[lo].price == price;
+	return lo;
+}
+
+static int book_side_grow(struct book_side *s)
+{
+	unsigned int size = s->size ? 2 * s->size : BOOK_SIDE_MIN_LEVELS;
+	struct book_level *level;
+
+	level = realloc(s->level, size * sizeof(*level));
+	if (!level)
+		return ENOMEM;
+	s->level = level;
+	s->size = size;
+	return 0;
+}
+
+static inline int book_is_crossed(struct order_book *book)
+{
+	const struct book_level *bid = order_book_best(book, BOOK_BID);
+	const struct book_level *ask = order_book_best(book, BOOK_ASK);
+
+	return bid && ask && bid->price >= ask->price;
+}
+
+void order_book_init(struct order_book *book)
+{
+	memset(book, 0, sizeof(*book));
+}
+
+void order_book_cleanup(struct order_book *book)
+{
+	free(book->side[BOOK_BID].level);
+	free(book->side[BOOK_ASK].level);
+	memset(book, 0, sizeof(*book));
+}
+
+int order_book_add(struct order_book *book, int side,
+		   uint32_t price, uint32_t shares)
+{
+	struct book_side *s = &book->side[side];
+	struct book_level *level;
+	unsigned int i;
+	int found;
+
+	i = book_side_find(s, side, price, &found);
+	if (!found) {
+		if (s->num == s->size && book_side_grow(s))
+			return ENOMEM;
+		memmove(&s->level[i + 1], &s->level[i],
+			(s->num - i) * sizeof(*s->level));
+		level = &s->level[i];
+		level->price = price;
+		level->orders = 0;
+		level->shares = 0;
+		if (++s->num > s->max_num)
+			s->max_num = s->num;
+	}
+	level = &s->level[i];
+	level->orders++;
+	level->shares += shares;
+
+	if (i == s->num - 1) {
+		book->top_changes++;
+		if (book_is_crossed(book))
+			book->crossed++;
+	}
+	return 0;
+}
+
+int order_book_reduce(struct order_book *book, int side,
+		      uint32_t price, uint32_t shares, int gone)
+{
+	struct book_side *s = &book->side[side];
+	struct book_level *level;
+	unsigned int i;
+	int found, top;
+
+	i = book_side_find(s, side, price, &found);
+	if (!found) {
+		book->errors++;
+		return ENOENT;
+	}
+	level = &s->level[i];
+	if (level->shares < shares) {
+		book->errors++;
+		shares = level->shares;
+	}
+	level->shares -= shares;
+	if (gone)
+		level->orders--;
+
+	top = i == s->num - 1;
+	if (!level->orders) {
+		memmove(&s->level[i], &s->level[i + 1],
+			(s->num - i - 1) * sizeof(*s->level));
+		s->num--;
+	}
+	if (top) {
+		book->top_changes++;
+		if (book_is_crossed(book))
+			book->crossed++;
+	}
+	return 0;
+}
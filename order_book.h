@@ -0,0 +1,66 @@
+/*
+ * File:   order_book.h
+ * Summary: per-symbol limit order book, price levels with aggregated size
+ * Author: Alexander Nezhinsky (nezhinsky@gmail.com)
+ */
+
+#ifndef ORDER_BOOK_H
+#define	ORDER_BOOK_H
+
+#include <stdint.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define BOOK_BID	0
+#define BOOK_ASK	1
+
+/* orders resting at one price */
+	struct book_level {
+		uint32_t price;
+		uint32_t orders;
+		unsigned long long shares;
+	};
+
+/* levels kept sorted worst first, so the best one is the last: orders
+ * come and go mostly near the top, where the shifting is the shortest */
+	struct book_side {
+		struct book_level *level;
+		unsigned int num;
+		unsigned int size;
+		unsigned int max_num;	/* depth all-times-max */
+	};
+
+	struct order_book {
+		struct book_side side[2];	/* BOOK_BID, BOOK_ASK */
+		unsigned long long top_changes;	/* best price or its size */
+		unsigned long long crossed;	/* updates leaving bid >= ask */
+		unsigned long long errors;	/* missing level, excess shares */
+	};
+
+	void order_book_init(struct order_book *book);
+	void order_book_cleanup(struct order_book *book);
+
+/* an order of shares rests at price; returns 0 or ENOMEM */
+	int order_book_add(struct order_book *book, int side,
+			   uint32_t price, uint32_t shares);
+
+/* shares of an order at price are gone, the order itself too if gone;
+ * returns 0, ENOENT if there is no such level (counted as an error) */
+	int order_book_reduce(struct order_book *book, int side,
+			      uint32_t price, uint32_t shares, int gone);
+
+/* best level of the side, NULL when empty */
+	static inline const struct book_level *
+	order_book_best(const struct order_book *book, int side)
+	{
+		const struct book_side *s = &book->side[side];
+
+		return s->num ? &s->level[s->num - 1] : NULL;
+	}
+
+#ifdef	__cplusplus
+}
+#endif
+#endif				/* ORDER_BOOK_H */
@@ -31,6 +31,10 @@
 #include <string.h>
 #include <errno.h>
 #include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <netinet/in.h>
 #include <netinet/if_ether.h>
 #include <netinet/ip.h>
@@ -42,12 +46,6 @@
 #define likely(x)	__builtin_expect(!!(x), 1)
 #define unlikely(x)	__builtin_expect((x), 0)
 
-struct udp_hdrs {
-	struct ether_header ether;
-	struct iphdr ip;
-	struct udphdr udp;
-} __attribute__ ((packed));
-
 struct ipv4_pseudo_hdr {
 	uint32_t saddr;
 	uint32_t daddr;
@@ -78,31 +76,22 @@ void pcap_file_close(void)
 	}
 }
 
-static int pcap_file_add_global_hdr(void)
-{
-	struct pcap_global_hdr ghdr = {
-		.magic_number = PCAP_MAGIC_ORIG,
-		.version_major = PCAP_VER_MAJOR,
-		.version_minor = PCAP_VER_MINOR,
-		.thiszone = 0,
-		.sigfigs = 0,
-		.snaplen = PCAP_SNAP_LEN,
-		.network = PCAP_NET_ETH,
-	};
-	size_t n = fwrite(&ghdr, sizeof(ghdr), 1, fpcap);
-	if (unlikely(n != 1))
-		return pcap_err();
-	offset += sizeof(ghdr);
-	return 0;
-}
+static const struct pcap_global_hdr pcap_ghdr = {
+	.magic_number = PCAP_MAGIC_ORIG,
+	.version_major = PCAP_VER_MAJOR,
+	.version_minor = PCAP_VER_MINOR,
+	.thiszone = 0,
+	.sigfigs = 0,
+	.snaplen = PCAP_SNAP_LEN,
+	.network = PCAP_NET_ETH,
+};
 
-static int pcap_file_skip_global_hdr(void)
+static int pcap_file_add_global_hdr(void)
 {
-	struct pcap_global_hdr glob_hdr;
-	size_t n = fread(&glob_hdr, sizeof(glob_hdr), 1, fpcap);
+	size_t n = fwrite(&pcap_ghdr, sizeof(pcap_ghdr), 1, fpcap);
 	if (unlikely(n != 1))
 		return pcap_err();
-	offset += sizeof(glob_hdr);
+	offset += sizeof(pcap_ghdr);
 	return 0;
 }
 
@@ -133,23 +122,14 @@ void pcap_file_set_wr_endpoints(struct endpoint_addr *dst,
 	_src = *src;
 }
 
-int pcap_file_open_rd(char *fname)
-{
-	fpcap = fopen(fname, "r+");
-	if (!fpcap)
-		return errno;
-	fseek(fpcap, (offset = 0l), SEEK_SET);
-	return pcap_file_skip_global_hdr();
-}
-
-static uint32_t ip_checksum_step(uint32_t init_sum, void *buf, size_t size)
+static uint32_t ip_checksum_step(uint32_t init_sum, const void *buf, size_t size)
 {
 	uint32_t sum = init_sum;
-	uint16_t *b = buf;
+	const uint16_t *b = buf;
 
 	/* sum all 16-bit words in one's complement, pad if necessary */
 	if (size & 1) {
-		sum += ((uint8_t *) b)[size - 1];
+		sum += ((const uint8_t *) b)[size - 1];
 		size--;		/* used only one byte tail, equivalent to padding */
 	}
 	for (size >>= 1; size > 0; size--)
@@ -171,13 +151,15 @@ static uint16_t ip_checksum_final(uint32_t sum)
 #define IPTOS_CLASS_CS0 0x0
 #endif
 
-static void create_udp_packet(struct udp_hdrs *h, void *data, size_t len)
+void pcap_build_udp_hdrs(struct udp_hdrs *h, const struct endpoint_addr *dst,
+			 const struct endpoint_addr *src,
+			 const void *data, size_t len)
 {
 	struct ipv4_pseudo_hdr pseudo_iphdr;
 	uint32_t udp_sum;
 
-	memcpy(h->ether.ether_dhost, _dst.mac, ETH_ALEN);
-	memcpy(h->ether.ether_shost, _src.mac, ETH_ALEN);
+	memcpy(h->ether.ether_dhost, dst->mac, ETH_ALEN);
+	memcpy(h->ether.ether_shost, src->mac, ETH_ALEN);
 	h->ether.ether_type = htons(ETHERTYPE_IP);
 
 	h->ip.ihl = sizeof(h->ip) / sizeof(uint32_t);
@@ -189,21 +171,21 @@ static void create_udp_packet(struct udp_hdrs *h, void *data, size_t len)
 	h->ip.frag_off = htons(IP_DF);	/* flags:3 = Don't Frag, frag offset:13 = 0 */
 	h->ip.ttl = 64;
 	h->ip.protocol = IPPROTO_UDP;
-	h->ip.saddr = _src.ip_addr;
-	h->ip.daddr = _dst.ip_addr;
+	h->ip.saddr = src->ip_addr;
+	h->ip.daddr = dst->ip_addr;
 	h->ip.check = 0;
 	h->ip.check =
 	    ip_checksum_final(ip_checksum_step(0, &h->ip, sizeof(h->ip)));
 
-	pseudo_iphdr.saddr = _src.ip_addr;
-	pseudo_iphdr.daddr = _dst.ip_addr;
+	pseudo_iphdr.saddr = src->ip_addr;
+	pseudo_iphdr.daddr = dst->ip_addr;
 	pseudo_iphdr.zero = 0;
 	pseudo_iphdr.proto = 0x11;
 	pseudo_iphdr.udp_len = htons(sizeof(h->udp) + len);
 	udp_sum = ip_checksum_step(0, &pseudo_iphdr, sizeof(pseudo_iphdr));
 
-	h->udp.source = htons(_src.port);
-	h->udp.dest = htons(_dst.port);
+	h->udp.source = htons(src->port);
+	h->udp.dest = htons(dst->port);
 	/* UDP header + datalen */
 	h->udp.len = htons(sizeof(h->udp) + len);
 	h->udp.check = 0;	/* udp checksum */
@@ -213,11 +195,6 @@ static void create_udp_packet(struct udp_hdrs *h, void *data, size_t len)
 	h->udp.check = ip_checksum_final(udp_sum);
 }
 
-struct pcap_headers {
-	struct pcap_record_hdr pcap_rec;
-	struct udp_hdrs udp;
-} __attribute__ ((packed));
-
 int pcap_file_add_record(unsigned int tsec, unsigned int tusec,
 			 void *data, size_t len)
 {
@@ -231,7 +208,7 @@ int pcap_file_add_record(unsigned int tsec, unsigned int tusec,
 	};
 	size_t n;
 
-	create_udp_packet(&hdrs.udp, data, len);
+	pcap_build_udp_hdrs(&hdrs.udp, &_dst, &_src, data, len);
 
 	n = fwrite(&hdrs, sizeof(hdrs), 1, fpcap);
 	if (unlikely(n != 1))
@@ -262,68 +239,399 @@ static inline void set_src_ep_from_hdrs(struct endpoint_addr *ep,
 	ep_addr_set_port(ep, ntohs(hdrs->udp.source));
 }
 
-int pcap_file_read_record(void *data, size_t max_len, size_t *rec_len,
-	struct endpoint_addr *dst_ep, struct endpoint_addr *src_ep)
+/* endpoints as the headers of a record read them */
+void pcap_rec_dst_ep(struct pcap_rec *rec, struct endpoint_addr *ep)
 {
-	struct pcap_headers hdrs;
-	size_t n, len;
+	set_dst_ep_from_hdrs(ep, rec->udp);
+}
 
-	n = fread(&hdrs, sizeof(hdrs), 1, fpcap);
-	if (unlikely(n != 1))
-		return pcap_err();
-	offset += sizeof(hdrs);
+void pcap_rec_src_ep(struct pcap_rec *rec, struct endpoint_addr *ep)
+{
+	set_src_ep_from_hdrs(ep, rec->udp);
+}
 
-	if (dst_ep)
-		set_dst_ep_from_hdrs(dst_ep, &hdrs.udp);
-	if (src_ep)
-		set_src_ep_from_hdrs(src_ep, &hdrs.udp);
+/* a field of len bytes changed from old to new: addresses are summed in
+ * the IP header and, through the pseudo header, in the UDP one; ports in
+ * the UDP one alone. A UDP checksum of 0 is adjusted as any other, the
+ * writer leaves it so when that is what it sums to. */
+static void rec_adjust_checks(struct udp_hdrs *h, const void *old,
+			      const void *new, size_t len, int in_ip_hdr)
+{
+	if (in_ip_hdr)
+		h->ip.check = ip_checksum_adjust(h->ip.check, old, new, len);
+	h->udp.check = ip_checksum_adjust(h->udp.check, old, new, len);
+}
 
-	len = hdrs.pcap_rec.incl_len - sizeof(struct udp_hdrs);
-	*rec_len = len;
-	if (len > max_len)
-		len = max_len;
+/* the endpoint fields set in dst and src are written to the record's
+ * headers, the checksums adjusted for the changed words alone */
+void pcap_rec_retarget(struct pcap_rec *rec, const struct endpoint_addr *dst,
+		       const struct endpoint_addr *src)
+{
+	struct udp_hdrs *h = rec->udp;
+	uint32_t addr;
+	uint16_t port, new_port;
+
+	if (dst->mask & EP_ADDR_MAC_SET)
+		memcpy(h->ether.ether_dhost, dst->mac, ETH_ALEN);
+	if (src->mask & EP_ADDR_MAC_SET)
+		memcpy(h->ether.ether_shost, src->mac, ETH_ALEN);
+	if (dst->mask & EP_ADDR_IP_SET) {
+		addr = h->ip.daddr;
+		rec_adjust_checks(h, &addr, &dst->ip_addr, sizeof(addr), 1);
+		h->ip.daddr = dst->ip_addr;
+	}
+	if (src->mask & EP_ADDR_IP_SET) {
+		addr = h->ip.saddr;
+		rec_adjust_checks(h, &addr, &src->ip_addr, sizeof(addr), 1);
+		h->ip.saddr = src->ip_addr;
+	}
+	if (dst->mask & EP_ADDR_PORT_SET) {
+		port = h->udp.dest;
+		new_port = htons(dst->port);
+		rec_adjust_checks(h, &port, &new_port, sizeof(port), 0);
+		h->udp.dest = new_port;
+	}
+	if (src->mask & EP_ADDR_PORT_SET) {
+		port = h->udp.source;
+		new_port = htons(src->port);
+		rec_adjust_checks(h, &port, &new_port, sizeof(port), 0);
+		h->udp.source = new_port;
+	}
+}
 
-	n = fread(data, len, 1, fpcap);
-	if (unlikely(n != 1))
-		return pcap_err();
-	offset += len;
+int pcap_map_open(struct pcap_map *map, const char *fname, int writable)
+{
+	struct pcap_global_hdr *ghdr;
+	struct stat st;
+	uint8_t *base;
+	int prot = PROT_READ | (writable ? PROT_WRITE : 0);
+	int err;
 
-	fseek(fpcap, 0, SEEK_CUR); /* just make sure */
+	memset(map, 0, sizeof(*map));
+	map->fd = open(fname, writable ? O_RDWR : O_RDONLY);
+	if (map->fd < 0)
+		return errno;
+	if (fstat(map->fd, &st)) {
+		err = errno;
+		goto close_fd;
+	}
+	if ((size_t)st.st_size < sizeof(*ghdr)) {
+		err = EINVAL;
+		goto close_fd;
+	}
+	map->size = st.st_size;
+	map->writable = writable;
+
+	/* reserve the slack along, then lay the file over its start */
+	base = mmap(NULL, map->size + PCAP_MAP_SLACK, PROT_READ,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED) {
+		err = errno;
+		goto close_fd;
+	}
+	map->base = mmap(base, map->size, prot,
+			 (writable ? MAP_SHARED : MAP_PRIVATE) | MAP_FIXED,
+			 map->fd, 0);
+	if (map->base == MAP_FAILED) {
+		err = errno;
+		munmap(base, map->size + PCAP_MAP_SLACK);
+		goto close_fd;
+	}
+	madvise(map->base, map->size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+	madvise(map->base, map->size, MADV_HUGEPAGE);	/* a hint, may fail */
+#endif
+
+	ghdr = (struct pcap_global_hdr *)map->base;
+	if (ghdr->magic_number != PCAP_MAGIC_ORIG) {
+		pcap_map_close(map);
+		return EINVAL;
+	}
 	return 0;
+
+close_fd:
+	close(map->fd);
+	map->fd = -1;
+	return err;
 }
 
-int pcap_file_replace_last_record(void *data, size_t rec_len)
+/* a new file as large as like, its global header copied, mapped for
+ * writing the rest */
+int pcap_map_create(struct pcap_map *map, const char *fname,
+		    const struct pcap_map *like)
 {
-	struct pcap_headers hdrs;
-	size_t n;
-	int err;
+	int fd, err = 0;
 
-	offset -= rec_len + sizeof(hdrs);
-	err = fseek(fpcap, offset, SEEK_SET);
-	if (unlikely(err))
+	fd = open(fname, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return errno;
+	if (ftruncate(fd, like->size) ||
+	    pwrite(fd, like->base, sizeof(struct pcap_global_hdr), 0) !=
+	    sizeof(struct pcap_global_hdr))
+		err = errno ? errno : EIO;
+	close(fd);
+	if (err)
 		return err;
+	return pcap_map_open(map, fname, 1);
+}
 
-	n = fread(&hdrs, sizeof(hdrs), 1, fpcap);
-	if (unlikely(n != 1))
-		return pcap_err();
+void pcap_map_close(struct pcap_map *map)
+{
+	if (map->base) {
+		if (map->writable)
+			msync(map->base, map->size, MS_SYNC);
+		munmap(map->base, map->size + PCAP_MAP_SLACK);
+		map->base = NULL;
+	}
+	if (map->fd >= 0) {
+		close(map->fd);
+		map->fd = -1;
+	}
+}
 
-	memset(&hdrs.udp, 0, sizeof(hdrs.udp));
-	create_udp_packet(&hdrs.udp, data, rec_len);
+/* the length of the record at pos if its headers look right, 0 if not */
+static size_t pcap_rec_check(struct pcap_map *map, size_t pos)
+{
+	struct pcap_headers *hdrs;
+	size_t incl_len;
+
+	if (map->size - pos < sizeof(*hdrs))
+		return 0;
+	hdrs = (struct pcap_headers *)(map->base + pos);
+	incl_len = hdrs->pcap_rec.incl_len;
+	if (incl_len != hdrs->pcap_rec.orig_len ||
+	    incl_len < sizeof(hdrs->udp) || incl_len > PCAP_SNAP_LEN ||
+	    incl_len > map->size - pos - sizeof(hdrs->pcap_rec) ||
+	    hdrs->pcap_rec.ts_usec >= 1000000)
+		return 0;
+	if (hdrs->udp.ether.ether_type != htons(ETHERTYPE_IP) ||
+	    hdrs->udp.ip.version != 4 ||
+	    hdrs->udp.ip.ihl != sizeof(hdrs->udp.ip) / sizeof(uint32_t) ||
+	    hdrs->udp.ip.protocol != IPPROTO_UDP ||
+	    ntohs(hdrs->udp.ip.tot_len) !=
+	    incl_len - sizeof(hdrs->udp.ether) ||
+	    ntohs(hdrs->udp.udp.len) !=
+	    incl_len - sizeof(hdrs->udp.ether) - sizeof(hdrs->udp.ip))
+		return 0;
+	return sizeof(hdrs->pcap_rec) + incl_len;
+}
 
-	/* rewind, then write back */
-	err = fseek(fpcap, offset, SEEK_SET);
-	if (unlikely(err))
-		return err;
-	n = fwrite(&hdrs, sizeof(hdrs), 1, fpcap);
-	if (unlikely(n != 1))
-		return pcap_err();
-	offset += sizeof(hdrs);
+size_t pcap_map_resync(struct pcap_map *map, size_t off)
+{
+	size_t pos, next, len;
+	int n;
+
+	if (off < sizeof(struct pcap_global_hdr))
+		off = sizeof(struct pcap_global_hdr);
+	for (pos = off; pos < map->size; pos++) {
+		next = pos;
+		for (n = 0; n <= PCAP_SYNC_RECS && next < map->size; n++) {
+			len = pcap_rec_check(map, next);
+			if (!len)
+				break;
+			next += len;
+		}
+		if (n > PCAP_SYNC_RECS || next == map->size)
+			return pos;
+	}
+	return map->size;
+}
 
-	n = fwrite(data, rec_len, 1, fpcap);
-	if (unlikely(n != 1))
-		return pcap_err();
-	offset += rec_len;
+int pcap_reader_open(struct pcap_reader *rd, const char *fname,
+		     size_t buf_size)
+{
+	struct pcap_global_hdr *ghdr;
+	int err;
+
+	memset(rd, 0, sizeof(*rd));
+	rd->buf_size = buf_size > PCAP_SNAP_LEN + sizeof(struct pcap_headers) ?
+		       buf_size : PCAP_READ_BUF_SIZE;
+	rd->buf = malloc(rd->buf_size);
+	if (!rd->buf)
+		return ENOMEM;
+	rd->fd = open(fname, O_RDONLY);
+	if (rd->fd < 0) {
+		err = errno;
+		goto free_buf;
+	}
+	posix_fadvise(rd->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	err = pcap_reader_fill(rd);
+	if (err)
+		goto close_fd;
+	ghdr = (struct pcap_global_hdr *)rd->buf;
+	if (rd->len < sizeof(*ghdr) || ghdr->magic_number != PCAP_MAGIC_ORIG) {
+		err = EINVAL;
+		goto close_fd;
+	}
+	rd->pos = sizeof(*ghdr);
+	return 0;
+
+close_fd:
+	close(rd->fd);
+free_buf:
+	free(rd->buf);
+	rd->buf = NULL;
+	rd->fd = -1;
+	return err;
+}
+
+int pcap_reader_fill(struct pcap_reader *rd)
+{
+	ssize_t n;
+
+	memmove(rd->buf, rd->buf + rd->pos, rd->len - rd->pos);
+	rd->off += rd->pos;
+	rd->len -= rd->pos;
+	rd->pos = 0;
+	while (rd->len < rd->buf_size && !rd->eof) {
+		n = read(rd->fd, rd->buf + rd->len, rd->buf_size - rd->len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+		if (!n)
+			rd->eof = 1;
+		rd->len += n;
+	}
+	return 0;
+}
+
+void pcap_reader_close(struct pcap_reader *rd)
+{
+	if (rd->fd >= 0)
+		close(rd->fd);
+	rd->fd = -1;
+	free(rd->buf);
+	rd->buf = NULL;
+}
+
+int pcap_out_open(struct pcap_out *out, const char *fname)
+{
+	memset(out, 0, sizeof(*out));
+	out->iov = calloc(PCAP_OUT_IOV, sizeof(*out->iov));
+	out->buf = malloc(PCAP_OUT_BUF_SIZE);
+	if (!out->iov || !out->buf) {
+		free(out->iov);
+		free(out->buf);
+		return ENOMEM;
+	}
+	out->fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (out->fd < 0) {
+		free(out->iov);
+		free(out->buf);
+		return errno;
+	}
+	out->iov[0].iov_base = (void *)&pcap_ghdr;
+	out->iov[0].iov_len = sizeof(pcap_ghdr);
+	out->num_iov = 1;
+	return 0;
+}
+
+int pcap_out_flush(struct pcap_out *out)
+{
+	struct iovec *iov = out->iov;
+	unsigned int cnt = out->num_iov;
+	ssize_t n;
+
+	while (cnt) {
+		n = writev(out->fd, iov, cnt);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+		/* a short write, go on from where it stopped */
+		while (cnt && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			cnt--;
+		}
+		if (cnt) {
+			iov->iov_base = (uint8_t *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+	out->num_iov = 0;
+	out->buf_used = 0;
+	return 0;
+}
+
+/* the bytes at base join the last run if they follow it */
+static int pcap_out_append(struct pcap_out *out, void *base, size_t len)
+{
+	struct iovec *last;
+	int err;
+
+	if (out->num_iov) {
+		last = &out->iov[out->num_iov - 1];
+		if ((uint8_t *)last->iov_base + last->iov_len == base) {
+			last->iov_len += len;
+			return 0;
+		}
+	}
+	if (out->num_iov == PCAP_OUT_IOV) {
+		err = pcap_out_flush(out);
+		if (unlikely(err))
+			return err;
+	}
+	out->iov[out->num_iov].iov_base = base;
+	out->iov[out->num_iov].iov_len = len;
+	out->num_iov++;
+	return 0;
+}
+
+/* the record is written from where it is mapped */
+int pcap_out_add(struct pcap_out *out, const struct pcap_rec *rec)
+{
+	out->recs++;
+	return pcap_out_append(out, rec->hdr,
+			       sizeof(struct pcap_headers) + rec->len);
+}
+
+/* the record is copied to the buffer, copy gets it there to be edited */
+int pcap_out_add_copy(struct pcap_out *out, const struct pcap_rec *rec,
+		      struct pcap_rec *copy)
+{
+	size_t size = sizeof(struct pcap_headers) + rec->len;
+	struct pcap_headers *hdrs;
+	int err;
 
-	fseek(fpcap, 0, SEEK_CUR); /* just make sure */
+	if (unlikely(size > PCAP_OUT_BUF_SIZE))
+		return EINVAL;
+	/* flushed before the copy, appending it may not flush the buffer */
+	if (out->buf_used + size > PCAP_OUT_BUF_SIZE ||
+	    out->num_iov == PCAP_OUT_IOV) {
+		err = pcap_out_flush(out);
+		if (unlikely(err))
+			return err;
+	}
+	hdrs = (struct pcap_headers *)(out->buf + out->buf_used);
+	memcpy(hdrs, rec->hdr, size);
+	pcap_out_append(out, hdrs, size);
+	out->buf_used += size;
+	out->recs++;
+
+	copy->hdr = &hdrs->pcap_rec;
+	copy->udp = &hdrs->udp;
+	copy->data = hdrs + 1;
+	copy->len = rec->len;
+	copy->off = rec->off;
 	return 0;
 }
+
+int pcap_out_close(struct pcap_out *out)
+{
+	int err;
+
+	err = pcap_out_flush(out);
+	if (close(out->fd) && !err)
+		err = errno;
+	out->fd = -1;
+	free(out->iov);
+	free(out->buf);
+	out->iov = NULL;
+	out->buf = NULL;
+	return err;
+}
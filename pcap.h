@@ -8,8 +8,14 @@
 #define	PCAP_H
 
 #include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
 #include <netinet/in.h>
+#include <netinet/if_ether.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
 #include <arpa/inet.h>
+#include <sys/uio.h>
 
 struct pcap_global_hdr {
 	uint32_t magic_number;	/* magic number */
@@ -37,6 +43,17 @@ struct pcap_record_hdr {
 	uint32_t orig_len;	/* actual length of packet */
 } __attribute__ ((packed));
 
+struct udp_hdrs {
+	struct ether_header ether;
+	struct iphdr ip;
+	struct udphdr udp;
+} __attribute__ ((packed));
+
+struct pcap_headers {
+	struct pcap_record_hdr pcap_rec;
+	struct udp_hdrs udp;
+} __attribute__ ((packed));
+
 struct endpoint_addr {
 	uint8_t mac[8];
 	in_addr_t ip_addr;
@@ -79,10 +96,208 @@ void pcap_file_set_wr_endpoints(
 		   struct endpoint_addr *dst, struct endpoint_addr *src);
 int pcap_file_add_record(unsigned int tsec, unsigned int tusec,
 			 void *data, size_t len);
-int pcap_file_open_rd(char *fname);
-int pcap_file_read_record(void *data, size_t max_len, size_t *rec_len,
-	struct endpoint_addr *dst_ep, struct endpoint_addr *src_ep);
-int pcap_file_replace_last_record(void *data, size_t rec_len);
 void pcap_file_close(void);
 
+/*
+ * Reading: the file is mapped whole and the records are visited in place.
+ * The mapping is followed by PCAP_MAP_SLACK readable bytes, so a record
+ * may be read as a whole itch_packet even when its message is shorter.
+ */
+#define PCAP_MAP_SLACK		4096
+
+struct pcap_map {
+	int fd;
+	uint8_t *base;
+	size_t size;		/* of the file */
+	int writable;
+};
+
+int pcap_map_open(struct pcap_map *map, const char *fname, int writable);
+int pcap_map_create(struct pcap_map *map, const char *fname,
+		    const struct pcap_map *like);
+void pcap_map_close(struct pcap_map *map);
+
+/* a record in place: headers, then len bytes of UDP payload */
+struct pcap_rec {
+	struct pcap_record_hdr *hdr;
+	struct udp_hdrs *udp;
+	void *data;
+	size_t len;
+	size_t off;		/* of the record in the file */
+};
+
+struct pcap_iter {
+	uint8_t *base;
+	size_t pos;
+	size_t end;		/* no record starts at or past it */
+	size_t size;		/* records may not run past it */
+};
+
+/* records from the first one on */
+static inline void pcap_iter_init(struct pcap_iter *it, struct pcap_map *map)
+{
+	it->base = map->base;
+	it->pos = sizeof(struct pcap_global_hdr);
+	it->end = map->size;
+	it->size = map->size;
+}
+
+/* records starting in [from, to), from must be a record boundary;
+ * the last one may run past to, ending where the next range starts */
+static inline void pcap_iter_init_range(struct pcap_iter *it,
+					struct pcap_map *map,
+					size_t from, size_t to)
+{
+	it->base = map->base;
+	it->pos = from;
+	it->end = to < map->size ? to : map->size;
+	it->size = map->size;
+}
+
+/* 0 and the next record in rec, ENOENT past the last one, EINVAL on a
+ * truncated record or one too short for the UDP headers */
+static inline int pcap_iter_next(struct pcap_iter *it, struct pcap_rec *rec)
+{
+	struct pcap_headers *hdrs;
+	size_t incl_len;
+
+	if (it->pos >= it->end)
+		return ENOENT;
+	if (it->size - it->pos < sizeof(*hdrs))
+		return EINVAL;
+	hdrs = (struct pcap_headers *)(it->base + it->pos);
+	incl_len = hdrs->pcap_rec.incl_len;
+	if (incl_len < sizeof(hdrs->udp) ||
+	    incl_len > it->size - it->pos - sizeof(hdrs->pcap_rec))
+		return EINVAL;
+
+	rec->hdr = &hdrs->pcap_rec;
+	rec->udp = &hdrs->udp;
+	rec->data = hdrs + 1;
+	rec->len = incl_len - sizeof(hdrs->udp);
+	rec->off = it->pos;
+	it->pos += sizeof(hdrs->pcap_rec) + incl_len;
+	return 0;
+}
+
+/*
+ * A record boundary at or after off, for walking a part of the file:
+ * a record header agreeing with its Ethernet/IPv4/UDP headers, followed
+ * by PCAP_SYNC_RECS more such records or by the end of the file.
+ * Returns the file size if there is none.
+ */
+#define PCAP_SYNC_RECS		8
+
+size_t pcap_map_resync(struct pcap_map *map, size_t off);
+
+/* ethernet, IP and UDP headers of a datagram carrying len bytes of data,
+ * the checksums computed */
+void pcap_build_udp_hdrs(struct udp_hdrs *h, const struct endpoint_addr *dst,
+			 const struct endpoint_addr *src,
+			 const void *data, size_t len);
+
+void pcap_rec_dst_ep(struct pcap_rec *rec, struct endpoint_addr *ep);
+void pcap_rec_src_ep(struct pcap_rec *rec, struct endpoint_addr *ep);
+void pcap_rec_retarget(struct pcap_rec *rec, const struct endpoint_addr *dst,
+		       const struct endpoint_addr *src);
+
+/*
+ * Reading a file as a stream, through a buffer of its own, for when it is
+ * one of many read at once. pcap_reader_next() returns EAGAIN when the
+ * next record is not in the buffer whole; pcap_reader_fill() then moves
+ * the rest to the start and reads more, so the records returned so far do
+ * not stay put past it.
+ */
+#define PCAP_READ_BUF_SIZE	(4 << 20)
+
+struct pcap_reader {
+	int fd;
+	uint8_t *buf;
+	size_t buf_size;
+	size_t pos;		/* of the next record in buf */
+	size_t len;		/* of the data in buf */
+	size_t off;		/* of buf[0] in the file */
+	int eof;
+};
+
+int pcap_reader_open(struct pcap_reader *rd, const char *fname,
+		     size_t buf_size);
+int pcap_reader_fill(struct pcap_reader *rd);
+void pcap_reader_close(struct pcap_reader *rd);
+
+/* 0 and the next record in rec, ENOENT past the last one, EINVAL on a
+ * truncated record, EAGAIN when the buffer is to be filled first */
+static inline int pcap_reader_next(struct pcap_reader *rd,
+				   struct pcap_rec *rec)
+{
+	struct pcap_headers *hdrs;
+	size_t incl_len, left = rd->len - rd->pos;
+
+	if (left < sizeof(*hdrs)) {
+		if (!rd->eof)
+			return EAGAIN;
+		return left ? EINVAL : ENOENT;
+	}
+	hdrs = (struct pcap_headers *)(rd->buf + rd->pos);
+	incl_len = hdrs->pcap_rec.incl_len;
+	if (incl_len < sizeof(hdrs->udp) ||
+	    sizeof(hdrs->pcap_rec) + incl_len > rd->buf_size)
+		return EINVAL;
+	if (left < sizeof(hdrs->pcap_rec) + incl_len)
+		return rd->eof ? EINVAL : EAGAIN;
+
+	rec->hdr = &hdrs->pcap_rec;
+	rec->udp = &hdrs->udp;
+	rec->data = hdrs + 1;
+	rec->len = incl_len - sizeof(hdrs->udp);
+	rec->off = rd->off + rd->pos;
+	rd->pos += sizeof(hdrs->pcap_rec) + incl_len;
+	return 0;
+}
+
+/*
+ * Writing records taken from a mapped file: runs of them are gathered in
+ * an iovec array and written with writev() straight from the mapping, the
+ * ones to be edited are copied to a buffer first. Both must stay put until
+ * the next flush, which comes every PCAP_OUT_IOV runs or once the buffer
+ * is full, so the writes are large ones.
+ */
+#define PCAP_OUT_IOV		1024
+#define PCAP_OUT_BUF_SIZE	(4 << 20)
+
+struct pcap_out {
+	int fd;
+	struct iovec *iov;
+	unsigned int num_iov;
+	uint8_t *buf;
+	size_t buf_used;
+	unsigned long long recs;
+};
+
+int pcap_out_open(struct pcap_out *out, const char *fname);
+int pcap_out_add(struct pcap_out *out, const struct pcap_rec *rec);
+int pcap_out_add_copy(struct pcap_out *out, const struct pcap_rec *rec,
+		      struct pcap_rec *copy);
+int pcap_out_flush(struct pcap_out *out);
+int pcap_out_close(struct pcap_out *out);
+
+/*
+ * RFC 1624: the checksum of data where len bytes changed from old to new,
+ * computed from the changes alone. len is even and the bytes are at an
+ * even offset of the checksummed data.
+ */
+static inline uint16_t ip_checksum_adjust(uint16_t check, const void *old,
+					  const void *new, size_t len)
+{
+	const uint16_t *o = old, *n = new;
+	uint32_t sum = (uint16_t)~check;
+	size_t i;
+
+	for (i = 0; i < len / 2; i++)
+		sum += (uint16_t)~o[i] + n[i];
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return ~sum;
+}
+
 #endif				/* PCAP_H */
@@ -0,0 +1,219 @@
+/*
+ * File:   phash.c
+ * Summary: minimal perfect hash, hash-and-displace construction
+ *
+ * Keys are spread over num_keys / PHASH_BUCKET_KEYS buckets. Buckets are
+ * placed largest first: for each one a displacement is searched that puts
+ * all of its keys into free slots. Single-key buckets come last and need
+ * no search at all, the displacement is computed to hit the next free
+ * slot directly - this is what makes a table with no spare slots cheap
+ * to build.
+ *
+ * Author: Alexander Nezhinsky (nezhinsky@gmail.com)
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "phash.h"
+
+#define PHASH_MAX_SEEDS		64
+#define PHASH_MAX_TRIES		(1 << 16)
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* displacement that sends the hash straight to the slot: undo the
+ * multiplier on the smallest value phash_range() maps onto the slot */
+static uint32_t phash_disp_inv(uint32_t h, uint32_t slot, uint32_t n)
+{
+	uint32_t v = (uint32_t)((((uint64_t)slot << 32) + n - 1) / n);
+	uint32_t inv = PHASH_SLOT_MUL;
+	int i;
+
+	for (i = 0; i < 5; i++)	/* newton, each step doubles valid bits */
+		inv *= 2 - PHASH_SLOT_MUL * inv;
+	return h ^ (v * inv);
+}
+
+struct phash_build_info {
+	const uint64_t *key;
+	uint64_t *hash;
+	uint32_t *start;	/* bucket members: member[start[b]..start[b+1]) */
+	uint32_t *member;
+	uint32_t *order;	/* buckets by decreasing size */
+	uint8_t *taken;
+};
+
+static void phash_group(struct phash *ph, struct phash_build_info *bi)
+{
+	uint32_t i, b, n = ph->num_keys, nb = ph->num_buckets;
+	uint32_t size, max_size = 0;
+	uint32_t *fill = bi->order;	/* used as scratch first */
+
+	memset(bi->start, 0, (nb + 1) * sizeof(*bi->start));
+	for (i = 0; i < n; i++) {
+		bi->hash[i] = phash_mix(bi->key[i] ^ ph->seed);
+		b = phash_range(bi->hash[i] >> 32, nb);
+		bi->start[b + 1]++;
+	}
+	for (b = 0; b < nb; b++) {
+		if (bi->start[b + 1] > max_size)
+			max_size = bi->start[b + 1];
+		bi->start[b + 1] += bi->start[b];
+	}
+	memcpy(fill, bi->start, nb * sizeof(*fill));
+	for (i = 0; i < n; i++) {
+		b = phash_range(bi->hash[i] >> 32, nb);
+		bi->member[fill[b]++] = i;
+	}
+
+	/* counting sort of the buckets, largest first */
+	i = 0;
+	for (size = max_size; size > 0; size--) {
+		for (b = 0; b < nb; b++) {
+			if (bi->start[b + 1] - bi->start[b] == size)
+				bi->order[i++] = b;
+		}
+	}
+	for (b = 0; b < nb; b++) {
+		if (bi->start[b + 1] == bi->start[b])
+			bi->order[i++] = b;
+	}
+}
+
+static int phash_place(struct phash *ph, struct phash_build_info *bi)
+{
+	uint32_t i, j, k, b, d, slot, try, num, free_slot = 0;
+	uint32_t n = ph->num_keys, nb = ph->num_buckets;
+
+	memset(bi->taken, 0, n);
+	for (i = 0; i < nb; i++) {
+		b = bi->order[i];
+		num = bi->start[b + 1] - bi->start[b];
+		if (num < 2)
+			break;
+
+		for (try = 0; try < PHASH_MAX_TRIES; try++) {
+			d = (uint32_t)phash_mix(ph->seed + try);
+			for (j = 0; j < num; j++) {
+				k = bi->member[bi->start[b] + j];
+				slot = phash_disp_slot((uint32_t)bi->hash[k],
+						       d, n);
+				if (bi->taken[slot])
+					break;
+				bi->taken[slot] = 1;
+			}
+			if (j == num)
+				break;
+			while (j--) {	/* undo the partial placement */
+				k = bi->member[bi->start[b] + j];
+				slot = phash_disp_slot((uint32_t)bi->hash[k],
+						       d, n);
+				bi->taken[slot] = 0;
+			}
+		}
+		if (try == PHASH_MAX_TRIES)
+			return EAGAIN;
+
+		ph->disp[b] = d;
+		for (j = 0; j < num; j++) {
+			k = bi->member[bi->start[b] + j];
+			slot = phash_disp_slot((uint32_t)bi->hash[k], d,
+					       n);
+			ph->keys[slot] = bi->key[k];
+		}
+	}
+
+	/* single-key buckets aim straight at the remaining free slots */
+	for (; i < nb; i++) {
+		b = bi->order[i];
+		if (bi->start[b + 1] == bi->start[b]) {
+			ph->disp[b] = 0;
+			continue;
+		}
+		while (bi->taken[free_slot])
+			free_slot++;
+		k = bi->member[bi->start[b]];
+		ph->disp[b] = phash_disp_inv((uint32_t)bi->hash[k],
+					     free_slot, n);
+		ph->keys[free_slot] = bi->key[k];
+		bi->taken[free_slot] = 1;
+	}
+	return 0;
+}
+
+int phash_build(struct phash *ph, const uint64_t *keys, size_t n)
+{
+	struct phash_build_info bi;
+	uint64_t *uniq;
+	uint32_t i, m, attempt;
+	int err = ENOMEM;
+
+	memset(ph, 0, sizeof(*ph));
+	if (!n)
+		return 0;
+
+	uniq = malloc(n * sizeof(*uniq));
+	if (!uniq) {
+		printf("failed to alloc %zu perfect hash keys\n", n);
+		return ENOMEM;
+	}
+	memcpy(uniq, keys, n * sizeof(*uniq));
+	qsort(uniq, n, sizeof(*uniq), cmp_u64);
+	for (i = 1, m = 1; i < n; i++) {
+		if (uniq[i] != uniq[m - 1])
+			uniq[m++] = uniq[i];
+	}
+
+	ph->num_keys = m;
+	ph->num_buckets = (m + PHASH_BUCKET_KEYS - 1) / PHASH_BUCKET_KEYS;
+	ph->disp = malloc(ph->num_buckets * sizeof(*ph->disp));
+	ph->keys = malloc(m * sizeof(*ph->keys));
+
+	memset(&bi, 0, sizeof(bi));
+	bi.key = uniq;
+	bi.hash = malloc(m * sizeof(*bi.hash));
+	bi.start = malloc((ph->num_buckets + 1) * sizeof(*bi.start));
+	bi.member = malloc(m * sizeof(*bi.member));
+	bi.order = malloc(ph->num_buckets * sizeof(*bi.order));
+	bi.taken = malloc(m);
+	if (!ph->disp || !ph->keys || !bi.hash || !bi.start ||
+	    !bi.member || !bi.order || !bi.taken) {
+		printf("failed to alloc perfect hash of %u keys\n", m);
+		goto out;
+	}
+
+	for (attempt = 0; attempt < PHASH_MAX_SEEDS; attempt++) {
+		ph->seed = phash_mix(0x9e3779b97f4a7c15ULL * (attempt + 1));
+		phash_group(ph, &bi);
+		err = phash_place(ph, &bi);
+		if (!err)
+			break;
+	}
+	if (err)
+		printf("failed to build perfect hash of %u keys\n", m);
+out:
+	free(bi.taken);
+	free(bi.order);
+	free(bi.member);
+	free(bi.start);
+	free(bi.hash);
+	free(uniq);
+	if (err)
+		phash_cleanup(ph);
+	return err;
+}
+
+void phash_cleanup(struct phash *ph)
+{
+	free(ph->disp);
+	free(ph->keys);
+	memset(ph, 0, sizeof(*ph));
+}
@@ -0,0 +1,83 @@
+/*
+ * File:   phash.h
+ * Summary: minimal perfect hash over a static set of 64-bit keys,
+ *          built once at startup, for membership tests on the fast path
+ * Author: Alexander Nezhinsky (nezhinsky@gmail.com)
+ */
+
+#ifndef PHASH_H
+#define	PHASH_H
+
+#include <stdint.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* average keys per displacement bucket */
+#define PHASH_BUCKET_KEYS	4
+
+/* a key lands in bucket (hash >> 32), its slot is picked by the low
+ * hash bits mixed with the bucket's displacement; slots hold the keys
+ * themselves, so a lookup is verified by a single compare */
+	struct phash {
+		uint64_t seed;
+		uint32_t num_keys;	/* == number of slots */
+		uint32_t num_buckets;
+		uint32_t *disp;
+		uint64_t *keys;
+	};
+
+/* duplicate keys are stored once; returns 0 on success, ENOMEM,
+ * or EAGAIN if no displacements could be found (never seen in practice) */
+	int phash_build(struct phash *ph, const uint64_t *keys, size_t n);
+	void phash_cleanup(struct phash *ph);
+
+	static inline uint64_t phash_mix(uint64_t x)
+	{
+		x ^= x >> 33;
+		x *= 0xff51afd7ed558ccdULL;
+		x ^= x >> 33;
+		x *= 0xc4ceb9fe1a85ec53ULL;
+		x ^= x >> 33;
+		return x;
+	}
+
+/* maps a uniform 32-bit value onto [0, n) without a division */
+	static inline uint32_t phash_range(uint32_t h, uint32_t n)
+	{
+		return (uint32_t)(((uint64_t)h * n) >> 32);
+	}
+
+/* odd multiplier: a bijection, so displacements can be solved for */
+#define PHASH_SLOT_MUL	0x9e3779b1u
+
+	static inline uint32_t phash_disp_slot(uint32_t h, uint32_t disp,
+					       uint32_t num_keys)
+	{
+		return phash_range((h ^ disp) * PHASH_SLOT_MUL, num_keys);
+	}
+
+	static inline uint32_t phash_slot(const struct phash *ph, uint64_t key)
+	{
+		uint64_t h = phash_mix(key ^ ph->seed);
+		uint32_t b = phash_range(h >> 32, ph->num_buckets);
+
+		return phash_disp_slot((uint32_t)h, ph->disp[b], ph->num_keys);
+	}
+
+/* returns the key's slot in [0, num_keys), -1 when not in the set */
+	static inline int phash_find(const struct phash *ph, uint64_t key)
+	{
+		uint32_t slot;
+
+		if (!ph->num_keys)
+			return -1;
+		slot = phash_slot(ph, key);
+		return ph->keys[slot] == key ? (int)slot : -1;
+	}
+
+#ifdef	__cplusplus
+}
+#endif
+#endif				/* PHASH_H */
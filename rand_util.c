@@ -28,6 +28,7 @@
  */
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <errno.h>
 #include <assert.h>
@@ -41,12 +42,37 @@ static inline unsigned int rand_seed(void)
 	return (unsigned int)time(NULL);
 }
 
+/*
+ * The numbers are those of random() seeded the same way, from a state of
+ * our own: random() takes a lock on every call, random_r() does not.
+ * Draws are made from one thread at a time.
+ */
+static char rand_state_buf[128];	/* the default random() state size */
+static struct random_data rand_state;
+
+static void rand_state_init(unsigned int seed)
+{
+	rand_state.state = NULL;
+	initstate_r(seed, rand_state_buf, sizeof(rand_state_buf), &rand_state);
+}
+
+static inline long int rand_next(void)
+{
+	int32_t rand_num;
+
+	if (!rand_state.state)
+		rand_state_init(1);	/* as random() before any srandom() */
+	random_r(&rand_state, &rand_num);
+	return rand_num;
+}
+
 void rand_util_init(int use_seed, unsigned int *seed)
 {
 	assert(seed != NULL);
 	if (!use_seed)
 		*seed = rand_seed();
 	srand(*seed);
+	rand_state_init(*seed);
 }
 
 #define RMAX_PERCENT        (RAND_MAX / 100)
@@ -67,7 +93,7 @@ void rand_interval_init(struct rand_interval *ri, size_t n)
 
 static long int random100(void)
 {
-	long int rand_num = random();
+	long int rand_num = rand_next();
 #if RMAX_100 < RAND_MAX
 	if (rand_num > RMAX_100)
 		rand_num = RMAX_100;
@@ -90,21 +116,54 @@ size_t rand_index(struct rand_interval * ri, size_t n)
 
 int rand_int_range(int from, int to)
 {
-	int ret_val = from;
-	long int num_intervals = 1 + to - from;
-	long int rand_num = random();
-	long int rand_interval_sz;
-	int interval_index;
+	assert(to >= from);
+	return rand_int_range_map(rand_next(), from, to);
+}
 
-	assert(num_intervals > 0);
+/*
+ * Batched draws: the raw numbers are taken in one pass, then mapped by
+ * loops free of calls and branches, which the compiler may vectorize.
+ * The mapping is that of the single-value versions.
+ */
+void rand_fill(long int *r, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		r[i] = rand_next();
+}
 
-	rand_interval_sz = RAND_MAX / num_intervals;
-	interval_index = rand_num / rand_interval_sz;
-	if (interval_index == num_intervals)
-		interval_index--;
-	ret_val += interval_index;
+/* index of the interval: the number of intervals ending below the draw */
+void rand_index_fill(unsigned char *v, const long int *r, size_t n,
+		     struct rand_interval *ri, size_t num)
+{
+	long int rand_num;
+	size_t i, k;
 
-	return ret_val;
+	for (i = 0; i < n; i++) {
+		rand_num = r[i] > RMAX_100 ? RMAX_100 : r[i];
+		v[i] = 0;
+		for (k = 0; k < num - 1; k++)
+			v[i] += rand_num > ri[k].to_rmax;
+	}
+}
+
+void rand_range_init(struct rand_range *rr, int from, int to)
+{
+	assert(to >= from);
+	rr->from = from;
+	rr->num_intervals = 1 + to - from;
+}
+
+void rand_int_range_fill(int *v, const long int *r, size_t n,
+			 int from, int to)
+{
+	struct rand_range rr;
+	size_t i;
+
+	rand_range_init(&rr, from, to);
+	for (i = 0; i < n; i++)
+		v[i] = rand_range_map(&rr, r[i]);
 }
 
 int rand_char_capital(void)
@@ -114,32 +173,47 @@ int rand_char_capital(void)
 
 unsigned long long rand_uint64(void)
 {
-	unsigned long long rand64 = (unsigned long long)random();
+	unsigned long long rand64 = (unsigned long long)rand_next();
 
-	return (rand64 << 32) | (unsigned long long)random();
+	return (rand64 << 32) | (unsigned long long)rand_next();
 }
 
 unsigned long rand_uint32(void)
 {
-	return (unsigned long)random();
+	return (unsigned long)rand_next();
 }
 
 const double RAND_MAX_FLOAT = 1.0 + (double)RAND_MAX;
 
 double rand_uniform_one(void)
 {
-	double rand_num = (double)random();
+	double rand_num = (double)rand_next();
 	return (rand_num / RAND_MAX_FLOAT);
 }
 
+/* -log of a uniform value in (0, 1], finite for a draw of 0 */
+static inline double rand_exp_one(long int rand_num)
+{
+	return -log((rand_num + 1.0) / RAND_MAX_FLOAT);
+}
+
 double rand_exp_time_by_rate(double rate)
 {
-	return (-log(rand_uniform_one()) / rate);
+	return rand_exp_one(rand_next()) / rate;
 }
 
 double rand_exp_time_by_mean(double mean)
 {
-	return (-log(rand_uniform_one()) * mean);
+	return rand_exp_one(rand_next()) * mean;
+}
+
+void rand_exp_fill_by_rate(double *t, const long int *r, size_t n,
+			   double rate)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		t[i] = rand_exp_one(r[i]) / rate;
 }
 
 unsigned long dtime_to_sec(double dtime)
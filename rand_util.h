@@ -8,6 +8,9 @@
 #ifndef RAND_UTIL_H
 #define	RAND_UTIL_H
 
+#include <stdlib.h>
+#include <stdint.h>
+
 void rand_util_init(int use_seed, unsigned int *seed);
 
 struct rand_interval {
@@ -25,12 +28,47 @@ unsigned long rand_uint32(void);
 unsigned long long rand_uint64(void);
 
 int rand_int_range(int from, int to);
+
+/*
+ * Maps a random() value, below 2^31, to [from, to]: the draw scaled by the
+ * number of intervals, so the index is below it for any draw, with no
+ * division and no correction
+ */
+static inline int rand_int_range_map(long int rand_num, int from, int to)
+{
+	uint32_t num_intervals = 1 + to - from;
+
+	return from + (int)(uint32_t)(((uint64_t)rand_num * num_intervals) >> 31);
+}
+
+/* the same mapping for a range used over and over */
+struct rand_range {
+	int from;
+	uint32_t num_intervals;
+};
+
+void rand_range_init(struct rand_range *rr, int from, int to);
+
+static inline int rand_range_map(const struct rand_range *rr,
+				 long int rand_num)
+{
+	return rr->from +
+	    (int)(uint32_t)(((uint64_t)rand_num * rr->num_intervals) >> 31);
+}
+
+void rand_fill(long int *r, size_t n);
+void rand_index_fill(unsigned char *v, const long int *r, size_t n,
+		     struct rand_interval *ri, size_t num);
+void rand_int_range_fill(int *v, const long int *r, size_t n,
+			 int from, int to);
 int rand_char_capital(void);
 
 double rand_uniform_one(void);
 
 double rand_exp_time_by_rate(double rate);
 double rand_exp_time_by_mean(double mean);
+void rand_exp_fill_by_rate(double *t, const long int *r, size_t n,
+			   double rate);
 
 unsigned long dtime_to_sec(double dtime);
 unsigned long dtime_to_nsec(double dtime);
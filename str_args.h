@@ -73,6 +73,31 @@ static inline int bad_optarg(int err, const char *arg, char *optarg)
 	return err;
 }
 
+/* mac address as xx:xx:xx:xx:xx:xx, or with - or . separators */
+static inline int str_to_mac(char *str, uint8_t * mac)
+{
+	int i, err;
+	char ch = 0;
+
+	if (strlen(str) != 17)
+		return EINVAL;
+
+	for (i = 0; i < 6; i++) {
+		if (i < 5) {
+			ch = str[3 * i + 2];
+			if (ch != ':' && ch != '-' && ch != '.')
+				return EINVAL;
+			str[3 * i + 2] = 0;
+		}
+		err = str_to_int_range(&str[3 * i], mac[i], 0, 255, 16);
+		if (i < 5)
+			str[3 * i + 2] = ch;
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
 #ifdef	__cplusplus
 }
 #endif
@@ -48,7 +48,7 @@ void usync_queue_init(struct usync_queue *q)
 	q->active = 1;
 }
 
-inline void usync_queue_push_list_(struct usync_queue *q,
+static inline void usync_queue_push_list_(struct usync_queue *q,
 	struct ulist_head *h)
 {
 	pthread_mutex_lock(&q->qlist_mutex);
@@ -113,6 +113,20 @@ int usync_queue_pull_list(struct usync_queue *q, struct ulist_head *h)
 	return err;
 }
 
+int usync_queue_try_pull_list(struct usync_queue *q, struct ulist_head *h)
+{
+	int err = -1;
+
+	pthread_mutex_lock(&q->qlist_mutex);
+	if (!ulist_empty(&q->qlist)) {
+		ulist_append_list(h, &q->qlist);
+		err = 0;
+	}
+	pthread_mutex_unlock(&q->qlist_mutex);
+
+	return err;
+}
+
 void usync_queue_shutdown(struct usync_queue *q)
 {
 	pthread_mutex_lock(&q->qlist_mutex);
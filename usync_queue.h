@@ -36,6 +36,8 @@ const void *usync_queue_pop_(struct usync_queue *q, size_t off);
 	((type *)usync_queue_pop_(q, ulist_off_(type, member)))
 
 int usync_queue_pull_list(struct usync_queue *q, struct ulist_head *h);
+/* does not wait, returns -1 if the queue is empty */
+int usync_queue_try_pull_list(struct usync_queue *q, struct ulist_head *h);
 
 void usync_queue_shutdown(struct usync_queue *q);
 